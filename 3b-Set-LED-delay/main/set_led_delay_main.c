@@ -16,16 +16,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include "led_strip.h"
+#include "line_reader.h"
 
 /**
- * This is an example which echos any data it receives on configured UART back to the sender,
- * with hardware flow control turned off. It does not use UART driver event queue.
+ * Blinks the LED with a delay in ms that's set by typing a number and pressing enter on the
+ * configured UART, with hardware flow control turned off. Lines are read by the shared
+ * Line-Reader component off the UART driver's event queue.
  *
  * - Port: configured UART
  * - Receive (Rx) buffer: on
  * - Transmit (Tx) buffer: off
  * - Flow control: off
- * - Event queue: off
+ * - Event queue: on, used by the line reader
  * - Pin assignment: see defines below (See Kconfig)
  */
 
@@ -42,6 +44,7 @@
 int delay = 1000;
 static const char *TAG = "UART TEST";
 led_strip_handle_t led;
+static line_reader_t* reader;
 
 
 void led_init(void) {
@@ -75,9 +78,17 @@ void led_blink_task(void* param) {
     }
 }
 
+// Called by the line reader with each line typed
+static void on_line(const char* line, size_t len, void* ctx) {
+    if (len > 0) {
+        delay = atoi(line);
+        ESP_LOGI(TAG, "delay = %d", delay);
+    }
+}
+
 void uart_init(void) {
     /* Configure parameters of an UART driver,
-     * communication pins and install the driver */
+     * communication pins and start the line reader, which installs the driver */
     uart_config_t uart_config = {
         .baud_rate = ECHO_UART_BAUD_RATE,
         .data_bits = UART_DATA_8_BITS,
@@ -86,47 +97,22 @@ void uart_init(void) {
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
         .source_clk = UART_SCLK_DEFAULT,
     };
+    line_reader_config_t reader_config = {
+        .uart_num = ECHO_UART_PORT_NUM,
+        .rx_buffer_size = BUF_SIZE * 2,
+        .on_line = on_line,
+        .task_priority = 10,
+        .task_stack = TASK_STACK_SIZE,
+    };
 
-    ESP_ERROR_CHECK(uart_driver_install(ECHO_UART_PORT_NUM, BUF_SIZE * 2, 0, 0, NULL, 0));
     ESP_ERROR_CHECK(uart_param_config(ECHO_UART_PORT_NUM, &uart_config));
     ESP_ERROR_CHECK(uart_set_pin(ECHO_UART_PORT_NUM, ECHO_TEST_TXD, ECHO_TEST_RXD, ECHO_TEST_RTS, ECHO_TEST_CTS));
-}
-
-static void uart_listen_task(void *arg)
-{
-    // Configure a temporary buffer for the incoming data
-    uint8_t *data = (uint8_t *) malloc(BUF_SIZE);
-    char buf[5];
-    memset(buf, 0, 5);
-    int idx = 0;
-
-    while (1) {
-        // Read data from the UART
-        int len = uart_read_bytes(ECHO_UART_PORT_NUM, data, (BUF_SIZE - 1), 10 / portTICK_PERIOD_MS);
-        // Write data back to the UART
-        //uart_write_bytes(ECHO_UART_PORT_NUM, (const char *) data, len);
-        
-        if (len) {
-            //ESP_LOGI(TAG, "data[0] = %d", data[0]);
-
-            if (((data[0] == '\n') || (data[0] == '\r')) && (idx > 0)) {
-                buf[idx] = '\0';
-                delay = atoi(buf);
-                idx = 0;
-            }
-            else {
-                buf[idx] = data[0];
-                idx++;
-            }
-            ESP_LOGI(TAG, "delay = %d", delay);
-        }
-    }
+    ESP_ERROR_CHECK(line_reader_start(&reader_config, &reader));
 }
 
 void app_main(void)
 {
     led_init();
     uart_init();
-    xTaskCreate(uart_listen_task, "uart_listen_task", TASK_STACK_SIZE, NULL, 10, NULL);
     xTaskCreate(led_blink_task, "led_blink_task", TASK_STACK_SIZE, NULL, 10, NULL);
 }
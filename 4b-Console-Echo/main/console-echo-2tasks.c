@@ -8,22 +8,32 @@
 */
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "driver/uart.h"
 #include "driver/gpio.h"
 #include "sdkconfig.h"
 #include "esp_log.h"
+#include "line_reader.h"
 
 /**
- * This is an example which echos any data it receives on configured UART back to the sender,
- * with hardware flow control turned off. It does not use UART driver event queue.
+ * This is an example which echos each line it receives on configured UART to the log from a
+ * second task, with hardware flow control turned off. Lines are read by the shared
+ * Line-Reader component off the UART driver's event queue.
+ *
+ * Lines go from the reader to the speak task in a fixed pool of MSG_POOL_SIZE messages, so
+ * there's no heap use per line. A free queue and a ready queue pass pointers into the pool
+ * around, and the speak task sleeps on the ready one. Up to MSG_POOL_SIZE lines can wait for
+ * the echo at once. Past that a line is turned away and counted. An empty line prints the
+ * counts.
  *
  * - Port: configured UART
  * - Receive (Rx) buffer: on
  * - Transmit (Tx) buffer: off
  * - Flow control: off
- * - Event queue: off
+ * - Event queue: on, used by the line reader
  * - Pin assignment: see defines below (See Kconfig)
  */
 
@@ -35,15 +45,81 @@
 #define ECHO_UART_BAUD_RATE     (CONFIG_EXAMPLE_UART_BAUD_RATE)
 #define ECHO_TASK_STACK_SIZE    (CONFIG_EXAMPLE_TASK_STACK_SIZE)
 #define BUF_SIZE (1024)
+#define MSG_POOL_SIZE 8         // Lines that can wait for the echo at once
+#define MSG_SIZE 256            // Longest line kept, plus the NUL
+#define ECHO_DELAY_MS 1000      // Pause after each echo
+
+// A line waiting for the echo. Lives in pool, handed around by pointer
+typedef struct {
+    size_t len;
+    char text[MSG_SIZE];
+} message_t;
 
-static char* message = NULL;
-static volatile uint8_t message_ready = 0;
+typedef struct {
+    uint32_t echoed;            // Lines echoed
+    uint32_t turned_away;       // Lines that found every message in use
+    uint32_t max_in_flight;     // Most messages in use at once
+} message_stats_t;
+
+static message_t pool[MSG_POOL_SIZE];
+static QueueHandle_t free_msgs;     // message_t*, pool entries not in use
+static QueueHandle_t ready_msgs;    // message_t*, lines waiting for the echo, oldest first
+static message_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
 static const char *TAG = "UART TEST";
+static line_reader_t* reader;
 
 
+void message_pool_init(void) {
+    // Both can hold the whole pool, so a send never fails or waits
+    free_msgs = xQueueCreate(MSG_POOL_SIZE, sizeof(message_t*));
+    ready_msgs = xQueueCreate(MSG_POOL_SIZE, sizeof(message_t*));
+    for (size_t i = 0; i < MSG_POOL_SIZE; i++) {
+        message_t* msg = &pool[i];
+        xQueueSend(free_msgs, &msg, 0);
+    }
+}
+
+void get_message_stats(message_stats_t* out) {
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+// Called by the line reader with each line typed
+static void on_line(const char* line, size_t len, void* ctx) {
+    message_t* msg;
+    message_stats_t s;
+
+    if (len == 0) {
+        get_message_stats(&s);
+        ESP_LOGI(TAG, "Enter some text to echo. (%" PRIu32 " echoed, %" PRIu32 " turned away, %" PRIu32 " of %d waiting at most)",
+                 s.echoed, s.turned_away, s.max_in_flight, MSG_POOL_SIZE);
+    }
+    else if (xQueueReceive(free_msgs, &msg, 0) == pdTRUE) {
+        // The reader keeps lines to MSG_SIZE - 1, so it always fits
+        msg->len = len;
+        memcpy(msg->text, line, len + 1);
+        xQueueSend(ready_msgs, &msg, 0);
+
+        uint32_t in_flight = MSG_POOL_SIZE - uxQueueMessagesWaiting(free_msgs);
+        portENTER_CRITICAL(&stats_lock);
+        if (in_flight > stats.max_in_flight) {
+            stats.max_in_flight = in_flight;
+        }
+        portEXIT_CRITICAL(&stats_lock);
+    }
+    else {
+        portENTER_CRITICAL(&stats_lock);
+        stats.turned_away++;
+        portEXIT_CRITICAL(&stats_lock);
+        ESP_LOGI(TAG, "%d lines already waiting for echo. Try again.", MSG_POOL_SIZE);
+    }
+}
+
 void uart_init(void) {
     /* Configure parameters of an UART driver,
-     * communication pins and install the driver */
+     * communication pins and start the line reader, which installs the driver */
     uart_config_t uart_config = {
         .baud_rate = ECHO_UART_BAUD_RATE,
         .data_bits = UART_DATA_8_BITS,
@@ -52,63 +128,40 @@ void uart_init(void) {
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
         .source_clk = UART_SCLK_DEFAULT,
     };
+    line_reader_config_t reader_config = {
+        .uart_num = ECHO_UART_PORT_NUM,
+        .rx_buffer_size = BUF_SIZE * 2,
+        .max_line = MSG_SIZE - 1,
+        .on_line = on_line,
+        .task_priority = 10,
+        .task_stack = 1024 * 3,
+    };
 
     ESP_ERROR_CHECK(uart_param_config(ECHO_UART_PORT_NUM, &uart_config));
-    ESP_ERROR_CHECK(uart_driver_install(ECHO_UART_PORT_NUM, BUF_SIZE * 2, 0, 0, NULL, 0));
     ESP_ERROR_CHECK(uart_set_pin(ECHO_UART_PORT_NUM, ECHO_TEST_TXD, ECHO_TEST_RXD, ECHO_TEST_RTS, ECHO_TEST_CTS));
+    ESP_ERROR_CHECK(line_reader_start(&reader_config, &reader));
 }
 
-void uart_listen_task(void* param) {
-    // Configure a temporary buffer for the incoming data
-    uint8_t *data = (uint8_t *) malloc(BUF_SIZE);
-
-    char buf[BUF_SIZE];
-    size_t idx = 0;
+void uart_speak_task(void* param) {
+    message_t* msg;
 
     while (1) {
-        // Read data from the UART
-        int len = uart_read_bytes(ECHO_UART_PORT_NUM, data, (BUF_SIZE - 1), 20 / portTICK_PERIOD_MS);
-
-        if (len) {
-            if (data[0] == '\n' || data[0] == '\r') {
-                if (idx == 0) {
-                    ESP_LOGI(TAG, "Enter some text to echo.");
-                }
-                else if (!message_ready) {
-                    buf[idx] = '\0';
-                    message = (char*)pvPortMalloc((idx+1) * sizeof(char));
-                    memcpy(message, buf, idx+1);
-                    idx = 0;
-                    message_ready = 1;
-                }
-                else {
-                    ESP_LOGI(TAG, "Wait for echo. Try again.");
-                }
-            }
-            else {
-                buf[idx] = data[0];
-                idx++;
-            }
-        }
-    }
-}
+        // Sleep until a line is waiting
+        xQueueReceive(ready_msgs, &msg, portMAX_DELAY);
+        ESP_LOGI(TAG, "%s", msg->text);
+        xQueueSend(free_msgs, &msg, 0);
 
-void uart_speak_task(void* param) {
-    while (1) {
-    vTaskDelay(10 / portTICK_PERIOD_MS);
-        if (message_ready) {
-            ESP_LOGI(TAG, "%s", message);
-            vPortFree(message);
-            message = NULL;
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            message_ready = 0;
-        }
+        portENTER_CRITICAL(&stats_lock);
+        stats.echoed++;
+        portEXIT_CRITICAL(&stats_lock);
+        vTaskDelay(ECHO_DELAY_MS / portTICK_PERIOD_MS);
     }
 }
 
 void app_main(void)
 {
+    // Before the line reader starts handing lines over
+    message_pool_init();
     uart_init();
-    xTaskCreate(uart_listen_task, "uart_listen_task", 1024 * 3, NULL, 10, NULL);
     xTaskCreate(uart_speak_task, "uart_speak_task", ECHO_TASK_STACK_SIZE, NULL, 10, NULL);
 }
@@ -17,16 +17,18 @@
 #include <string.h>
 #include "led_strip.h"
 #include "freertos/queue.h"
+#include "line_reader.h"
 
 /**
- * This is an example which echos any data it receives on configured UART back to the sender,
- * with hardware flow control turned off. It does not use UART driver event queue.
+ * This is an example which echos each line it receives on configured UART back to the sender
+ * and takes "delay <ms>" commands for the LED, with hardware flow control turned off. Lines
+ * are read by the shared Line-Reader component off the UART driver's event queue.
  *
  * - Port: configured UART
  * - Receive (Rx) buffer: on
  * - Transmit (Tx) buffer: off
  * - Flow control: off
- * - Event queue: off
+ * - Event queue: on, used by the line reader
  * - Pin assignment: see defines below (See Kconfig)
  */
 
@@ -47,6 +49,7 @@ static const char *TAG = ">";
 static led_strip_handle_t led;
 static QueueHandle_t delay_queue;
 static QueueHandle_t msg_queue;
+static line_reader_t* reader;
 
 
 void led_init(void) {
@@ -100,9 +103,28 @@ void led_blink_task(void* param) {
     }
 }
 
+/**
+ * Called by the line reader with each line of serial input.
+ * Evaluates the "delay" command if present, then echoes the line.
+ */
+static void on_line(const char* line, size_t len, void* ctx) {
+    // Process delay command
+    if (strncmp(line, "delay ", 6) == 0) {
+        int delay = atoi(line + 6);
+
+        if (xQueueSend(delay_queue, &delay, 10) != pdTRUE) {
+            ESP_LOGI(TAG, "Delay Queue push error");
+        }
+    }
+
+    /* UART Echo */
+    uart_write_bytes(ECHO_UART_PORT_NUM, line, len);
+    uart_write_bytes(ECHO_UART_PORT_NUM, "\r\n", 2);
+}
+
 void uart_init(void) {
     /* Configure parameters of an UART driver,
-     * communication pins and install the driver */
+     * communication pins and start the line reader, which installs the driver */
     uart_config_t uart_config = {
         .baud_rate = ECHO_UART_BAUD_RATE,
         .data_bits = UART_DATA_8_BITS,
@@ -111,72 +133,32 @@ void uart_init(void) {
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
         .source_clk = UART_SCLK_DEFAULT,
     };
+    line_reader_config_t reader_config = {
+        .uart_num = ECHO_UART_PORT_NUM,
+        .rx_buffer_size = BUF_SIZE * 2,
+        .max_line = BUF_SIZE - 1,
+        .on_line = on_line,
+        .task_priority = 10,
+        .task_stack = 2 * TASK_STACK_SIZE,
+    };
 
-    ESP_ERROR_CHECK(uart_driver_install(ECHO_UART_PORT_NUM, BUF_SIZE * 2, 0, 0, NULL, 0));
     ESP_ERROR_CHECK(uart_param_config(ECHO_UART_PORT_NUM, &uart_config));
     ESP_ERROR_CHECK(uart_set_pin(ECHO_UART_PORT_NUM, ECHO_TEST_TXD, ECHO_TEST_RXD, ECHO_TEST_RTS, ECHO_TEST_CTS));
+    ESP_ERROR_CHECK(line_reader_start(&reader_config, &reader));
 }
 
 /**
- * Prints messages from queue 2.
- * Then reads serial input. Echoes a line and evaluates "delay" command upon newline or carriage return if present.
+ * Prints messages from queue 2 as they come in.
  */
 static void serial_com_task(void *arg) {
     // Message queue buffer to read messages into
     char msgBuf[MSG_SIZE];
     memset(msgBuf, 0, MSG_SIZE);
 
-    // This program's UART buffer
-    uint8_t *data = (uint8_t *) malloc(BUF_SIZE);
-
-    // Buffer to capture a line of input
-    char line[BUF_SIZE];
-    memset(line, 0, BUF_SIZE);
-    int idx = 0;
-
-    // Delay to pass into delay_queue
-    int delay = 1000;
-
     while (1) {
-        // First print a message from queue if ready
-        if (xQueueReceive(msg_queue, &msgBuf, 10) == pdTRUE) {
+        if (xQueueReceive(msg_queue, &msgBuf, portMAX_DELAY) == pdTRUE) {
             ESP_LOGI(TAG, "%s", msgBuf);
         }
-
-        // Read a character from UART
-        int len = uart_read_bytes(ECHO_UART_PORT_NUM, data, (BUF_SIZE - 1), 10 / portTICK_PERIOD_MS);
-        
-        if (len) {
-            line[idx] = data[0];
-
-            // Process new line
-            if (line[idx] == '\n' || line[idx] == '\r') {
-                // Process delay command
-                if (memcmp(line, "delay ", 6) == 0) {
-                    char* textualDelay = line + 6;
-                    delay = atoi(textualDelay);
-
-                    if (xQueueSend(delay_queue, &delay, 10) != pdTRUE) {
-                        ESP_LOGI(TAG, "Delay Queue push error");
-                    }
-                }
-
-                // ESP_LOG Echo
-                //line[idx] = '\0';
-                //ESP_LOGI(TAG, "%s", line);
-                
-                /* UART Echo */
-                uart_write_bytes(ECHO_UART_PORT_NUM, line, BUF_SIZE);
-                memset(line, 0, BUF_SIZE);
-                
-                
-                idx = 0;
-            }
-            // Wait for newline or carriage return
-            else {
-                idx++;
-            }
-        }
     }
 }
 
@@ -185,14 +167,16 @@ void app_main(void)
 {
     vTaskDelay(3000 / portTICK_PERIOD_MS);
     led_init();
-    uart_init();
 
-    // Queue 1 to send delay time from serial_com_task to led_blink_task
+    // Queue 1 to send delay time from the line reader to led_blink_task
     delay_queue = xQueueCreate(DELAY_QUEUE_SIZE, sizeof(int));
     // Queue 2 to send blinked message from led_blink_task to serial_com_task
     msg_queue = xQueueCreate(MSG_QUEUE_SIZE, MSG_SIZE);
 
-    xTaskCreate(serial_com_task, "uart_listen_task", 2 * TASK_STACK_SIZE, NULL, 10, NULL);
+    // After the queues, the line reader sends to delay_queue as soon as it's started
+    uart_init();
+
+    xTaskCreate(serial_com_task, "serial_com_task", TASK_STACK_SIZE, NULL, 10, NULL);
     xTaskCreate(led_blink_task, "led_blink_task", TASK_STACK_SIZE, NULL, 10, NULL);
 }
 
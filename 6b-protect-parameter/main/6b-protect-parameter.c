@@ -14,6 +14,7 @@
 #include "freertos/task.h"
 #include "driver/uart.h"
 #include "freertos/semphr.h"
+#include "line_reader.h"
 
 
 // GPIO assignment
@@ -27,6 +28,7 @@
 static const char* TAG = ">";
 static led_strip_handle_t led = NULL;
 static SemaphoreHandle_t mutex;
+static line_reader_t* reader;
 
 
 led_strip_handle_t configure_led(void) {
@@ -84,9 +86,15 @@ void uart_init(void) {
     ESP_ERROR_CHECK(uart_param_config(UART_PORT_NUM, &uart_config));
     ESP_ERROR_CHECK(uart_set_pin(UART_PORT_NUM, 16, 17, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
+    // The line reader installs the driver and queues up the lines typed
     const int uart_buffer_size = (1024 * 2);
-    QueueHandle_t uart_queue;
-    ESP_ERROR_CHECK(uart_driver_install(UART_PORT_NUM, uart_buffer_size, uart_buffer_size, 10, &uart_queue, 0));
+    line_reader_config_t reader_config = {
+        .uart_num = UART_PORT_NUM,
+        .rx_buffer_size = uart_buffer_size,
+        .tx_buffer_size = uart_buffer_size,
+        .task_priority = 5,
+    };
+    ESP_ERROR_CHECK(line_reader_start(&reader_config, &reader));
 }
 
 
@@ -99,29 +107,15 @@ void app_main(void) {
 
     int delay_arg = 1000;
 
-    // Program UART buffer
-    uint8_t data[32];
     // Command parsed from UART
     char cmd[32];
-    size_t idx = 0;
 
     printf("Enter a number for delay (ms):\n");
     //ESP_LOGI(TAG, "Enter a number for delay (ms):\n");
 
-    while (data[0] != '\r' && data[0] != '\n') {
-        size_t len = 0;
-        // See how much data is in the UART Rx FIFO
-        ESP_ERROR_CHECK(uart_get_buffered_data_len(UART_PORT_NUM, &len));
-        // Read that much data into the program buffer
-        len = uart_read_bytes(UART_PORT_NUM, data, len, 0);
-
-        if (len) {
-            cmd[idx] = data[0];
-            idx++;
-        }
-        vTaskDelay(pdMS_TO_TICKS(10));
-    }
-    cmd[idx-1] = '\0';
+    // Sleep until a line comes in
+    line_reader_receive(reader, cmd, sizeof(cmd), portMAX_DELAY);
+    ESP_ERROR_CHECK(line_reader_stop(reader));
     delay_arg = atoi(cmd);
 
     //xSemaphoreTake(mutex, portMAX_DELAY);
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "adc_cal.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#endif
+
+
+// Top of the recommended input range at each attenuation
+static const int16_t full_scale_mv[] = {950, 1250, 1750, 3100};
+
+
+int adc_cal_nominal_mv(adc_cal_atten_t atten, int raw) {
+    return (raw * full_scale_mv[atten] + (ADC_CAL_LUT_LEN - 1) / 2) / (ADC_CAL_LUT_LEN - 1);
+}
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+// Run the chip's calibration over every code. ESP_ERR_NOT_SUPPORTED if it has none
+static esp_err_t fill_calibrated(int16_t* mv, uint8_t unit, uint8_t channel, adc_cal_atten_t atten) {
+    adc_cali_handle_t handle = NULL;
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = (adc_unit_t)unit,
+        .chan = (adc_channel_t)channel,
+        .atten = (adc_atten_t)atten,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    err = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    adc_cali_line_fitting_config_t cali_config = {
+        .unit_id = (adc_unit_t)unit,
+        .atten = (adc_atten_t)atten,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    err = adc_cali_create_scheme_line_fitting(&cali_config, &handle);
+#endif
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (int raw = 0; raw < ADC_CAL_LUT_LEN && err == ESP_OK; raw++) {
+        int v;
+        err = adc_cali_raw_to_voltage(handle, raw, &v);
+        mv[raw] = (int16_t)v;
+    }
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_delete_scheme_curve_fitting(handle);
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    adc_cali_delete_scheme_line_fitting(handle);
+#endif
+    return err;
+}
+#endif
+
+esp_err_t adc_cal_lut_init(adc_cal_lut_t* lut, uint8_t unit, uint8_t channel, adc_cal_atten_t atten) {
+    if (lut == NULL || atten > ADC_CAL_ATTEN_DB_12) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    lut->mv = malloc(ADC_CAL_LUT_LEN * sizeof(int16_t));
+    if (lut->mv == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    lut->calibrated = false;
+#ifndef CONFIG_IDF_TARGET_LINUX
+    lut->calibrated = (fill_calibrated(lut->mv, unit, channel, atten) == ESP_OK);
+#endif
+    if (!lut->calibrated) {
+        for (int raw = 0; raw < ADC_CAL_LUT_LEN; raw++) {
+            lut->mv[raw] = (int16_t)adc_cal_nominal_mv(atten, raw);
+        }
+    }
+    return ESP_OK;
+}
+
+void adc_cal_lut_free(adc_cal_lut_t* lut) {
+    free(lut->mv);
+    lut->mv = NULL;
+}
+
+void adc_cal_lut_convert(const adc_cal_lut_t* lut, const int16_t* raw, int16_t* mv, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        mv[i] = adc_cal_lut_mv(lut, raw[i]);
+    }
+}
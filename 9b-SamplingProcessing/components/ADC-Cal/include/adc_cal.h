@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Raw ADC code to millivolt conversion through a table built once per channel.
+ *
+ * adc_cali_raw_to_voltage runs the chip's calibration curve (line or curve fitting from the
+ * eFuse values, depending on the chip) through 64-bit integer maths for every sample, which
+ * adds up at tens of kHz. The curve only depends on the unit, channel and attenuation, so
+ * adc_cal_lut_init runs it once for every possible code and keeps the answers: 4096 int16_t
+ * (8 KB) for a 12-bit ADC. Converting a block is then one load per sample.
+ *
+ * If the chip has no calibration values burnt in, or on the linux target, the table is the
+ * nominal straight line for the attenuation instead and calibrated says so.
+ */
+
+#define ADC_CAL_BITS 12
+#define ADC_CAL_LUT_LEN (1 << ADC_CAL_BITS)
+
+// Same values as adc_atten_t
+typedef enum {
+    ADC_CAL_ATTEN_DB_0 = 0,
+    ADC_CAL_ATTEN_DB_2_5 = 1,
+    ADC_CAL_ATTEN_DB_6 = 2,
+    ADC_CAL_ATTEN_DB_12 = 3,
+} adc_cal_atten_t;
+
+typedef struct {
+    int16_t* mv;            // mV of every raw code
+    bool calibrated;        // From the chip's calibration values, not the nominal line
+} adc_cal_lut_t;
+
+// Build the table for one channel of an ADC unit (0 for ADC1) at an attenuation
+esp_err_t adc_cal_lut_init(adc_cal_lut_t* lut, uint8_t unit, uint8_t channel, adc_cal_atten_t atten);
+void adc_cal_lut_free(adc_cal_lut_t* lut);
+
+// Codes outside 0..ADC_CAL_LUT_LEN - 1 read as the nearest end of the table, so a glitch
+// reads as the rail it's past rather than some unrelated voltage
+static inline int16_t adc_cal_lut_mv(const adc_cal_lut_t* lut, int16_t raw) {
+    return lut->mv[(raw < 0) ? 0 : (raw >= ADC_CAL_LUT_LEN) ? ADC_CAL_LUT_LEN - 1 : raw];
+}
+
+// mv[i] = mV of raw[i]. raw and mv can be the same block
+void adc_cal_lut_convert(const adc_cal_lut_t* lut, const int16_t* raw, int16_t* mv, size_t n);
+
+// Nominal mV of a raw code at an attenuation, what the table falls back to
+int adc_cal_nominal_mv(adc_cal_atten_t atten, int raw);
@@ -0,0 +1,517 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "ADC-sampler-priv.h"
+
+
+ADC_sampler_state_t ADC_sampler = {0};
+
+// Counted from the sampling path, so they're atomics rather than behind a lock. busy_us and
+// deliver_us are 64-bit, which isn't lock-free on the chip, and they're only added once per frame
+static struct {
+    atomic_uint frames;
+    atomic_uint samples;
+    atomic_uint overruns;
+    atomic_uint dropped_frames;
+    atomic_uint overwritten_frames;
+    atomic_uint dropped_samples;
+    atomic_uint overwritten_samples;
+    atomic_uint spare_frames_used;
+    atomic_uint rate_changes;
+    atomic_uint crossings;
+    atomic_uint dropped_crossings;
+} counters;
+static int64_t busy_us = 0;
+static int64_t deliver_us = 0;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static latency_hist_t jitter_hist;
+static latency_hist_t read_latency_hist;
+// Last ADC_SAMPLER_RATE_LOG_LEN rate changes. Written once per change by the sampler task
+static struct {
+    ADC_sampler_rate_change_t entries[ADC_SAMPLER_RATE_LOG_LEN];
+    uint32_t count;             // Changes logged since config. The next goes in entries[count % LEN]
+} rate_log;
+static portMUX_TYPE rate_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static inline void count(atomic_uint* counter, uint32_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+// Pick the next frame to write into: a free pool frame if there is one, otherwise whatever the
+// overrun policy allows, otherwise scratch. Never waits
+static void next_frame(void) {
+    if (xQueueReceive(ADC_sampler.free_q, &ADC_sampler.cur, 0) == pdTRUE) {
+        return;
+    }
+
+    switch (ADC_sampler.config.overrun_policy) {
+    case ADC_SAMPLER_OVERRUN_OVERWRITE_OLDEST:
+        // Not acquired yet, so it's still ours to take back. If the consumer grabs it first
+        // there's nothing left in ready_q and we fall through to scratch. If subscribers still
+        // have it, taking it away from the main consumer is all we can do: the last of them
+        // to release it recycles it
+        if (xQueueReceive(ADC_sampler.ready_q, &ADC_sampler.cur, 0) == pdTRUE) {
+            count(&counters.overwritten_frames, 1);
+            count(&counters.overwritten_samples, ADC_sampler.cur->frame.len * ADC_sampler.config.num_channels);
+            if (atomic_fetch_sub(&ADC_sampler.cur->refs, 1) == 1) {
+                return;
+            }
+        }
+        break;
+    case ADC_SAMPLER_OVERRUN_SPARE_POOL:
+        if (xQueueReceive(ADC_sampler.spare_q, &ADC_sampler.cur, 0) == pdTRUE) {
+            atomic_fetch_add(&ADC_sampler.spares_out, 1);
+            count(&counters.spare_frames_used, 1);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    ADC_sampler.cur = ADC_sampler.scratch;
+}
+
+// Put a frame the consumer is done with back. While spares are out the first frames back
+// refill the spare pool, so the pool shrinks back to num_frames once the consumer catches up
+static void recycle(ADC_sampler_buf_t* buf) {
+    unsigned out = atomic_load(&ADC_sampler.spares_out);
+    while (out > 0) {
+        if (atomic_compare_exchange_weak(&ADC_sampler.spares_out, &out, out - 1)) {
+            xQueueSend(ADC_sampler.spare_q, &buf, 0);
+            return;
+        }
+    }
+    xQueueSend(ADC_sampler.free_q, &buf, 0);
+}
+
+// Drop one consumer's reference to a frame, recycling it if that was the last
+static void unref(ADC_sampler_buf_t* buf) {
+    if (atomic_fetch_sub(&buf->refs, 1) == 1) {
+        recycle(buf);
+    }
+}
+
+esp_err_t ADC_sampler_state_init(const ADC_sampler_config_t* config, TaskFunction_t task_fn) {
+    if (config == NULL || config->frame_len == 0 || config->sample_rate_hz == 0 ||
+        config->num_channels == 0 || config->num_channels > ADC_SAMPLER_MAX_CHANNELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ADC_sampler.task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ADC_sampler.config = *config;
+    if (ADC_sampler.config.num_frames == 0) {
+        ADC_sampler.config.num_frames = ADC_SAMPLER_DEFAULT_FRAMES;
+    }
+    if (ADC_sampler.config.overrun_policy != ADC_SAMPLER_OVERRUN_SPARE_POOL) {
+        ADC_sampler.config.num_spare_frames = 0;
+    }
+    else if (ADC_sampler.config.num_spare_frames == 0) {
+        ADC_sampler.config.num_spare_frames = ADC_SAMPLER_DEFAULT_SPARE_FRAMES;
+    }
+    const size_t num_frames = ADC_sampler.config.num_frames;
+    const size_t num_spares = ADC_sampler.config.num_spare_frames;
+    const size_t num_bufs = num_frames + num_spares + 1;
+    const size_t samples_per_buf = config->num_channels * config->frame_len;
+
+    ADC_sampler.running = false;
+    ADC_sampler.done = false;
+    ADC_sampler.seq = 0;
+    ADC_sampler.rate_hz = config->sample_rate_hz;
+    atomic_store(&ADC_sampler.requested_rate_hz, config->sample_rate_hz);
+    ADC_sampler.frame_len = config->frame_len;
+    atomic_store(&ADC_sampler.requested_frame_len, config->frame_len);
+    atomic_store(&ADC_sampler.spares_out, 0);
+    ADC_sampler.bufs = calloc(num_bufs, sizeof(ADC_sampler_buf_t));
+    ADC_sampler.storage = malloc(num_bufs * samples_per_buf * sizeof(int16_t));
+    // Sized for every frame, spares included, so sending a frame back can never fail
+    ADC_sampler.free_q = xQueueCreate(num_frames + num_spares, sizeof(ADC_sampler_buf_t*));
+    ADC_sampler.ready_q = xQueueCreate(num_frames + num_spares, sizeof(ADC_sampler_buf_t*));
+    if (num_spares > 0) {
+        ADC_sampler.spare_q = xQueueCreate(num_spares, sizeof(ADC_sampler_buf_t*));
+    }
+    ADC_sampler.crossing_q = xQueueCreate(ADC_SAMPLER_CROSSING_QUEUE_LEN, sizeof(ADC_sampler_crossing_t));
+    if (ADC_sampler.bufs == NULL || ADC_sampler.storage == NULL || ADC_sampler.free_q == NULL ||
+        ADC_sampler.ready_q == NULL || (num_spares > 0 && ADC_sampler.spare_q == NULL) ||
+        ADC_sampler.crossing_q == NULL) {
+        ADC_sampler_state_free();
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (size_t i = 0; i < num_bufs; i++) {
+        ADC_sampler_buf_t* buf = &ADC_sampler.bufs[i];
+        buf->storage = &ADC_sampler.storage[i * samples_per_buf];
+        buf->frame.num_channels = config->num_channels;
+        buf->frame.channels = ADC_sampler.config.channels;
+        buf->frame.sample_rate_hz = config->sample_rate_hz;
+        for (size_t ch = 0; ch < config->num_channels; ch++) {
+            buf->frame.samples[ch] = &buf->storage[ch * config->frame_len];
+        }
+        if (i < num_frames) {
+            xQueueSend(ADC_sampler.free_q, &buf, 0);
+        }
+        else if (i < num_frames + num_spares) {
+            xQueueSend(ADC_sampler.spare_q, &buf, 0);
+        }
+    }
+    // The last one is scratch and never goes in either pool
+    ADC_sampler.scratch = &ADC_sampler.bufs[num_bufs - 1];
+
+    atomic_store(&counters.frames, 0);
+    atomic_store(&counters.samples, 0);
+    atomic_store(&counters.overruns, 0);
+    atomic_store(&counters.dropped_frames, 0);
+    atomic_store(&counters.overwritten_frames, 0);
+    atomic_store(&counters.dropped_samples, 0);
+    atomic_store(&counters.overwritten_samples, 0);
+    atomic_store(&counters.spare_frames_used, 0);
+    atomic_store(&counters.rate_changes, 0);
+    atomic_store(&counters.crossings, 0);
+    atomic_store(&counters.dropped_crossings, 0);
+    for (size_t ch = 0; ch < ADC_SAMPLER_MAX_CHANNELS; ch++) {
+        atomic_store(&ADC_sampler.thresholds[ch], 0);
+    }
+    ADC_sampler.tripped = 0;
+    atomic_store(&ADC_sampler.rearm, 0);
+    ADC_sampler.crossing_seq = 0;
+    ADC_sampler.num_subs = 0;
+    busy_us = 0;
+    deliver_us = 0;
+    rate_log.count = 0;
+    latency_hist_reset(&jitter_hist);
+    latency_hist_reset(&read_latency_hist);
+    next_frame();
+
+    if (xTaskCreate(task_fn, "ADC sampler", ADC_SAMPLER_TASK_STACK, NULL, config->task_priority, &ADC_sampler.task) != pdPASS) {
+        ADC_sampler_state_free();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void ADC_sampler_task_delete(void) {
+    if (ADC_sampler.task != NULL) {
+        vTaskDelete(ADC_sampler.task);
+        ADC_sampler.task = NULL;
+    }
+}
+
+void ADC_sampler_state_free(void) {
+    ADC_sampler_task_delete();
+    if (ADC_sampler.free_q != NULL) {
+        vQueueDelete(ADC_sampler.free_q);
+        ADC_sampler.free_q = NULL;
+    }
+    if (ADC_sampler.ready_q != NULL) {
+        vQueueDelete(ADC_sampler.ready_q);
+        ADC_sampler.ready_q = NULL;
+    }
+    if (ADC_sampler.spare_q != NULL) {
+        vQueueDelete(ADC_sampler.spare_q);
+        ADC_sampler.spare_q = NULL;
+    }
+    if (ADC_sampler.crossing_q != NULL) {
+        vQueueDelete(ADC_sampler.crossing_q);
+        ADC_sampler.crossing_q = NULL;
+    }
+    for (size_t i = 0; i < ADC_sampler.num_subs; i++) {
+        vQueueDelete(ADC_sampler.subs[i].q);
+        ADC_sampler.subs[i].q = NULL;
+    }
+    ADC_sampler.num_subs = 0;
+    free(ADC_sampler.bufs);
+    free(ADC_sampler.storage);
+    ADC_sampler.bufs = NULL;
+    ADC_sampler.storage = NULL;
+    ADC_sampler.scratch = NULL;
+    ADC_sampler.cur = NULL;
+}
+
+void ADC_sampler_deliver(size_t len) {
+    ADC_sampler_buf_t* buf = ADC_sampler.cur;
+    int64_t start = esp_timer_get_time();
+    buf->frame.seq = ADC_sampler.seq++;
+    buf->frame.timestamp_us = start;
+    buf->frame.len = len;
+
+    bool dropped = (buf == ADC_sampler.scratch);
+    if (!dropped) {
+        // Our own reference while it's handed out, so a fast consumer releasing it can't
+        // recycle it before every subscriber has it
+        atomic_store(&buf->refs, 1);
+        if (ADC_sampler.config.on_frame != NULL) {
+            ADC_sampler.config.on_frame(&buf->frame, ADC_sampler.config.user_ctx);
+        }
+        else {
+            // Can't fail: the queue holds every frame there is
+            atomic_fetch_add(&buf->refs, 1);
+            xQueueSend(ADC_sampler.ready_q, &buf, 0);
+        }
+        for (size_t i = 0; i < ADC_sampler.num_subs; i++) {
+            ADC_sampler_sub_t* sub = &ADC_sampler.subs[i];
+            atomic_fetch_add(&buf->refs, 1);
+            if (xQueueSend(sub->q, &buf, 0) == pdTRUE) {
+                count(&sub->frames, 1);
+                unsigned waiting = uxQueueMessagesWaiting(sub->q);
+                if (waiting > atomic_load_explicit(&sub->max_waiting, memory_order_relaxed)) {
+                    atomic_store_explicit(&sub->max_waiting, waiting, memory_order_relaxed);
+                }
+            }
+            else {
+                atomic_fetch_sub(&buf->refs, 1);
+                count(&sub->dropped_frames, 1);
+            }
+        }
+        unref(buf);
+    }
+    next_frame();
+
+    if (dropped) {
+        count(&counters.dropped_frames, 1);
+        count(&counters.dropped_samples, len * ADC_sampler.config.num_channels);
+    }
+    else {
+        count(&counters.frames, 1);
+        count(&counters.samples, len * ADC_sampler.config.num_channels);
+    }
+    int64_t us = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&stats_lock);
+    deliver_us += us;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+bool ADC_sampler_wait_frame(TickType_t wait) {
+    if (ADC_sampler.cur != ADC_sampler.scratch) {
+        return true;
+    }
+    return xQueueReceive(ADC_sampler.free_q, &ADC_sampler.cur, wait) == pdTRUE;
+}
+
+bool ADC_sampler_done(void) {
+    return ADC_sampler.done;
+}
+
+const ADC_sampler_frame_t* ADC_sampler_acquire(TickType_t wait) {
+    ADC_sampler_buf_t* buf = NULL;
+    if (ADC_sampler.ready_q == NULL || xQueueReceive(ADC_sampler.ready_q, &buf, wait) != pdTRUE) {
+        return NULL;
+    }
+    return &buf->frame;
+}
+
+void ADC_sampler_release(const ADC_sampler_frame_t* frame) {
+    unref((ADC_sampler_buf_t*)frame);
+}
+
+size_t ADC_sampler_frames_waiting(void) {
+    return (ADC_sampler.ready_q != NULL) ? uxQueueMessagesWaiting(ADC_sampler.ready_q) : 0;
+}
+
+esp_err_t ADC_sampler_subscribe(size_t queue_len, ADC_sampler_sub_t** out) {
+    if (queue_len == 0 || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Only the sampler task walks the list, and only while running
+    if (ADC_sampler.task == NULL || ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ADC_sampler.num_subs == ADC_SAMPLER_MAX_SUBSCRIBERS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ADC_sampler_sub_t* sub = &ADC_sampler.subs[ADC_sampler.num_subs];
+    sub->q = xQueueCreate(queue_len, sizeof(ADC_sampler_buf_t*));
+    if (sub->q == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    atomic_store(&sub->frames, 0);
+    atomic_store(&sub->dropped_frames, 0);
+    atomic_store(&sub->max_waiting, 0);
+    latency_hist_reset(&sub->lag);
+    ADC_sampler.num_subs++;
+    *out = sub;
+    return ESP_OK;
+}
+
+const ADC_sampler_frame_t* ADC_sampler_sub_acquire(ADC_sampler_sub_t* sub, TickType_t wait) {
+    ADC_sampler_buf_t* buf = NULL;
+    if (sub->q == NULL || xQueueReceive(sub->q, &buf, wait) != pdTRUE) {
+        return NULL;
+    }
+    int64_t lag = esp_timer_get_time() - buf->frame.timestamp_us;
+    latency_hist_record(&sub->lag, (lag > 0) ? (uint32_t)lag : 0);
+    return &buf->frame;
+}
+
+void ADC_sampler_get_sub_stats(ADC_sampler_sub_t* sub, ADC_sampler_sub_stats_t* out, latency_hist_t* lag) {
+    out->frames = atomic_load_explicit(&sub->frames, memory_order_relaxed);
+    out->dropped_frames = atomic_load_explicit(&sub->dropped_frames, memory_order_relaxed);
+    out->waiting = (sub->q != NULL) ? uxQueueMessagesWaiting(sub->q) : 0;
+    out->max_waiting = atomic_load_explicit(&sub->max_waiting, memory_order_relaxed);
+    if (lag != NULL) {
+        latency_hist_copy(lag, &sub->lag);
+    }
+}
+
+void ADC_sampler_add_busy(int64_t us) {
+    portENTER_CRITICAL(&stats_lock);
+    busy_us += us;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void ADC_sampler_add_overruns(uint32_t n) {
+    count(&counters.overruns, n);
+}
+
+void ADC_sampler_add_timing(uint32_t jitter_us, uint32_t read_latency_us) {
+    latency_hist_record(&jitter_hist, jitter_us);
+    latency_hist_record(&read_latency_hist, read_latency_us);
+}
+
+void ADC_sampler_add_jitter(uint32_t jitter_us) {
+    latency_hist_record(&jitter_hist, jitter_us);
+}
+
+esp_err_t ADC_sampler_request_rate(uint32_t sample_rate_hz, uint32_t max_rate_hz) {
+    if (sample_rate_hz == 0 || sample_rate_hz > max_rate_hz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ADC_sampler.task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    atomic_store_explicit(&ADC_sampler.requested_rate_hz, sample_rate_hz, memory_order_relaxed);
+    return ESP_OK;
+}
+
+esp_err_t ADC_sampler_request_frame_len(size_t len) {
+    if (ADC_sampler.task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // The pool's frames only have room for the configured length
+    if (len == 0 || len > ADC_sampler.config.frame_len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_store_explicit(&ADC_sampler.requested_frame_len, len, memory_order_relaxed);
+    return ESP_OK;
+}
+
+size_t ADC_sampler_get_frame_len(void) {
+    return ADC_sampler.frame_len;
+}
+
+void ADC_sampler_log_rate(uint32_t rate_hz, uint64_t alarm_count) {
+    ADC_sampler_rate_change_t change = {
+        .seq = ADC_sampler.seq,     // What ADC_sampler_deliver will number the current frame
+        .alarm_count = alarm_count,
+        .timestamp_us = esp_timer_get_time(),
+        .sample_rate_hz = rate_hz,
+    };
+    ADC_sampler.rate_hz = rate_hz;
+
+    portENTER_CRITICAL(&rate_lock);
+    rate_log.entries[rate_log.count % ADC_SAMPLER_RATE_LOG_LEN] = change;
+    rate_log.count++;
+    portEXIT_CRITICAL(&rate_lock);
+    count(&counters.rate_changes, 1);
+}
+
+uint32_t ADC_sampler_get_rate(void) {
+    return ADC_sampler.rate_hz;
+}
+
+size_t ADC_sampler_get_rate_changes(ADC_sampler_rate_change_t* changes, size_t max, uint32_t* cursor) {
+    size_t n = 0;
+
+    portENTER_CRITICAL(&rate_lock);
+    uint32_t next = *cursor;
+    // A cursor from before the last config, or one that's been lapped
+    if ((int32_t)(rate_log.count - next) < 0) {
+        next = 0;
+    }
+    if (rate_log.count - next > ADC_SAMPLER_RATE_LOG_LEN) {
+        next = rate_log.count - ADC_SAMPLER_RATE_LOG_LEN;
+    }
+    for (; next != rate_log.count && n < max; next++, n++) {
+        changes[n] = rate_log.entries[next % ADC_SAMPLER_RATE_LOG_LEN];
+    }
+    portEXIT_CRITICAL(&rate_lock);
+
+    *cursor = next;
+    return n;
+}
+
+esp_err_t ADC_sampler_set_threshold(size_t ch, const ADC_sampler_threshold_t* threshold) {
+    if (threshold != NULL && threshold->low >= threshold->high) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ADC_sampler.task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Only the configured channels are ever checked, and tripped has a bit for each
+    if (ch >= ADC_sampler.config.num_channels) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // low < high, so an armed threshold never packs to 0
+    uint32_t packed = 0;
+    if (threshold != NULL) {
+        packed = ((uint32_t)(uint16_t)threshold->high << 16) | (uint16_t)threshold->low;
+    }
+    // The channel starts armed. tripped is the sampler task's, so it clears the bit when it
+    // next checks the channel, before it can see the new threshold
+    atomic_fetch_or_explicit(&ADC_sampler.rearm, 1u << ch, memory_order_relaxed);
+    atomic_store_explicit(&ADC_sampler.thresholds[ch], packed, memory_order_release);
+    return ESP_OK;
+}
+
+void ADC_sampler_cross(size_t ch, int16_t sample, int64_t timestamp_us) {
+    ADC_sampler_crossing_t crossing = {
+        .seq = ADC_sampler.crossing_seq++,
+        .channel = ch,
+        .rising = !((ADC_sampler.tripped >> ch) & 1),
+        .sample = sample,
+        .timestamp_us = timestamp_us,
+    };
+    ADC_sampler.tripped ^= 1u << ch;
+
+    // Never waits: a handler that's that far behind has bigger problems than the latest one
+    if (xQueueSend(ADC_sampler.crossing_q, &crossing, 0) == pdTRUE) {
+        count(&counters.crossings, 1);
+    }
+    else {
+        count(&counters.dropped_crossings, 1);
+    }
+}
+
+bool ADC_sampler_wait_crossing(ADC_sampler_crossing_t* crossing, TickType_t wait) {
+    return ADC_sampler.crossing_q != NULL && xQueueReceive(ADC_sampler.crossing_q, crossing, wait) == pdTRUE;
+}
+
+void ADC_sampler_get_timing(latency_hist_t* jitter, latency_hist_t* read_latency) {
+    if (jitter != NULL) {
+        latency_hist_copy(jitter, &jitter_hist);
+    }
+    if (read_latency != NULL) {
+        latency_hist_copy(read_latency, &read_latency_hist);
+    }
+}
+
+void ADC_sampler_get_stats(ADC_sampler_stats_t* out) {
+    out->frames = atomic_load_explicit(&counters.frames, memory_order_relaxed);
+    out->samples = atomic_load_explicit(&counters.samples, memory_order_relaxed);
+    out->overruns = atomic_load_explicit(&counters.overruns, memory_order_relaxed);
+    out->dropped_frames = atomic_load_explicit(&counters.dropped_frames, memory_order_relaxed);
+    out->overwritten_frames = atomic_load_explicit(&counters.overwritten_frames, memory_order_relaxed);
+    out->dropped_samples = atomic_load_explicit(&counters.dropped_samples, memory_order_relaxed);
+    out->overwritten_samples = atomic_load_explicit(&counters.overwritten_samples, memory_order_relaxed);
+    out->spare_frames_used = atomic_load_explicit(&counters.spare_frames_used, memory_order_relaxed);
+    out->rate_changes = atomic_load_explicit(&counters.rate_changes, memory_order_relaxed);
+    out->crossings = atomic_load_explicit(&counters.crossings, memory_order_relaxed);
+    out->dropped_crossings = atomic_load_explicit(&counters.dropped_crossings, memory_order_relaxed);
+
+    portENTER_CRITICAL(&stats_lock);
+    out->busy_us = busy_us;
+    out->deliver_us = deliver_us;
+    portEXIT_CRITICAL(&stats_lock);
+}
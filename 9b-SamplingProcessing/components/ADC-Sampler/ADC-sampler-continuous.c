@@ -0,0 +1,213 @@
+/**
+ * Continuous backend: the ADC's digital controller steps through the channel list at the
+ * configured scan rate and DMAs results into the driver's pool. The conversion-done ISR wakes
+ * the sampler task once per frame, and the task sorts the interleaved results into one block
+ * per channel and hands the whole frame over at once.
+ * No per-sample ISR, task wake or driver call like the oneshot backend.
+ *
+ * The hardware converts one channel at a time, so the conversion rate is the scan rate times
+ * the number of channels. That can't go below SOC_ADC_SAMPLE_FREQ_THRES_LOW (~600 Hz on most
+ * chips), so slow rates still need the oneshot backend.
+ */
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_adc/adc_continuous.h"
+#include "soc/soc_caps.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "ADC-sampler-priv.h"
+
+// Frames the driver can buffer before it overflows and starts dropping
+#define POOL_FRAMES 4
+#define NO_SLOT 0xFF
+
+#if CONFIG_IDF_TARGET_ESP32
+#define ADC_OUTPUT_FORMAT       ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_GET_CHANNEL(p)      ((p)->type1.channel)
+#define ADC_GET_DATA(p)         ((p)->type1.data)
+#else
+#define ADC_OUTPUT_FORMAT       ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_GET_CHANNEL(p)      ((p)->type2.channel)
+#define ADC_GET_DATA(p)         ((p)->type2.data)
+#endif
+
+static const char* TAG = "ADC sampler";
+static adc_continuous_handle_t adc_handle = NULL;
+static uint8_t* dma_frame = NULL;
+static uint32_t dma_frame_bytes = 0;
+static volatile uint32_t pool_overflows = 0;
+static uint8_t slot_of_channel[16];     // Position in the scan list for each ADC channel, or NO_SLOT
+
+
+// ISR that wakes the sampler task when a frame has been converted
+static bool IRAM_ATTR ADC_conv_done_ISR(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data) {
+    BaseType_t high_task_awoken = pdFALSE;
+    vTaskNotifyGiveFromISR(ADC_sampler.task, &high_task_awoken);
+    return (high_task_awoken == pdTRUE);
+}
+
+// ISR for when the sampler task fell behind and the driver's pool filled up
+static bool IRAM_ATTR ADC_pool_ovf_ISR(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data) {
+    pool_overflows++;
+    return false;
+}
+
+static void ADC_sample_task(void* param) {
+    uint32_t overflows_seen = 0;
+    size_t idx[ADC_SAMPLER_MAX_CHANNELS] = {0};
+    const size_t num_channels = ADC_sampler.config.num_channels;
+    const size_t frame_len = ADC_sampler.config.frame_len;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+
+        // Drain everything the driver has in case notifications were merged
+        uint32_t ret_num = 0;
+        while (adc_continuous_read(adc_handle, dma_frame, dma_frame_bytes, &ret_num, 0) == ESP_OK) {
+            for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= ret_num; i += SOC_ADC_DIGI_RESULT_BYTES) {
+                adc_digi_output_data_t* p = (adc_digi_output_data_t*)&dma_frame[i];
+                uint8_t ch = slot_of_channel[ADC_GET_CHANNEL(p) & 0xF];
+                if (ch != NO_SLOT && idx[ch] < frame_len) {
+                    int16_t sample = ADC_GET_DATA(p);
+                    *ADC_sampler_slot(ch, idx[ch]++) = sample;
+                    // The DMA frame's samples only reach us together, so that's the soonest
+                    ADC_sampler_check(ch, sample, start);
+                }
+            }
+
+            // The pattern is round robin so every channel fills up on the same scan
+            if (idx[num_channels - 1] >= frame_len) {
+                ADC_sampler_deliver(frame_len);
+                for (size_t ch = 0; ch < num_channels; ch++) {
+                    idx[ch] = 0;
+                }
+            }
+        }
+
+        uint32_t overflows = pool_overflows;
+        if (overflows != overflows_seen) {
+            ADC_sampler_add_overruns(overflows - overflows_seen);
+            overflows_seen = overflows;
+        }
+        ADC_sampler_add_busy(esp_timer_get_time() - start);
+    }
+}
+
+esp_err_t ADC_sampler_config(const ADC_sampler_config_t* config) {
+    uint32_t conv_rate_hz = (config != NULL) ? config->sample_rate_hz * config->num_channels : 0;
+    if (config != NULL && (conv_rate_hz < SOC_ADC_SAMPLE_FREQ_THRES_LOW || conv_rate_hz > SOC_ADC_SAMPLE_FREQ_THRES_HIGH)) {
+        ESP_LOGE(TAG, "Continuous mode only supports %d to %d conversions/s",
+                 SOC_ADC_SAMPLE_FREQ_THRES_LOW, SOC_ADC_SAMPLE_FREQ_THRES_HIGH);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ADC_sampler_state_init(config, ADC_sample_task);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (size_t i = 0; i < sizeof(slot_of_channel); i++) {
+        slot_of_channel[i] = NO_SLOT;
+    }
+    for (size_t ch = 0; ch < config->num_channels; ch++) {
+        slot_of_channel[config->channels[ch] & 0xF] = (uint8_t)ch;
+    }
+
+    // One DMA frame is one sampler frame: frame_len scans of every channel.
+    // conv_frame_size has to be a multiple of the bytes per conversion
+    dma_frame_bytes = config->num_channels * config->frame_len * SOC_ADC_DIGI_RESULT_BYTES;
+    dma_frame_bytes += (SOC_ADC_DIGI_DATA_BYTES_PER_CONV - dma_frame_bytes % SOC_ADC_DIGI_DATA_BYTES_PER_CONV) % SOC_ADC_DIGI_DATA_BYTES_PER_CONV;
+    dma_frame = malloc(dma_frame_bytes);
+    if (dma_frame == NULL) {
+        ADC_sampler_deinit();
+        return ESP_ERR_NO_MEM;
+    }
+
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = dma_frame_bytes * POOL_FRAMES,
+        .conv_frame_size = dma_frame_bytes,
+    };
+    err = adc_continuous_new_handle(&handle_config, &adc_handle);
+
+    if (err == ESP_OK) {
+        adc_digi_pattern_config_t pattern[ADC_SAMPLER_MAX_CHANNELS];
+        for (size_t ch = 0; ch < config->num_channels; ch++) {
+            pattern[ch].atten = ADC_ATTEN_DB_12;
+            pattern[ch].channel = config->channels[ch];
+            pattern[ch].unit = ADC_UNIT_1;
+            pattern[ch].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        }
+        adc_continuous_config_t dig_config = {
+            .pattern_num = config->num_channels,
+            .adc_pattern = pattern,
+            .sample_freq_hz = conv_rate_hz,
+            .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+            .format = ADC_OUTPUT_FORMAT,
+        };
+        err = adc_continuous_config(adc_handle, &dig_config);
+    }
+
+    if (err == ESP_OK) {
+        adc_continuous_evt_cbs_t cbs = {
+            .on_conv_done = ADC_conv_done_ISR,
+            .on_pool_ovf = ADC_pool_ovf_ISR,
+        };
+        err = adc_continuous_register_event_callbacks(adc_handle, &cbs, NULL);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Config failed: %s", esp_err_to_name(err));
+        ADC_sampler_deinit();
+    }
+    return err;
+}
+
+esp_err_t ADC_sampler_deinit(void) {
+    if (ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The task may still be reading a conversion frame, so it goes before the driver does
+    ADC_sampler_task_delete();
+    if (adc_handle != NULL) {
+        adc_continuous_deinit(adc_handle);
+        adc_handle = NULL;
+    }
+    free(dma_frame);
+    dma_frame = NULL;
+    ADC_sampler_state_free();
+    return ESP_OK;
+}
+
+esp_err_t ADC_sampler_start(void) {
+    if (adc_handle == NULL || ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = adc_continuous_start(adc_handle);
+    if (err == ESP_OK) {
+        ADC_sampler.running = true;
+    }
+    return err;
+}
+
+// The conversion rate is fixed when the driver is configured. Changing it means stopping and
+// reconfiguring continuous mode, which would lose samples
+esp_err_t ADC_sampler_set_rate(uint32_t sample_rate_hz) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+// Same for the DMA frame size
+esp_err_t ADC_sampler_set_frame_len(size_t len) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t ADC_sampler_stop(void) {
+    if (!ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler.running = false;
+    return adc_continuous_stop(adc_handle);
+}
@@ -0,0 +1,146 @@
+/**
+ * Mock backend for the linux target. The sampler task generates a 12-bit sine plus a
+ * little noise on every channel at the configured scan rate and hands it over in frames,
+ * the same way the continuous backend does. Each channel's sine is shifted by 1/8 of a
+ * period so they're easy to tell apart. It paces itself off esp_timer so the average rate is right
+ * even when a frame period is shorter than a tick. If on_frame is too slow to keep up, the
+ * backlog is capped and the skipped frames are counted as overruns like a DMA pool overflow.
+ * Frames are stamped with the esp_timer time they were due and generated, and how late they
+ * were goes in the jitter histogram. A rate change from ADC_sampler_set_rate is picked up
+ * before each frame: the schedule restarts from when the last frame was due, at the new rate.
+ * A frame length from ADC_sampler_set_frame_len restarts it the same way.
+ * Thresholds are checked as each frame is generated, like the continuous backend does.
+ */
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "ADC-sampler-priv.h"
+
+#define WAVE_LEN 256            // One period of the test signal. Power of 2 for the phase wrap
+#define MAX_BACKLOG_FRAMES 4    // Frames we're allowed to fall behind before skipping ahead
+#define US_PER_TICK (1000000 / configTICK_RATE_HZ)
+#define MAX_RATE_HZ 1000000
+
+static int16_t wave[WAVE_LEN];
+static uint32_t phase = 0;      // Index into wave in 16.16 fixed point
+static uint32_t phase_step = 0;
+static uint32_t noise = 1;
+
+
+static void set_phase_step(uint32_t rate_hz) {
+    phase_step = (uint32_t)((uint64_t)CONFIG_ADC_SAMPLER_MOCK_SIGNAL_HZ * WAVE_LEN * 65536 / rate_hz);
+}
+
+// first_us is when the first scan of the frame was due, period_us the time between scans
+static void fill_frame(size_t len, int64_t first_us, int64_t period_us) {
+    for (size_t ch = 0; ch < ADC_sampler.config.num_channels; ch++) {
+        int16_t* out = ADC_sampler_slot(ch, 0);
+        uint32_t ch_phase = phase + ((uint32_t)ch << 16) * (WAVE_LEN / 8);
+        for (size_t i = 0; i < len; i++) {
+            // Cheap LCG noise of +/-8 codes
+            noise = noise * 1103515245u + 12345u;
+            out[i] = (int16_t)(wave[(ch_phase >> 16) & (WAVE_LEN - 1)] + (int)((noise >> 24) & 0xF) - 8);
+            ch_phase += phase_step;
+        }
+        ADC_sampler_check_block(ch, out, len, first_us, period_us);
+    }
+    phase += phase_step * (uint32_t)len;
+}
+
+static void ADC_sample_task(void* param) {
+    while (true) {
+        // Wait for ADC_sampler_start
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        const int64_t origin_us = esp_timer_get_time();     // Count 0 for the frame stamps
+        int64_t start_us = origin_us;   // When frame 0 at the current rate started
+        uint64_t frames_due = 0;        // Frames generated or skipped since start_us
+        uint64_t rate = atomic_load(&ADC_sampler.requested_rate_hz);
+        uint64_t frame_len = atomic_load(&ADC_sampler.requested_frame_len);
+        set_phase_step((uint32_t)rate);
+        ADC_sampler.frame_len = frame_len;
+
+        while (ADC_sampler.running) {
+            uint32_t requested = atomic_load_explicit(&ADC_sampler.requested_rate_hz, memory_order_relaxed);
+            uint32_t requested_len = atomic_load_explicit(&ADC_sampler.requested_frame_len, memory_order_relaxed);
+            if (requested != rate || requested_len != frame_len) {
+                start_us += (int64_t)(frames_due * frame_len * 1000000 / rate);
+                frames_due = 0;
+                rate = requested;
+                frame_len = requested_len;
+                set_phase_step(requested);
+                ADC_sampler.frame_len = frame_len;
+            }
+
+            int64_t now = esp_timer_get_time();
+            int64_t next_us = start_us + (int64_t)((frames_due + 1) * frame_len * 1000000 / rate);
+            if (now < next_us) {
+                // Sleep at least a tick. We catch up by generating several frames back to back
+                TickType_t wait = (TickType_t)((next_us - now) / US_PER_TICK);
+                vTaskDelay(wait > 0 ? wait : 1);
+                continue;
+            }
+
+            // Skip ahead if on_frame has been holding us up for too long
+            uint64_t behind = (uint64_t)(now - start_us) * rate / (frame_len * 1000000) - frames_due;
+            if (behind > MAX_BACKLOG_FRAMES) {
+                ADC_sampler_add_overruns((uint32_t)(behind - MAX_BACKLOG_FRAMES));
+                frames_due += behind - MAX_BACKLOG_FRAMES;
+                next_us = start_us + (int64_t)((frames_due + 1) * frame_len * 1000000 / rate);
+            }
+
+            ADC_sampler_add_jitter((uint32_t)(now - next_us));
+            ADC_sampler_stamp((uint64_t)(next_us - origin_us), (uint64_t)(now - origin_us), (uint32_t)rate);
+            // Like a DMA frame, the samples only exist once the whole frame's done, so a
+            // crossing's latency counts from when its sample would have been taken
+            const int64_t period_us = (int64_t)(1000000 / rate);
+            fill_frame(frame_len, next_us - (int64_t)frame_len * period_us, period_us);
+            ADC_sampler_deliver(frame_len);
+            frames_due++;
+            ADC_sampler_add_busy(esp_timer_get_time() - now);
+        }
+    }
+}
+
+esp_err_t ADC_sampler_config(const ADC_sampler_config_t* config) {
+    for (size_t i = 0; i < WAVE_LEN; i++) {
+        wave[i] = 2048 + (int16_t)(1500.0f * sinf(2.0f * (float)M_PI * i / WAVE_LEN));
+    }
+    phase = 0;
+
+    return ADC_sampler_state_init(config, ADC_sample_task);
+}
+
+esp_err_t ADC_sampler_deinit(void) {
+    if (ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler_state_free();
+    return ESP_OK;
+}
+
+esp_err_t ADC_sampler_start(void) {
+    if (ADC_sampler.task == NULL || ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler.running = true;
+    xTaskNotifyGive(ADC_sampler.task);
+    return ESP_OK;
+}
+
+esp_err_t ADC_sampler_set_rate(uint32_t sample_rate_hz) {
+    return ADC_sampler_request_rate(sample_rate_hz, MAX_RATE_HZ);
+}
+
+esp_err_t ADC_sampler_set_frame_len(size_t len) {
+    return ADC_sampler_request_frame_len(len);
+}
+
+esp_err_t ADC_sampler_stop(void) {
+    if (!ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler.running = false;
+    return ESP_OK;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "ADC-sampler.h"
+
+/**
+ * State and helpers shared by the backends. Each backend file implements the public
+ * config/deinit/start/stop functions and the sampler task body. Everything else lives in
+ * ADC-sampler-common.c.
+ */
+
+#define ADC_SAMPLER_TASK_STACK 4096
+
+// A frame in the pool. frame has to stay first so a released frame pointer can be cast back
+typedef struct {
+    ADC_sampler_frame_t frame;
+    int16_t* storage;           // frame_len samples per channel, one channel after another
+    atomic_uint refs;           // Consumers that have it queued or acquired. Recycled at 0
+} ADC_sampler_buf_t;
+
+struct ADC_sampler_sub {
+    QueueHandle_t q;            // Full frames, each holding a reference for this subscriber
+    atomic_uint frames;
+    atomic_uint dropped_frames;
+    atomic_uint max_waiting;    // Sampler task only writes it
+    latency_hist_t lag;         // Frame completed -> acquired, recorded by the subscriber
+};
+
+typedef struct {
+    ADC_sampler_config_t config;
+    ADC_sampler_buf_t* bufs;    // num_frames pool frames, then the spares, then one scratch frame
+    int16_t* storage;           // Backing memory for every frame
+    ADC_sampler_buf_t* scratch; // Written to when there's no frame to spare, never delivered
+    ADC_sampler_buf_t* cur;     // Frame the backend is writing into
+    QueueHandle_t free_q;       // Pool frames the sampler can fill
+    QueueHandle_t ready_q;      // Full frames waiting for the consumer
+    QueueHandle_t spare_q;      // Spare pool policy only: spares not in use
+    atomic_uint spares_out;     // Spares handed out and not released yet
+    uint32_t seq;
+    uint32_t rate_hz;           // Rate of the frame being written. Sampler task only
+    atomic_uint requested_rate_hz;  // From ADC_sampler_set_rate, picked up by the backend per frame
+    size_t frame_len;           // Length of the frame being written. Sampler task only
+    atomic_uint requested_frame_len;    // From ADC_sampler_set_frame_len, picked up like the rate
+    atomic_uint thresholds[ADC_SAMPLER_MAX_CHANNELS];   // high << 16 | low, both as uint16_t. 0 = off
+    uint32_t tripped;           // Bit per channel: crossed high, waiting for low. Sampler task only
+    atomic_uint rearm;          // Bit per channel: a new threshold was set, so clear its tripped bit
+    QueueHandle_t crossing_q;
+    uint32_t crossing_seq;
+    ADC_sampler_sub_t subs[ADC_SAMPLER_MAX_SUBSCRIBERS];
+    size_t num_subs;
+    TaskHandle_t task;
+    volatile bool running;
+    volatile bool done;         // Replay backend: the file has run out
+} ADC_sampler_state_t;
+
+extern ADC_sampler_state_t ADC_sampler;
+
+// Validate the config, allocate the frame pool and create the sampler task running task_fn
+esp_err_t ADC_sampler_state_init(const ADC_sampler_config_t* config, TaskFunction_t task_fn);
+// Delete the sampler task. Backends do this before tearing down the hardware it reads from
+void ADC_sampler_task_delete(void);
+// Delete the sampler task if it's still there and free the pool
+void ADC_sampler_state_free(void);
+
+// Where the backend writes sample idx of the channel at position ch in the scan list
+static inline int16_t* ADC_sampler_slot(size_t ch, size_t idx) {
+    return &ADC_sampler.cur->storage[ch * ADC_sampler.config.frame_len + idx];
+}
+
+// Hand the current frame, with len samples per channel, to the consumer and start on the next one.
+// If the pool is empty the next frame is written to scratch and dropped when it's delivered
+void ADC_sampler_deliver(size_t len);
+// For a source that can wait for the consumers (replay as fast as they go): if the pool was
+// empty at the last deliver, wait up to wait ticks for a frame to come back. False if none did
+bool ADC_sampler_wait_frame(TickType_t wait);
+void ADC_sampler_add_busy(int64_t us);
+void ADC_sampler_add_overruns(uint32_t n);
+void ADC_sampler_add_timing(uint32_t jitter_us, uint32_t read_latency_us);
+void ADC_sampler_add_jitter(uint32_t jitter_us);
+// Validate and store a rate for the backend to pick up at the next frame
+esp_err_t ADC_sampler_request_rate(uint32_t sample_rate_hz, uint32_t max_rate_hz);
+// Validate and store a frame length for the backend to pick up at the next frame
+esp_err_t ADC_sampler_request_frame_len(size_t len);
+// Log that the frame being written is the first at rate_hz
+void ADC_sampler_log_rate(uint32_t rate_hz, uint64_t alarm_count);
+
+// Queue a crossing for the handler and flip the channel's state
+void ADC_sampler_cross(size_t ch, int16_t sample, int64_t timestamp_us);
+
+// Threshold check for sample of the channel at position ch, taken at timestamp_us. Cheap
+// enough for every sample: two loads and a compare unless it crossed
+static inline void ADC_sampler_check(size_t ch, int16_t sample, int64_t timestamp_us) {
+    // Acquire, so a rearm bit set before this threshold was published is seen with it
+    uint32_t packed = atomic_load_explicit(&ADC_sampler.thresholds[ch], memory_order_acquire);
+    if (packed == 0) {
+        return;
+    }
+    if ((atomic_load_explicit(&ADC_sampler.rearm, memory_order_relaxed) >> ch) & 1) {
+        atomic_fetch_and_explicit(&ADC_sampler.rearm, ~(1u << ch), memory_order_relaxed);
+        ADC_sampler.tripped &= ~(1u << ch);
+    }
+    bool tripped = (ADC_sampler.tripped >> ch) & 1;
+    if (tripped ? sample <= (int16_t)packed : sample >= (int16_t)(packed >> 16)) {
+        ADC_sampler_cross(ch, sample, timestamp_us);
+    }
+}
+
+// Same for a block of n samples period_us apart, the first taken at timestamp_us
+static inline void ADC_sampler_check_block(size_t ch, const int16_t* samples, size_t n, int64_t timestamp_us, int64_t period_us) {
+    if (atomic_load_explicit(&ADC_sampler.thresholds[ch], memory_order_relaxed) == 0) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        ADC_sampler_check(ch, samples[i], timestamp_us + (int64_t)i * period_us);
+    }
+}
+
+// Tag the frame being written with its first scan's schedule and read times and its rate
+static inline void ADC_sampler_stamp(uint64_t alarm_count, uint64_t read_count, uint32_t rate_hz) {
+    ADC_sampler.cur->frame.alarm_count = alarm_count;
+    ADC_sampler.cur->frame.read_count = read_count;
+    ADC_sampler.cur->frame.sample_rate_hz = rate_hz;
+    if (rate_hz != ADC_sampler.rate_hz) {
+        ADC_sampler_log_rate(rate_hz, alarm_count);
+    }
+}
@@ -0,0 +1,238 @@
+/**
+ * Replay backend for the linux target. Instead of generating a signal like the mock backend it
+ * reads scans back out of a capture file (config.replay_path), so a field recording can be run
+ * through the same consumers on the host:
+ *  - *.csv: one scan per line, the last num_channels comma separated fields are the samples in
+ *    scan list order. Lines with fewer numbers (headers, blank lines) are skipped
+ *  - anything else: raw little-endian int16 samples, num_channels per scan, interleaved
+ * Only whole frames are delivered. When the file runs out the leftover scans are dropped and
+ * ADC_sampler_done starts returning true.
+ *
+ * Real time (the default) paces frames off esp_timer at sample_rate_hz exactly like the mock
+ * backend, overruns and jitter included. With config.replay_fast it waits for a free frame
+ * instead, so the consumers set the pace, nothing is ever dropped and a run over the same file
+ * always feeds them the same samples. The overrun policy is forced to drop newest for that, since
+ * there's never anything to drop. The file has one rate, so ADC_sampler_set_rate isn't
+ * supported. ADC_sampler_set_frame_len is, and restarts the real time schedule like the mock's.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "ADC-sampler-priv.h"
+
+#define MAX_BACKLOG_FRAMES 4    // Frames we're allowed to fall behind before skipping ahead
+#define US_PER_TICK (1000000 / configTICK_RATE_HZ)
+#define FAST_WAIT_MS 10         // How often a fast replay waiting for a frame checks it's still running
+#define MAX_LINE 256
+
+static const char* TAG = "ADC sampler";
+static FILE* file = NULL;
+static bool csv = false;
+static int16_t* scans = NULL;   // One frame of interleaved binary scans
+
+
+// Next scan from a CSV file into scan[num_channels]. False at the end of the file
+static bool read_csv_scan(int16_t* scan) {
+    const size_t num_channels = ADC_sampler.config.num_channels;
+    char line[MAX_LINE];
+    long fields[ADC_SAMPLER_MAX_CHANNELS];
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        // Keep the last num_channels numbers on the line
+        size_t n = 0;
+        char* p = line;
+        while (true) {
+            char* end;
+            long v = strtol(p, &end, 10);
+            if (end == p) {
+                n = 0;  // Not a number, so not a sample line
+                break;
+            }
+            fields[n % num_channels] = v;
+            n++;
+            p = end + strspn(end, " \t");
+            if (*p != ',') {
+                break;
+            }
+            p++;
+        }
+        if (n < num_channels) {
+            continue;
+        }
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            scan[ch] = (int16_t)fields[(n + ch) % num_channels];
+        }
+        return true;
+    }
+    return false;
+}
+
+// Fill the current frame with the next frame_len scans. False if the file ran out first
+static bool read_frame(size_t frame_len) {
+    const size_t num_channels = ADC_sampler.config.num_channels;
+
+    if (!csv && fread(scans, num_channels * sizeof(int16_t), frame_len, file) != frame_len) {
+        return false;
+    }
+    for (size_t i = 0; i < frame_len; i++) {
+        int16_t* scan = &scans[i * num_channels];
+        if (csv && !read_csv_scan(scan)) {
+            return false;
+        }
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            *ADC_sampler_slot(ch, i) = scan[ch];
+        }
+    }
+    return true;
+}
+
+static void skip_scans(uint64_t n) {
+    if (!csv) {
+        fseek(file, (long)(n * ADC_sampler.config.num_channels * sizeof(int16_t)), SEEK_CUR);
+        return;
+    }
+    for (; n > 0 && read_csv_scan(scans); n--) {
+    }
+}
+
+static void ADC_sample_task(void* param) {
+    const uint64_t rate = ADC_sampler.config.sample_rate_hz;
+    const int64_t period_us = (int64_t)(1000000 / rate);
+    const bool fast = ADC_sampler.config.replay_fast;
+    uint64_t scans_read = 0;        // Scan count of the next frame, for its stamps
+
+    while (true) {
+        // Wait for ADC_sampler_start
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start_us = esp_timer_get_time();   // When frame 0 at the current length started
+        uint64_t frames_due = 0;    // Frames replayed or skipped since start_us
+        uint64_t frame_len = atomic_load(&ADC_sampler.requested_frame_len);
+        ADC_sampler.frame_len = frame_len;
+
+        while (ADC_sampler.running && !ADC_sampler.done) {
+            uint32_t requested_len = atomic_load_explicit(&ADC_sampler.requested_frame_len, memory_order_relaxed);
+            if (requested_len != frame_len) {
+                start_us += (int64_t)(frames_due * frame_len * 1000000 / rate);
+                frames_due = 0;
+                frame_len = requested_len;
+                ADC_sampler.frame_len = frame_len;
+            }
+            // Fast: wait for the consumers instead of dropping anything
+            if (fast && !ADC_sampler_wait_frame(pdMS_TO_TICKS(FAST_WAIT_MS))) {
+                continue;
+            }
+            int64_t now = esp_timer_get_time();
+            int64_t next_us = now;
+            if (!fast) {
+                next_us = start_us + (int64_t)((frames_due + 1) * frame_len * 1000000 / rate);
+                if (now < next_us) {
+                    // Sleep at least a tick. We catch up by replaying several frames back to back
+                    TickType_t wait = (TickType_t)((next_us - now) / US_PER_TICK);
+                    vTaskDelay(wait > 0 ? wait : 1);
+                    continue;
+                }
+
+                // Skip ahead if the consumer has been holding us up for too long. The skipped
+                // scans are lost like they would be from the ADC
+                uint64_t behind = (uint64_t)(now - start_us) * rate / (frame_len * 1000000) - frames_due;
+                if (behind > MAX_BACKLOG_FRAMES) {
+                    ADC_sampler_add_overruns((uint32_t)(behind - MAX_BACKLOG_FRAMES));
+                    skip_scans((behind - MAX_BACKLOG_FRAMES) * frame_len);
+                    scans_read += (behind - MAX_BACKLOG_FRAMES) * frame_len;
+                    frames_due += behind - MAX_BACKLOG_FRAMES;
+                    next_us = start_us + (int64_t)((frames_due + 1) * frame_len * 1000000 / rate);
+                }
+                ADC_sampler_add_jitter((uint32_t)(now - next_us));
+            }
+
+            if (!read_frame(frame_len)) {
+                ADC_sampler.done = true;
+                break;
+            }
+            // Stamped in scans since the start of the file, so the stamps match whatever the pace
+            uint64_t first_scan_us = scans_read * 1000000 / rate;
+            ADC_sampler_stamp(first_scan_us, first_scan_us, (uint32_t)rate);
+            for (size_t ch = 0; ch < ADC_sampler.config.num_channels; ch++) {
+                ADC_sampler_check_block(ch, ADC_sampler_slot(ch, 0), frame_len, next_us - (int64_t)frame_len * period_us, period_us);
+            }
+            ADC_sampler_deliver(frame_len);
+            scans_read += frame_len;
+            frames_due++;
+            ADC_sampler_add_busy(esp_timer_get_time() - now);
+        }
+    }
+}
+
+esp_err_t ADC_sampler_config(const ADC_sampler_config_t* config) {
+    if (config == NULL || config->replay_path == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ADC_sampler.task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    file = fopen(config->replay_path, "rb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Can't open %s", config->replay_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    const char* ext = strrchr(config->replay_path, '.');
+    csv = (ext != NULL && strcmp(ext, ".csv") == 0);
+    scans = malloc(config->frame_len * config->num_channels * sizeof(int16_t));
+    if (scans == NULL) {
+        ADC_sampler_deinit();
+        return ESP_ERR_NO_MEM;
+    }
+
+    ADC_sampler_config_t replay_config = *config;
+    if (replay_config.replay_fast) {
+        replay_config.overrun_policy = ADC_SAMPLER_OVERRUN_DROP_NEWEST;
+    }
+    esp_err_t err = ADC_sampler_state_init(&replay_config, ADC_sample_task);
+    if (err != ESP_OK) {
+        ADC_sampler_deinit();
+    }
+    return err;
+}
+
+esp_err_t ADC_sampler_deinit(void) {
+    if (ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler_state_free();
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+    free(scans);
+    scans = NULL;
+    return ESP_OK;
+}
+
+esp_err_t ADC_sampler_start(void) {
+    if (ADC_sampler.task == NULL || ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler.running = true;
+    xTaskNotifyGive(ADC_sampler.task);
+    return ESP_OK;
+}
+
+esp_err_t ADC_sampler_set_rate(uint32_t sample_rate_hz) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t ADC_sampler_set_frame_len(size_t len) {
+    return ADC_sampler_request_frame_len(len);
+}
+
+esp_err_t ADC_sampler_stop(void) {
+    if (!ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler.running = false;
+    return ESP_OK;
+}
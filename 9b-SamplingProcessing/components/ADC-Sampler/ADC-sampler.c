@@ -1,66 +1,268 @@
+/**
+ * Oneshot backend: a gptimer alarm at the scan rate wakes the sampler task,
+ * which does one adc_oneshot_read per channel and hands over a frame once it's full.
+ * adc_oneshot_read isn't ISR safe so the read itself can't happen in the alarm ISR.
+ *
+ * The timer free runs from ADC_sampler_start and the ISR moves the alarm on by one period
+ * each time, instead of auto-reloading to 0. That way every count is an absolute time: the
+ * ISR passes the alarm count and its own count to the task, and the task reads the count
+ * again when it starts the scan.
+ *
+ * Threshold crossings are checked on each sample as soon as it's read, so a crossing reaches
+ * its handler one scan after it happens rather than one frame.
+ *
+ * The same makes rate changes free: the ISR counts scans, and at each frame boundary it picks
+ * up the requested rate and schedules the next alarm one new period on. The timer keeps
+ * running and no scan is lost or doubled. It picks up the requested frame length there too and
+ * passes it on with each alarm, so the task ends the frame where the ISR does.
+ */
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "driver/gptimer.h"
 #include "esp_adc/adc_oneshot.h"
+#include "esp_timer.h"
 #include "esp_log.h"
+#include "sdkconfig.h"
+#include "seqlock.h"
+#include "ADC-sampler-priv.h"
 
-static const char* TAG = "";
-adc_oneshot_unit_handle_t adc_handle;
+#define TIMER_RESOLUTION_HZ 1000000 // 1MHz, 1 tick=1us
 
-void ADC_config(void) {
+static const char* TAG = "ADC sampler";
+static adc_oneshot_unit_handle_t adc_handle = NULL;
+static gptimer_handle_t ADC_sample_timer = NULL;
+// ISR only once started
+static uint32_t period_counts = 0;
+static uint32_t rate_hz = 0;
+static size_t scan_in_frame = 0;    // Position in its frame of the scan the next alarm is for
+static size_t frame_len = 0;        // Length of the frame the next alarm is in
+
+// Latest alarm, from the ISR to the task. A seqlock so the ISR never waits on the task
+static seqlock_t alarm_lock = SEQLOCK_INITIALIZER;
+static struct {
+    uint64_t alarm_count;   // When it was scheduled
+    uint64_t isr_count;     // When the ISR got to it
+    uint32_t rate_hz;       // Rate of the frame it's in
+    size_t frame_len;       // Length of the frame it's in
+} last_alarm;
+
+
+static esp_err_t ADC_config(const ADC_sampler_config_t* sampler_config) {
     // May have to mess with ADC unit and channel to get this to work
     adc_oneshot_unit_init_cfg_t adc_init_config = {
         .unit_id = ADC_UNIT_1,
         .ulp_mode = ADC_ULP_MODE_DISABLE,
     };
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&adc_init_config, &adc_handle));
+    esp_err_t err = adc_oneshot_new_unit(&adc_init_config, &adc_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
 
     adc_oneshot_chan_cfg_t config = {
         .bitwidth = ADC_BITWIDTH_DEFAULT,
         .atten = ADC_ATTEN_DB_12,
     };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc_handle, ADC_CHANNEL_0, &config));
+    for (size_t ch = 0; ch < sampler_config->num_channels && err == ESP_OK; ch++) {
+        err = adc_oneshot_config_channel(adc_handle, sampler_config->channels[ch], &config);
+    }
+    return err;
 }
 
-
-// ISR to sample from the ADC every 100ms when the timer expires
+// ISR that wakes the sampler task once per scan period
 static bool IRAM_ATTR ADC_sample_ISR(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_data) {
     BaseType_t high_task_awoken = pdFALSE;
-    // Sample from the ADC and write into double buffer
-    // May need to do this through an ISR-safe FreeRTOS call like a task notification
 
-    // Documentation says not to put this in an ISR but let's see if it works
-    adc_oneshot_read(adc_handle, ADC_CHANNEL_0, &buffer);
+    seqlock_write_begin(&alarm_lock);
+    last_alarm.alarm_count = edata->alarm_value;
+    last_alarm.isr_count = edata->count_value;
+    last_alarm.rate_hz = rate_hz;
+    last_alarm.frame_len = frame_len;
+    seqlock_write_end(&alarm_lock);
+
+    // The next alarm starts a frame. Switch rate now so the whole frame is at the new one
+    if (++scan_in_frame >= frame_len) {
+        scan_in_frame = 0;
+        frame_len = atomic_load_explicit(&ADC_sampler.requested_frame_len, memory_order_relaxed);
+        uint32_t requested = atomic_load_explicit(&ADC_sampler.requested_rate_hz, memory_order_relaxed);
+        if (requested != rate_hz) {
+            rate_hz = requested;
+            period_counts = TIMER_RESOLUTION_HZ / requested;
+        }
+    }
+
+    // Scheduled off the last alarm, not the current count, so lateness doesn't add up.
+    // If we're so late the next one's already due it fires straight away
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = edata->alarm_value + period_counts,
+    };
+    gptimer_set_alarm_action(timer, &alarm_config);
 
+    vTaskNotifyGiveFromISR(ADC_sampler.task, &high_task_awoken);
     return (high_task_awoken == pdTRUE);
 }
 
-// Function to configure a timer for this project and start it.
-// This should be called after other inits to start the program
-void ADC_sample_timer_config_start(void) {
-    //ESP_LOGI(TAG, "Create timer handle");
-    gptimer_handle_t ADC_sample_timer = NULL;
+static esp_err_t ADC_sample_timer_config(uint32_t sample_rate_hz) {
+    if (sample_rate_hz > TIMER_RESOLUTION_HZ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
     gptimer_config_t timer_config = {
         .clk_src = GPTIMER_CLK_SRC_DEFAULT,
         .direction = GPTIMER_COUNT_UP,
-        .resolution_hz = 1000000, // 1MHz, 1 tick=1us
+        .resolution_hz = TIMER_RESOLUTION_HZ,
     };
-    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &ADC_sample_timer));
+    esp_err_t err = gptimer_new_timer(&timer_config, &ADC_sample_timer);
+    if (err != ESP_OK) {
+        ADC_sample_timer = NULL;
+        return err;
+    }
 
     gptimer_event_callbacks_t cbs = {
         .on_alarm = ADC_sample_ISR,
     };
-    ESP_ERROR_CHECK(gptimer_register_event_callbacks(ADC_sample_timer, &cbs, NULL));
+    err = gptimer_register_event_callbacks(ADC_sample_timer, &cbs, NULL);
+    if (err == ESP_OK) {
+        err = gptimer_enable(ADC_sample_timer);
+    }
+    if (err != ESP_OK) {
+        // Never enabled if it got this far, so there's only the timer to delete
+        gptimer_del_timer(ADC_sample_timer);
+        ADC_sample_timer = NULL;
+    }
+    return err;
+}
+
+static void ADC_sample_task(void* param) {
+    size_t idx = 0;
+    size_t len = 0;     // Of the frame being read, from its first alarm
+
+    while (true) {
+        // More than one pending alarm means we slept through sample periods
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (pending > 1) {
+            ADC_sampler_add_overruns(pending - 1);
+        }
+
+        int64_t start = esp_timer_get_time();
+        uint64_t read_count = 0;
+        gptimer_get_raw_count(ADC_sample_timer, &read_count);
+
+        uint32_t seq;
+        uint64_t alarm_count, isr_count;
+        uint32_t alarm_rate_hz;
+        size_t alarm_frame_len;
+        do {
+            seq = seqlock_read_begin(&alarm_lock);
+            alarm_count = last_alarm.alarm_count;
+            isr_count = last_alarm.isr_count;
+            alarm_rate_hz = last_alarm.rate_hz;
+            alarm_frame_len = last_alarm.frame_len;
+        } while (seqlock_read_retry(&alarm_lock, seq));
+
+        ADC_sampler_add_timing((uint32_t)(isr_count - alarm_count), (uint32_t)(read_count - isr_count));
+        if (idx == 0) {
+            ADC_sampler_stamp(alarm_count, read_count, alarm_rate_hz);
+            len = alarm_frame_len;
+            ADC_sampler.frame_len = len;
+        }
 
-    //ESP_LOGI(TAG, "Enable timer");
-    ESP_ERROR_CHECK(gptimer_enable(ADC_sample_timer));
+        int raw;
+        for (size_t ch = 0; ch < ADC_sampler.config.num_channels; ch++) {
+            // Keep the channels lined up even if a read fails
+            if (adc_oneshot_read(adc_handle, ADC_sampler.config.channels[ch], &raw) != ESP_OK) {
+                raw = 0;
+            }
+            *ADC_sampler_slot(ch, idx) = (int16_t)raw;
+            // Straight away, not once the frame's full: this is the alarm path. Stamped when
+            // this channel's read finished, not when the scan started, so alarm latency isn't
+            // understated by the reads before it
+            ADC_sampler_check(ch, (int16_t)raw, esp_timer_get_time());
+        }
+        if (++idx >= len) {
+            ADC_sampler_deliver(idx);
+            idx = 0;
+        }
+        ADC_sampler_add_busy(esp_timer_get_time() - start);
+    }
+}
+
+esp_err_t ADC_sampler_config(const ADC_sampler_config_t* config) {
+    esp_err_t err = ADC_sampler_state_init(config, ADC_sample_task);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = ADC_config(config);
+    if (err == ESP_OK) {
+        err = ADC_sample_timer_config(config->sample_rate_hz);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Config failed: %s", esp_err_to_name(err));
+        ADC_sampler_deinit();
+    }
+    return err;
+}
+
+esp_err_t ADC_sampler_deinit(void) {
+    if (ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // A notification from before the stop may still have the task reading the timer and the
+    // ADC, so it goes before they do
+    ADC_sampler_task_delete();
+    if (ADC_sample_timer != NULL) {
+        gptimer_disable(ADC_sample_timer);
+        gptimer_del_timer(ADC_sample_timer);
+        ADC_sample_timer = NULL;
+    }
+    if (adc_handle != NULL) {
+        adc_oneshot_del_unit(adc_handle);
+        adc_handle = NULL;
+    }
+    ADC_sampler_state_free();
+    return ESP_OK;
+}
 
-    //ESP_LOGI(TAG, "Start timer, stop it at alarm event");
-    gptimer_alarm_config_t alarm_config1 = {
-        .reload_count = 0,
-        .flags.auto_reload_on_alarm = true,
-        .alarm_count = 100*1000, // period = 100ms
+esp_err_t ADC_sampler_start(void) {
+    if (ADC_sample_timer == NULL || ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Start counting from 0 with the first alarm one period in, at whatever rate was last set.
+    // The ISR isn't running, so its state is ours until gptimer_start
+    rate_hz = atomic_load(&ADC_sampler.requested_rate_hz);
+    period_counts = TIMER_RESOLUTION_HZ / rate_hz;
+    frame_len = atomic_load(&ADC_sampler.requested_frame_len);
+    scan_in_frame = 0;
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = period_counts,
     };
-    ESP_ERROR_CHECK(gptimer_set_alarm_action(ADC_sample_timer, &alarm_config1));
-    ESP_ERROR_CHECK(gptimer_start(ADC_sample_timer));
-    // Not including any stop functionality
-}
\ No newline at end of file
+    esp_err_t err = gptimer_set_raw_count(ADC_sample_timer, 0);
+    if (err == ESP_OK) {
+        err = gptimer_set_alarm_action(ADC_sample_timer, &alarm_config);
+    }
+    if (err == ESP_OK) {
+        err = gptimer_start(ADC_sample_timer);
+    }
+    // Not running unless the timer is, so ADC_sampler_stop and deinit see the state it's really in
+    if (err == ESP_OK) {
+        ADC_sampler.running = true;
+    }
+    return err;
+}
+
+esp_err_t ADC_sampler_set_rate(uint32_t sample_rate_hz) {
+    return ADC_sampler_request_rate(sample_rate_hz, TIMER_RESOLUTION_HZ);
+}
+
+esp_err_t ADC_sampler_set_frame_len(size_t len) {
+    return ADC_sampler_request_frame_len(len);
+}
+
+esp_err_t ADC_sampler_stop(void) {
+    if (!ADC_sampler.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ADC_sampler.running = false;
+    return gptimer_stop(ADC_sample_timer);
+}
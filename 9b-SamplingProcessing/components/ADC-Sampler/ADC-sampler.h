@@ -1,3 +0,0 @@
-#pragma once
-
-void ADC_sample_timer_config_start(void);
\ No newline at end of file
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "latency_hist.h"
+
+/**
+ * ADC sampling component. Scans a list of ADC1 channels at a fixed rate into a fixed pool
+ * of frames and lends each full frame to the consumer. Samples are written once, by the
+ * backend, straight into the frame, and are never copied after that.
+ *
+ * Ownership of a frame goes sampler -> consumer -> sampler:
+ *  - ADC_sampler_acquire hands the consumer the oldest full frame. The consumer owns it and
+ *    can read it for as long as it likes
+ *  - ADC_sampler_release gives it back to the sampler to refill
+ * If the consumer holds on to every frame the sampler has nowhere to write. What happens then
+ * is the overrun policy, but the sampler never waits for a frame either way, so sampling stays
+ * on schedule through consumer stalls and the overload shows up in the stats instead:
+ *  - Drop newest: the frames sampled in the meantime are thrown away (dropped_frames)
+ *  - Overwrite oldest: the oldest full frame the consumer hasn't acquired yet is reused for
+ *    the new one (overwritten_frames). The consumer always gets the freshest data
+ *  - Spare pool: a few extra frames are held back and only handed out when the pool runs dry
+ *    (spare_frames_used). They go back to the spare pool as soon as they're released. Once
+ *    the spares run out too it drops newest
+ * The sequence numbers of the frames the consumer does get show where data went missing.
+ *
+ * Instead of acquiring, a consumer can set on_frame to be called from the sampler task with
+ * each full frame. The frame is released automatically when the callback returns.
+ *
+ * More consumers can subscribe (ADC_sampler_subscribe) to get every frame as well, without a
+ * copy: each full frame goes to the main consumer and to every subscriber's own queue, and it
+ * only goes back to the pool once the last of them has released it. Every subscriber holds its
+ * own reference, so a slow one never holds the others up, but it does keep frames out of the
+ * pool: up to its queue length plus the one it's reading. Size num_frames for that. A
+ * subscriber whose queue is full misses the frame (its dropped count) rather than making the
+ * sampler wait, and the overrun policies only ever apply to the main consumer's frames.
+ *
+ * Frames are structure-of-arrays: each channel's samples are one contiguous block, so a
+ * consumer can run the block kernels over a channel without de-interleaving it first.
+ *
+ * The backend is picked at build time in menuconfig (ADC Sampler -> Sampling backend):
+ *  - Oneshot: a gptimer alarm wakes the sampler task which does one adc_oneshot_read per channel
+ *  - Continuous: the ADC's DMA fills whole frames and the sampler task is woken once per frame
+ *  - Mock: generates a test signal at the configured rate, for the linux target
+ *  - Replay: reads scans back from a capture file (replay_path), for the linux target. In real
+ *    time at the configured rate, or with replay_fast as fast as the consumers release frames
+ * All of them take the same config and hand out frames the same way.
+ *
+ * Timing: each frame is tagged with when its first scan was scheduled and when it was actually
+ * read, and every scan feeds two histograms (ADC_sampler_get_timing):
+ *  - jitter: scheduled alarm -> alarm ISR running. How late the hardware got to the sample
+ *  - read latency: alarm ISR -> sampler task starting the read
+ * The oneshot backend uses the gptimer's count (1 us per count, free running from start) for
+ * all of it. The mock backend uses esp_timer and only has jitter, per frame. The continuous
+ * backend is paced by the ADC itself, so its tags are 0 and the histograms stay empty.
+ *
+ * Rate: ADC_sampler_set_rate changes the scan rate while running. It takes effect from the
+ * next frame, so every frame is sampled at one rate, sample_rate_hz in the frame. The oneshot
+ * backend just schedules the next alarm one new period on, the timer is never stopped. Each
+ * change is logged with the first frame and scan at the new rate (ADC_sampler_get_rate_changes)
+ * so a consumer can put samples on a common time base. A frame that lost scans to an overrun
+ * can straddle a change. The continuous backend can't change rate without restarting the DMA,
+ * so it doesn't support it.
+ *
+ * Frame length: ADC_sampler_set_frame_len changes how many scans go in a frame, from the next
+ * frame on, up to the config's frame_len that the pool was sized for. Every frame's len says how
+ * long it is. Shorter frames reach the consumer sooner after their first scan but wake it more
+ * often, so it's the knob between latency and per-frame overhead. The oneshot ISR switches at
+ * the frame boundary like it does the rate. The continuous backend's DMA frames are sized when
+ * the driver is configured, so it doesn't support it either.
+ */
+
+#define ADC_SAMPLER_MAX_CHANNELS 8
+
+#define ADC_SAMPLER_DEFAULT_FRAMES 3
+#define ADC_SAMPLER_DEFAULT_SPARE_FRAMES 2
+#define ADC_SAMPLER_RATE_LOG_LEN 16     // Rate changes kept for ADC_sampler_get_rate_changes
+#define ADC_SAMPLER_CROSSING_QUEUE_LEN 8    // Crossings waiting for ADC_sampler_wait_crossing
+#define ADC_SAMPLER_MAX_SUBSCRIBERS 4
+
+typedef enum {
+    ADC_SAMPLER_OVERRUN_DROP_NEWEST = 0,
+    ADC_SAMPLER_OVERRUN_OVERWRITE_OLDEST,
+    ADC_SAMPLER_OVERRUN_SPARE_POOL,
+} ADC_sampler_overrun_policy_t;
+
+typedef struct {
+    uint32_t seq;                                       // Frame number since config, counting dropped frames
+    int64_t timestamp_us;                               // esp_timer time the frame was completed
+    uint64_t alarm_count;                               // Timer count the first scan was scheduled for
+    uint64_t read_count;                                // Timer count when the first scan was read
+    uint32_t sample_rate_hz;                            // Scan rate the whole frame was sampled at
+    size_t num_channels;
+    size_t len;                                         // Samples per channel
+    const uint8_t* channels;                            // ADC channel number of each block
+    const int16_t* samples[ADC_SAMPLER_MAX_CHANNELS];   // samples[i] is len samples from channels[i]
+} ADC_sampler_frame_t;
+
+// Called from the sampler task with a full frame. The frame goes back to the pool when it returns
+typedef void (*ADC_sampler_frame_cb_t)(const ADC_sampler_frame_t* frame, void* user_ctx);
+
+typedef struct {
+    uint32_t sample_rate_hz;        // Scans per second. Every channel is sampled once per scan
+    size_t frame_len;               // Samples per channel per frame, and the most ADC_sampler_set_frame_len can set
+    size_t num_frames;              // Frames in the pool. 0 for ADC_SAMPLER_DEFAULT_FRAMES
+    ADC_sampler_overrun_policy_t overrun_policy;    // What to do when the consumer holds every frame
+    size_t num_spare_frames;        // Spare pool policy only. 0 for ADC_SAMPLER_DEFAULT_SPARE_FRAMES
+    uint8_t channels[ADC_SAMPLER_MAX_CHANNELS];  // ADC1 channels to scan, in order
+    size_t num_channels;
+    ADC_sampler_frame_cb_t on_frame;   // Optional. NULL to use ADC_sampler_acquire instead
+    void* user_ctx;                 // Passed through to on_frame
+    uint32_t task_priority;         // Priority of the sampler task
+    const char* replay_path;        // Replay backend only: capture file, *.csv or raw int16 scans
+    bool replay_fast;               // Replay backend only: as fast as frames are released, never dropping
+} ADC_sampler_config_t;
+
+typedef struct {
+    uint32_t frames;                // Full frames handed to the main consumer
+    uint32_t samples;               // Samples in those frames, counting every channel
+    uint32_t overruns;              // Times the sampler task fell behind and data was lost
+    uint32_t dropped_frames;        // Frames sampled while the consumer held every frame in the pool
+    uint32_t overwritten_frames;    // Full frames reused before the consumer got to them
+    uint32_t dropped_samples;       // Samples in the dropped frames, counting every channel
+    uint32_t overwritten_samples;   // Samples in the overwritten frames, counting every channel
+    uint32_t spare_frames_used;     // Times a spare frame had to be handed out
+    uint32_t rate_changes;          // Rate changes that have taken effect
+    uint32_t crossings;             // Threshold crossings detected
+    uint32_t dropped_crossings;     // Crossings the queue had no room for
+    int64_t busy_us;                // Time the sampler task spent reading and in on_frame
+    int64_t deliver_us;             // Part of it spent handing full frames over, on_frame included
+} ADC_sampler_stats_t;
+
+// Set up the ADC, the rate source and the sampler task. Call once before ADC_sampler_start
+esp_err_t ADC_sampler_config(const ADC_sampler_config_t* config);
+// Undo ADC_sampler_config so it can be called again with different settings. Must be stopped
+esp_err_t ADC_sampler_deinit(void);
+
+esp_err_t ADC_sampler_start(void);
+esp_err_t ADC_sampler_stop(void);
+
+// Borrow the oldest full frame, waiting up to wait ticks for one. The frame is the caller's
+// until it's passed to ADC_sampler_release. Returns NULL on timeout
+const ADC_sampler_frame_t* ADC_sampler_acquire(TickType_t wait);
+// Give a frame from ADC_sampler_acquire or ADC_sampler_sub_acquire back. It's refilled once
+// every consumer that got it has given it back
+void ADC_sampler_release(const ADC_sampler_frame_t* frame);
+// Full frames waiting to be acquired
+size_t ADC_sampler_frames_waiting(void);
+// True once the source has run out: the replay backend has reached the end of its file and
+// every whole frame in it has been delivered. Always false for the ADC
+bool ADC_sampler_done(void);
+
+typedef struct ADC_sampler_sub ADC_sampler_sub_t;
+
+typedef struct {
+    uint32_t frames;                // Frames queued for the subscriber
+    uint32_t dropped_frames;        // Frames it missed because its queue was full
+    uint32_t waiting;               // Frames in its queue now
+    uint32_t max_waiting;           // Most ever in its queue, right after a frame was queued
+} ADC_sampler_sub_stats_t;
+
+// Add a consumer that gets every full frame from now on in a queue of its own, up to queue_len
+// deep. Call between ADC_sampler_config and ADC_sampler_start. Subscribers last until
+// ADC_sampler_deinit
+esp_err_t ADC_sampler_subscribe(size_t queue_len, ADC_sampler_sub_t** sub);
+// Like ADC_sampler_acquire, for one subscriber. Hand the frame back with ADC_sampler_release
+const ADC_sampler_frame_t* ADC_sampler_sub_acquire(ADC_sampler_sub_t* sub, TickType_t wait);
+// Copy out a subscriber's counters and, if lag isn't NULL, its frame completed -> acquired
+// times in us. Safe to call while running
+void ADC_sampler_get_sub_stats(ADC_sampler_sub_t* sub, ADC_sampler_sub_stats_t* stats, latency_hist_t* lag);
+
+typedef struct {
+    uint32_t seq;                   // First frame sampled at the new rate
+    uint64_t alarm_count;           // Timer count its first scan was scheduled for
+    int64_t timestamp_us;           // esp_timer time its first scan was read
+    uint32_t sample_rate_hz;        // The new rate
+} ADC_sampler_rate_change_t;
+
+// Change the scan rate from the next frame on. Can be called while running, from any task.
+// Only the last rate set before a frame starts counts. ESP_ERR_NOT_SUPPORTED on the continuous
+// backend
+esp_err_t ADC_sampler_set_rate(uint32_t sample_rate_hz);
+// Rate of the frame being sampled now
+uint32_t ADC_sampler_get_rate(void);
+// Copy out up to max logged rate changes, oldest first, starting from change number *cursor
+// (start at 0) and move *cursor past them. If the log has moved on past *cursor the missed
+// changes are skipped. Returns how many were copied. Safe to call while running
+size_t ADC_sampler_get_rate_changes(ADC_sampler_rate_change_t* changes, size_t max, uint32_t* cursor);
+
+// Change the scans per frame, 1 to the config's frame_len, from the next frame on. Can be called
+// while running, from any task. ESP_ERR_NOT_SUPPORTED on the continuous backend
+esp_err_t ADC_sampler_set_frame_len(size_t len);
+// Length of the frame being sampled now
+size_t ADC_sampler_get_frame_len(void);
+
+// Comparator with hysteresis on one channel, checked on every sample by the sampler as it's
+// read, before the frame is anywhere near full. A sample at or over high while armed is a
+// rising crossing; after that a sample at or under low is a falling one and re-arms it
+typedef struct {
+    int16_t high;
+    int16_t low;                    // Below high. The gap is the hysteresis
+} ADC_sampler_threshold_t;
+
+typedef struct {
+    uint32_t seq;                   // Crossing number since config, counting dropped ones
+    size_t channel;                 // Position in the scan list
+    bool rising;
+    int16_t sample;                 // The sample that crossed
+    int64_t timestamp_us;           // esp_timer time the sample was taken
+} ADC_sampler_crossing_t;
+
+// Watch channel ch (position in the scan list) for crossings, or stop if threshold is NULL.
+// Can be called while running, from any task. The channel starts armed
+esp_err_t ADC_sampler_set_threshold(size_t ch, const ADC_sampler_threshold_t* threshold);
+// Wait up to wait ticks for the next crossing, for one handler task. Give the handler a higher
+// priority than the sampler task and it runs as soon as the sampler queues the crossing.
+// Returns false on timeout
+bool ADC_sampler_wait_crossing(ADC_sampler_crossing_t* crossing, TickType_t wait);
+
+// Copy out the counters. Safe to call while running
+void ADC_sampler_get_stats(ADC_sampler_stats_t* stats);
+// Copy out the timing histograms (in us) since ADC_sampler_config. Either can be NULL. Safe to
+// call while running
+void ADC_sampler_get_timing(latency_hist_t* jitter, latency_hist_t* read_latency);
@@ -0,0 +1,36 @@
+#include "block_kernels.h"
+
+
+int32_t block_sum_i16(const int16_t* restrict x, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += x[i];
+    }
+    return sum;
+}
+
+int64_t block_sum_sq_i16(const int16_t* restrict x, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (int32_t)x[i] * x[i];
+    }
+    return sum;
+}
+
+void block_minmax_i16(const int16_t* restrict x, size_t n, int16_t* min, int16_t* max) {
+    // Ternaries instead of ifs so the loop turns into vector min/max instructions
+    int16_t lo = x[0];
+    int16_t hi = x[0];
+    for (size_t i = 1; i < n; i++) {
+        lo = (x[i] < lo) ? x[i] : lo;
+        hi = (x[i] > hi) ? x[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+}
+
+void block_scale_to_mv_i16(const int16_t* x, int16_t* out, size_t n, int32_t scale_q16, int16_t offset_mv) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (int16_t)(((int32_t)x[i] * scale_q16) >> 16) + offset_mv;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Reductions over blocks of packed int16_t samples.
+ *
+ * The ADC is 12-bit so int16_t holds a sample with room to spare and halves the buffer
+ * memory compared to int. Each kernel is a single pass with no branches in the loop body
+ * and restrict pointers, so GCC vectorizes it wherever the target has a vector unit
+ * (SSE/AVX on the linux target). The ESP32-C6 has no SIMD, so there it's just a tight loop.
+ */
+
+// Millivolts per code in 16.16 fixed point, for block_scale_to_mv
+#define BLOCK_MV_SCALE_Q16(full_scale_mv, max_code) ((int32_t)(((int64_t)(full_scale_mv) << 16) / (max_code)))
+
+int32_t block_sum_i16(const int16_t* restrict x, size_t n);
+// 64-bit so 12-bit samples can't overflow for any block that fits in RAM
+int64_t block_sum_sq_i16(const int16_t* restrict x, size_t n);
+// n must be at least 1
+void block_minmax_i16(const int16_t* restrict x, size_t n, int16_t* min, int16_t* max);
+// out[i] = (x[i] * scale_q16 >> 16) + offset_mv. x and out can be the same block
+void block_scale_to_mv_i16(const int16_t* x, int16_t* out, size_t n, int32_t scale_q16, int16_t offset_mv);
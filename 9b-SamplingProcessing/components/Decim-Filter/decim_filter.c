@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <string.h>
+#include "decim_filter.h"
+#include "decim_filter_coeffs.h"
+
+
+static inline int16_t saturate_i16(int32_t x) {
+    if (x > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (x < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)x;
+}
+
+static inline int16_t round_f32_to_i16(float x) {
+    float r = x + (x >= 0.0f ? 0.5f : -0.5f);
+    if (r >= (float)INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (r <= (float)INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)r;
+}
+
+
+/* FIR */
+
+static esp_err_t fir_decim_alloc(fir_decim_t* f, size_t coeff_size, size_t taps, size_t factor, size_t max_block) {
+    if (f == NULL || taps == 0 || factor == 0 || max_block == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    f->coeffs = malloc(taps * coeff_size);
+    f->history = malloc((taps - 1 + max_block) * sizeof(int16_t));
+    if (f->coeffs == NULL || f->history == NULL) {
+        fir_decim_free(f);
+        return ESP_ERR_NO_MEM;
+    }
+
+    f->taps = taps;
+    f->factor = factor;
+    f->max_block = max_block;
+    fir_decim_reset(f);
+    return ESP_OK;
+}
+
+esp_err_t fir_decim_init_q15(fir_decim_t* f, const int16_t* coeffs, size_t taps, size_t factor, size_t max_block) {
+    esp_err_t err = fir_decim_alloc(f, sizeof(int16_t), taps, factor, max_block);
+    if (err != ESP_OK) {
+        return err;
+    }
+    int16_t* h = f->coeffs;
+    for (size_t i = 0; i < taps; i++) {
+        h[i] = coeffs[taps - 1 - i];
+    }
+    f->fixed = true;
+    return ESP_OK;
+}
+
+esp_err_t fir_decim_init_f32(fir_decim_t* f, const float* coeffs, size_t taps, size_t factor, size_t max_block) {
+    esp_err_t err = fir_decim_alloc(f, sizeof(float), taps, factor, max_block);
+    if (err != ESP_OK) {
+        return err;
+    }
+    float* h = f->coeffs;
+    for (size_t i = 0; i < taps; i++) {
+        h[i] = coeffs[taps - 1 - i];
+    }
+    f->fixed = false;
+    return ESP_OK;
+}
+
+void fir_decim_free(fir_decim_t* f) {
+    free(f->coeffs);
+    free(f->history);
+    f->coeffs = NULL;
+    f->history = NULL;
+    f->taps = 0;
+}
+
+void fir_decim_reset(fir_decim_t* f) {
+    memset(f->history, 0, (f->taps - 1) * sizeof(int16_t));
+    // Keep the last input of every group of factor
+    f->phase = f->factor - 1;
+}
+
+// The output for the newest of taps inputs. 12-bit samples times Q15 taps that sum to
+// less than 2 can't overflow 32 bits (gen_coeffs.py checks)
+static inline int16_t fir_dot_q15(const int16_t* restrict x, const int16_t* restrict h, size_t taps) {
+    int32_t acc = 1 << 14;  // Round to nearest
+    for (size_t i = 0; i < taps; i++) {
+        acc += (int32_t)x[i] * h[i];
+    }
+    return saturate_i16(acc >> 15);
+}
+
+static inline int16_t fir_dot_f32(const int16_t* restrict x, const float* restrict h, size_t taps) {
+    float acc = 0.0f;
+    for (size_t i = 0; i < taps; i++) {
+        acc += (float)x[i] * h[i];
+    }
+    return round_f32_to_i16(acc);
+}
+
+size_t fir_decim_process(fir_decim_t* f, const int16_t* in, size_t len, int16_t* out) {
+    if (len > f->max_block) {
+        len = f->max_block;
+    }
+    const size_t keep = f->taps - 1;
+    memcpy(f->history + keep, in, len * sizeof(int16_t));
+
+    // history[i .. i + taps - 1] are the inputs that make output i. Skipping straight from
+    // one kept output to the next is the polyphase decomposition: every tap is used once per
+    // kept output and the factor - 1 dropped outputs in between are never computed
+    size_t n = 0;
+    size_t i = f->phase;
+    if (f->fixed) {
+        for (; i < len; i += f->factor) {
+            out[n++] = fir_dot_q15(&f->history[i], f->coeffs, f->taps);
+        }
+    } else {
+        for (; i < len; i += f->factor) {
+            out[n++] = fir_dot_f32(&f->history[i], f->coeffs, f->taps);
+        }
+    }
+    f->phase = i - len;
+
+    memmove(f->history, f->history + len, keep * sizeof(int16_t));
+    return n;
+}
+
+
+/* Biquads */
+
+static esp_err_t biquad_decim_alloc(biquad_decim_t* b, const void* coeffs, size_t sections, size_t factor) {
+    if (b == NULL || coeffs == NULL || sections == 0 || factor == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    b->state = malloc(sections * sizeof(biquad_state_t));
+    if (b->state == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    b->coeffs = coeffs;
+    b->sections = sections;
+    b->factor = factor;
+    biquad_decim_reset(b);
+    return ESP_OK;
+}
+
+esp_err_t biquad_decim_init_q28(biquad_decim_t* b, const int32_t (*coeffs)[5], size_t sections, size_t factor) {
+    esp_err_t err = biquad_decim_alloc(b, coeffs, sections, factor);
+    if (err == ESP_OK) {
+        b->fixed = true;
+    }
+    return err;
+}
+
+esp_err_t biquad_decim_init_f32(biquad_decim_t* b, const float (*coeffs)[5], size_t sections, size_t factor) {
+    esp_err_t err = biquad_decim_alloc(b, coeffs, sections, factor);
+    if (err == ESP_OK) {
+        b->fixed = false;
+    }
+    return err;
+}
+
+void biquad_decim_free(biquad_decim_t* b) {
+    free(b->state);
+    b->state = NULL;
+    b->sections = 0;
+}
+
+void biquad_decim_reset(biquad_decim_t* b) {
+    memset(b->state, 0, b->sections * sizeof(biquad_state_t));
+    b->phase = b->factor - 1;
+}
+
+// Direct Form I. Coefficients are Q28, so the accumulator needs 64 bits. The bits shifted
+// off each output are added back into the next one instead of being thrown away
+static inline int32_t biquad_step_q28(biquad_state_t* s, const int32_t* c, int32_t x) {
+    int64_t acc = s->err
+                + (int64_t)c[0] * x + (int64_t)c[1] * s->x1 + (int64_t)c[2] * s->x2
+                - (int64_t)c[3] * s->y1 - (int64_t)c[4] * s->y2;
+    int32_t y = (int32_t)(acc >> 28);
+    s->err = acc - ((int64_t)y << 28);
+    s->x2 = s->x1;
+    s->x1 = x;
+    s->y2 = s->y1;
+    s->y1 = y;
+    return y;
+}
+
+// Transposed Direct Form II, which has the best rounding behaviour in float
+static inline float biquad_step_f32(biquad_state_t* s, const float* c, float x) {
+    float y = c[0] * x + s->s1;
+    s->s1 = c[1] * x - c[3] * y + s->s2;
+    s->s2 = c[2] * x - c[4] * y;
+    return y;
+}
+
+size_t biquad_decim_process(biquad_decim_t* b, const int16_t* in, size_t len, int16_t* out) {
+    size_t n = 0;
+    size_t phase = b->phase;
+
+    // Unlike the FIR, every input has to go through the filter to keep the state right.
+    // Only the decimation is free
+    if (b->fixed) {
+        const int32_t (*c)[5] = b->coeffs;
+        for (size_t i = 0; i < len; i++) {
+            int32_t y = in[i];
+            for (size_t s = 0; s < b->sections; s++) {
+                y = biquad_step_q28(&b->state[s], c[s], y);
+            }
+            if (phase == 0) {
+                out[n++] = saturate_i16(y);
+                phase = b->factor;
+            }
+            phase--;
+        }
+    } else {
+        const float (*c)[5] = b->coeffs;
+        for (size_t i = 0; i < len; i++) {
+            float y = in[i];
+            for (size_t s = 0; s < b->sections; s++) {
+                y = biquad_step_f32(&b->state[s], c[s], y);
+            }
+            if (phase == 0) {
+                out[n++] = round_f32_to_i16(y);
+                phase = b->factor;
+            }
+            phase--;
+        }
+    }
+
+    b->phase = phase;
+    return n;
+}
+
+
+/* Configured filter */
+
+esp_err_t decim_filter_init(decim_filter_t* d, size_t max_block) {
+    if (d == NULL || max_block == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    d->max_block = max_block;
+
+#if CONFIG_DECIM_FILTER_TYPE_FIR && CONFIG_DECIM_FILTER_FIXED_POINT
+    return fir_decim_init_q15(&d->fir, decim_fir_q15, DECIM_FIR_TAPS, DECIM_FILTER_FACTOR, max_block);
+#elif CONFIG_DECIM_FILTER_TYPE_FIR
+    return fir_decim_init_f32(&d->fir, decim_fir_f32, DECIM_FIR_TAPS, DECIM_FILTER_FACTOR, max_block);
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD && CONFIG_DECIM_FILTER_FIXED_POINT
+    return biquad_decim_init_q28(&d->biquad, decim_biquad_q28, DECIM_BIQUAD_SECTIONS, DECIM_FILTER_FACTOR);
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD
+    return biquad_decim_init_f32(&d->biquad, decim_biquad_f32, DECIM_BIQUAD_SECTIONS, DECIM_FILTER_FACTOR);
+#else
+    d->factor = 1;
+    d->phase = 0;
+    return ESP_OK;
+#endif
+}
+
+void decim_filter_free(decim_filter_t* d) {
+#if CONFIG_DECIM_FILTER_TYPE_FIR
+    fir_decim_free(&d->fir);
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD
+    biquad_decim_free(&d->biquad);
+#endif
+}
+
+void decim_filter_reset(decim_filter_t* d) {
+#if CONFIG_DECIM_FILTER_TYPE_FIR
+    fir_decim_reset(&d->fir);
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD
+    biquad_decim_reset(&d->biquad);
+#else
+    d->phase = d->factor - 1;
+#endif
+}
+
+// Both filters count down to their next kept output, so a new factor just changes the step
+// from the one after that on. The FIR's history and the biquads' state carry over to the new
+// coefficients, so there's no gap in the output, just a short transient
+esp_err_t decim_filter_set_factor(decim_filter_t* d, size_t factor) {
+    if (factor != DECIM_FILTER_FACTOR && factor != DECIM_FILTER_SHED_FACTOR) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const bool shed = (factor != DECIM_FILTER_FACTOR);
+#if CONFIG_DECIM_FILTER_TYPE_FIR
+    // Same taps, so they go over the old ones in the buffer, time reversed like at init
+#if CONFIG_DECIM_FILTER_FIXED_POINT
+    const int16_t* c = shed ? decim_fir_q15_shed : decim_fir_q15;
+    int16_t* h = d->fir.coeffs;
+#else
+    const float* c = shed ? decim_fir_f32_shed : decim_fir_f32;
+    float* h = d->fir.coeffs;
+#endif
+    for (size_t i = 0; i < DECIM_FIR_TAPS; i++) {
+        h[i] = c[DECIM_FIR_TAPS - 1 - i];
+    }
+    d->fir.factor = factor;
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD
+#if CONFIG_DECIM_FILTER_FIXED_POINT
+    d->biquad.coeffs = shed ? decim_biquad_q28_shed : decim_biquad_q28;
+#else
+    d->biquad.coeffs = shed ? decim_biquad_f32_shed : decim_biquad_f32;
+#endif
+    d->biquad.factor = factor;
+#else
+    // No lowpass to switch
+    (void)shed;
+    d->factor = factor;
+#endif
+    return ESP_OK;
+}
+
+size_t decim_filter_get_factor(const decim_filter_t* d) {
+#if CONFIG_DECIM_FILTER_TYPE_FIR
+    return d->fir.factor;
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD
+    return d->biquad.factor;
+#else
+    return d->factor;
+#endif
+}
+
+size_t decim_filter_process(decim_filter_t* d, const int16_t* in, size_t len, int16_t* out) {
+#if CONFIG_DECIM_FILTER_TYPE_FIR
+    return fir_decim_process(&d->fir, in, len, out);
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD
+    return biquad_decim_process(&d->biquad, in, len, out);
+#else
+    if (len > d->max_block) {
+        len = d->max_block;
+    }
+    if (d->factor == 1) {
+        memcpy(out, in, len * sizeof(int16_t));
+        return len;
+    }
+    size_t n = 0;
+    size_t i = d->phase;
+    for (; i < len; i += d->factor) {
+        out[n++] = in[i];
+    }
+    d->phase = i - len;
+    return n;
+#endif
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+Designs the decimation filter coefficients and writes them out as a C header.
+
+Run by the component's CMakeLists.txt at configure time with the Kconfig options, so the
+tables are constants in flash and nothing has to be designed on the chip. Both the fixed
+and float versions of both filters are written; decim_filter.c picks the ones it needs.
+Each comes twice: for the configured factor, and with the cutoff halved for twice that
+(the _shed tables, for decim_filter_set_factor).
+
+    gen_coeffs.py --factor 4 --cutoff-percent 80 --taps 32 --sections 2 --out decim_filter_coeffs.h
+"""
+import argparse
+import math
+
+
+def fir_lowpass(taps, cutoff):
+    """Blackman-windowed sinc. cutoff is a fraction of the input sample rate."""
+    mid = (taps - 1) / 2
+    h = []
+    for i in range(taps):
+        t = i - mid
+        sinc = 2 * cutoff if t == 0 else math.sin(2 * math.pi * cutoff * t) / (math.pi * t)
+        # Window spans taps + 2 points so the end taps aren't wasted on zeros
+        x = (i + 1) / (taps + 1)
+        window = 0.42 - 0.5 * math.cos(2 * math.pi * x) + 0.08 * math.cos(4 * math.pi * x)
+        h.append(sinc * window)
+    # Unity gain at DC
+    total = sum(h)
+    return [c / total for c in h]
+
+
+def quantize_unity(h, frac_bits):
+    """Round to fixed point, nudging the biggest taps so DC gain is still exactly 1."""
+    one = 1 << frac_bits
+    q = [round(c * one) for c in h]
+    order = sorted(range(len(h)), key=lambda i: -abs(h[i]))
+    i = 0
+    while sum(q) != one:
+        q[order[i % len(q)]] += 1 if sum(q) < one else -1
+        i += 1
+    return q
+
+
+def butterworth_sections(sections, cutoff):
+    """Lowpass biquads (b0, b1, b2, a1, a2) with a0 normalized to 1. cutoff as above."""
+    order = 2 * sections
+    w0 = 2 * math.pi * cutoff
+    out = []
+    for k in range(sections):
+        q = 1 / (2 * math.cos(math.pi * (2 * k + 1) / (2 * order)))
+        alpha = math.sin(w0) / (2 * q)
+        a0 = 1 + alpha
+        b0 = (1 - math.cos(w0)) / 2 / a0
+        out.append((b0, 2 * b0, b0, -2 * math.cos(w0) / a0, (1 - alpha) / a0))
+    return out
+
+
+def quantize_biquad(section, frac_bits):
+    """Round to fixed point, fixing b1 up so each section's DC gain is still exactly 1."""
+    one = 1 << frac_bits
+    b0, _, b2, a1, a2 = (round(c * one) for c in section)
+    b1 = one + a1 + a2 - b0 - b2
+    return (b0, b1, b2, a1, a2)
+
+
+def c_array(values, fmt):
+    lines = []
+    for i in range(0, len(values), 8):
+        lines.append("    " + ", ".join(fmt(v) for v in values[i:i + 8]) + ",")
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--factor", type=int, required=True)
+    parser.add_argument("--cutoff-percent", type=int, required=True)
+    parser.add_argument("--taps", type=int, required=True)
+    parser.add_argument("--sections", type=int, required=True)
+    parser.add_argument("--out", required=True)
+    args = parser.parse_args()
+
+    with open(args.out, "w") as f:
+        f.write("// Generated by gen_coeffs.py from the Decimation Filter Kconfig options. Don't edit\n")
+        f.write("#pragma once\n\n#include <stdint.h>\n\n")
+        f.write(f"#define DECIM_FIR_TAPS {args.taps}\n")
+        f.write(f"#define DECIM_BIQUAD_SECTIONS {args.sections}\n")
+        write_tables(f, args, args.factor, "")
+        write_tables(f, args, args.factor * 2, "_shed")
+
+
+def write_tables(f, args, factor, suffix):
+    # Fraction of the input rate: percent of the output Nyquist, which is 1 / (2 * factor)
+    cutoff = args.cutoff_percent / 100 / (2 * factor)
+
+    fir = fir_lowpass(args.taps, cutoff)
+    fir_q15 = quantize_unity(fir, 15)
+    # The Q15 accumulator is 32-bit. Samples are at most 16-bit, so it can't overflow as
+    # long as the taps' absolute sum stays under 2
+    if sum(abs(c) for c in fir_q15) >= 2 << 15:
+        raise SystemExit("FIR taps too large for a 32-bit accumulator")
+
+    biquads = butterworth_sections(args.sections, cutoff)
+
+    f.write(f"\n// factor {factor}, cutoff {cutoff:.6f} of the input rate\n")
+    f.write(f"static const int16_t decim_fir_q15{suffix}[DECIM_FIR_TAPS] = {{\n")
+    f.write(c_array(fir_q15, str) + "\n};\n\n")
+    f.write(f"static const float decim_fir_f32{suffix}[DECIM_FIR_TAPS] = {{\n")
+    f.write(c_array(fir, lambda v: f"{v:.9e}f") + "\n};\n\n")
+    f.write("// b0, b1, b2, a1, a2 per section\n")
+    f.write(f"static const int32_t decim_biquad_q28{suffix}[DECIM_BIQUAD_SECTIONS][5] = {{\n")
+    for s in biquads:
+        f.write("    {" + ", ".join(str(c) for c in quantize_biquad(s, 28)) + "},\n")
+    f.write("};\n\n")
+    f.write(f"static const float decim_biquad_f32{suffix}[DECIM_BIQUAD_SECTIONS][5] = {{\n")
+    for s in biquads:
+        f.write("    {" + ", ".join(f"{c:.9e}f" for c in s) + "},\n")
+    f.write("};\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/**
+ * Anti-aliasing lowpass + decimation for blocks of int16_t samples.
+ *
+ * Two filters, each with a fixed-point and a float version:
+ *   fir_decim_t     polyphase FIR. Only every factor'th output is computed, so each kept
+ *                   output costs taps multiplies and the dropped ones cost nothing.
+ *   biquad_decim_t  cascade of Direct Form I biquads. Runs on every input and keeps every
+ *                   factor'th output. The fixed-point version saves the rounding error
+ *                   between samples so low cutoffs don't pick up a DC offset.
+ *
+ * Blocks can be any length up to the max_block given at init and don't have to be a
+ * multiple of the factor; the decimation phase carries over between calls.
+ *
+ * decim_filter_t wraps whichever one is picked in menuconfig, with coefficients designed
+ * at build time from the Kconfig options (see gen_coeffs.py). A second set is designed for
+ * DECIM_FILTER_SHED_FACTOR, so load shedding can halve the output rate without aliasing.
+ */
+
+#ifdef CONFIG_DECIM_FILTER_FACTOR
+#define DECIM_FILTER_FACTOR CONFIG_DECIM_FILTER_FACTOR
+#else
+#define DECIM_FILTER_FACTOR 1
+#endif
+#define DECIM_FILTER_SHED_FACTOR (DECIM_FILTER_FACTOR * 2)
+
+typedef struct {
+    size_t taps;
+    size_t factor;
+    bool fixed;             // Q15 coefficients if true, float if false
+    void* coeffs;           // Time reversed so the inner loop walks both arrays forwards
+    int16_t* history;       // Last taps - 1 inputs followed by room for max_block new ones
+    size_t max_block;
+    size_t phase;           // Inputs to skip before the next kept output
+} fir_decim_t;
+
+typedef struct {
+    int32_t x1, x2;
+    int32_t y1, y2;
+    int64_t err;            // Fixed point only: bits lost to rounding the last output
+    float s1, s2;           // Float only: transposed state
+} biquad_state_t;
+
+typedef struct {
+    size_t sections;
+    size_t factor;
+    bool fixed;             // Q28 coefficients if true, float if false
+    const void* coeffs;     // [sections][5] of b0, b1, b2, a1, a2. Not copied
+    biquad_state_t* state;
+    size_t phase;
+} biquad_decim_t;
+
+// coeffs are copied. They should sum to 1 << 15 for unity gain
+esp_err_t fir_decim_init_q15(fir_decim_t* f, const int16_t* coeffs, size_t taps, size_t factor, size_t max_block);
+esp_err_t fir_decim_init_f32(fir_decim_t* f, const float* coeffs, size_t taps, size_t factor, size_t max_block);
+void fir_decim_free(fir_decim_t* f);
+void fir_decim_reset(fir_decim_t* f);
+// Filters len samples (at most max_block) and writes the kept ones to out. Returns how many
+// were written, which is at most len / factor + 1
+size_t fir_decim_process(fir_decim_t* f, const int16_t* in, size_t len, int16_t* out);
+
+// coeffs must outlive the filter
+esp_err_t biquad_decim_init_q28(biquad_decim_t* b, const int32_t (*coeffs)[5], size_t sections, size_t factor);
+esp_err_t biquad_decim_init_f32(biquad_decim_t* b, const float (*coeffs)[5], size_t sections, size_t factor);
+void biquad_decim_free(biquad_decim_t* b);
+void biquad_decim_reset(biquad_decim_t* b);
+// Same as fir_decim_process. No block length limit
+size_t biquad_decim_process(biquad_decim_t* b, const int16_t* in, size_t len, int16_t* out);
+
+// The filter configured in menuconfig
+typedef struct {
+#if CONFIG_DECIM_FILTER_TYPE_FIR
+    fir_decim_t fir;
+#elif CONFIG_DECIM_FILTER_TYPE_BIQUAD
+    biquad_decim_t biquad;
+#else
+    size_t factor;          // No filter: keep one input in factor, 1 unless set_factor changed it
+    size_t phase;
+#endif
+    size_t max_block;
+} decim_filter_t;
+
+esp_err_t decim_filter_init(decim_filter_t* d, size_t max_block);
+void decim_filter_free(decim_filter_t* d);
+void decim_filter_reset(decim_filter_t* d);
+// Writes at most len / factor + 1 samples to out. With no filter configured it's a straight
+// copy (of every factor'th sample)
+size_t decim_filter_process(decim_filter_t* d, const int16_t* in, size_t len, int16_t* out);
+// Switch between DECIM_FILTER_FACTOR and DECIM_FILTER_SHED_FACTOR from the next block on,
+// along with the lowpass designed for it, so the cutoff stays under the output Nyquist.
+// Made for shedding load: the FIR only computes the outputs it keeps, so its cost halves at
+// the shed factor; the biquads still run on every input. Any other factor is
+// ESP_ERR_INVALID_ARG
+esp_err_t decim_filter_set_factor(decim_filter_t* d, size_t factor);
+size_t decim_filter_get_factor(const decim_filter_t* d);
@@ -0,0 +1,439 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "sdkconfig.h"
+#include "flash_log.h"
+
+
+#define FLASH_LOG_TASK_STACK 3072
+#define RECORD_SIZE CONFIG_FLASH_LOG_RECORD_SIZE
+#define RECORD_MAGIC 0x31474C53     // "SLG1"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    int64_t timestamp_us;
+    uint32_t sample_rate_hz;
+    uint16_t scans;
+    uint8_t num_channels;
+    uint8_t reserved;
+    uint32_t crc;
+    uint32_t reserved2;
+} record_header_t;
+
+_Static_assert(sizeof(record_header_t) == FLASH_LOG_HEADER_LEN, "record header layout");
+_Static_assert((RECORD_SIZE & (RECORD_SIZE - 1)) == 0, "CONFIG_FLASH_LOG_RECORD_SIZE must be a power of 2");
+
+static struct {
+    flash_log_config_t config;
+    const esp_partition_t* part;
+    const uint8_t* map;             // The whole partition, memory-mapped
+    esp_partition_mmap_handle_t map_handle;
+    size_t sector_size;
+    size_t slots_per_sector;
+    size_t num_slots;
+    int64_t time_base_us;           // Log time - esp_timer time
+    uint8_t* storage;               // num_buffers records in RAM
+    uint8_t* cur;                   // Record being filled. NULL if none were free
+    QueueHandle_t free_q;
+    QueueHandle_t ready_q;          // A NULL record tells the writer to stop
+    TaskHandle_t task;
+    SemaphoreHandle_t done;         // Given by the writer on its way out
+    // Writer side. Readers take a snapshot under the lock
+    size_t head;                    // Slot the next record goes in
+    uint32_t next_seq;
+} fl = {0};
+
+static flash_log_stats_t stats = {0};
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static inline const record_header_t* header_at(size_t slot) {
+    return (const record_header_t*)&fl.map[slot * RECORD_SIZE];
+}
+
+static inline size_t payload_len(const record_header_t* hdr) {
+    return (size_t)hdr->scans * hdr->num_channels * sizeof(int16_t);
+}
+
+static inline int64_t end_us(const record_header_t* hdr) {
+    return hdr->timestamp_us + (int64_t)hdr->scans * 1000000 / hdr->sample_rate_hz;
+}
+
+// Cheap checks, header only. Erased flash and old junk fail these
+static bool plausible(const record_header_t* hdr) {
+    return hdr->magic == RECORD_MAGIC && hdr->num_channels > 0 && hdr->num_channels <= FLASH_LOG_MAX_CHANNELS &&
+           hdr->sample_rate_hz > 0 && hdr->scans > 0 && payload_len(hdr) <= RECORD_SIZE - FLASH_LOG_HEADER_LEN;
+}
+
+static uint32_t record_crc(const record_header_t* hdr) {
+    record_header_t copy = *hdr;
+    copy.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&copy, sizeof(copy));
+    return esp_rom_crc32_le(crc, (const uint8_t*)(hdr + 1), payload_len(hdr));
+}
+
+static void write_record(uint8_t* buf) {
+    record_header_t* hdr = (record_header_t*)buf;
+    const size_t len = FLASH_LOG_HEADER_LEN + payload_len(hdr);
+    const size_t offset = fl.head * RECORD_SIZE;
+    bool erased = false;
+    int64_t start = esp_timer_get_time();
+
+    // Entering a sector: it holds the oldest records, which go now
+    esp_err_t err = ESP_OK;
+    if (offset % fl.sector_size == 0) {
+        err = esp_partition_erase_range(fl.part, offset, fl.sector_size);
+        erased = true;
+    }
+    hdr->seq = fl.next_seq;
+    hdr->crc = 0;
+    hdr->crc = record_crc(hdr);
+    if (err == ESP_OK) {
+        err = esp_partition_write(fl.part, offset, buf, len);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&lock);
+    fl.head = (fl.head + 1 < fl.num_slots) ? fl.head + 1 : 0;
+    fl.next_seq++;
+    stats.next_seq = fl.next_seq;
+    if (err == ESP_OK) {
+        stats.records++;
+        stats.bytes += len;
+    }
+    else {
+        stats.write_errors++;
+    }
+    if (erased) {
+        stats.erases++;
+    }
+    stats.write_us += elapsed;
+    if (elapsed > stats.max_write_us) {
+        stats.max_write_us = elapsed;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+// Leaves once it gets to the NULL flash_log_close queues after the last record, so it's
+// never deleted in the middle of a write or an erase
+static void flash_log_task(void* param) {
+    uint8_t* buf;
+
+    while (true) {
+        xQueueReceive(fl.ready_q, &buf, portMAX_DELAY);
+        if (buf == NULL) {
+            break;
+        }
+        write_record(buf);
+        xQueueSend(fl.free_q, &buf, 0);
+    }
+    xSemaphoreGive(fl.done);
+    vTaskDelete(NULL);
+}
+
+// Whether the record in slot passes its CRC, i.e. wasn't torn by a reset
+static bool record_ok(size_t slot) {
+    const record_header_t* hdr = header_at(slot);
+    return plausible(hdr) && record_crc(hdr) == hdr->crc;
+}
+
+// Find the newest record and carry on after it
+static void recover(void) {
+    bool found = false;
+    size_t last_slot = 0;
+    uint32_t last_seq = 0;
+
+    for (size_t slot = 0; slot < fl.num_slots; slot++) {
+        const record_header_t* hdr = header_at(slot);
+        if (plausible(hdr) && (!found || (int32_t)(hdr->seq - last_seq) > 0)) {
+            found = true;
+            last_slot = slot;
+            last_seq = hdr->seq;
+        }
+    }
+
+    fl.head = 0;
+    fl.next_seq = 0;
+    fl.time_base_us = 0;
+    if (!found) {
+        return;
+    }
+
+    // The rest of the newest record's sector may have been programmed by a write that never
+    // finished, so start on a fresh sector. The slots skipped were erased and stay empty
+    fl.next_seq = last_seq + 1;
+    fl.head = (last_slot / fl.slots_per_sector + 1) * fl.slots_per_sector;
+    if (fl.head >= fl.num_slots) {
+        fl.head = 0;
+    }
+
+    // Log time picks up where the newest intact record ends
+    for (size_t i = 0; i < fl.num_slots; i++) {
+        size_t slot = (last_slot + fl.num_slots - i) % fl.num_slots;
+        const record_header_t* hdr = header_at(slot);
+        if (record_ok(slot) && (int32_t)(last_seq - hdr->seq) >= 0) {
+            fl.time_base_us = end_us(hdr) - esp_timer_get_time();
+            break;
+        }
+    }
+}
+
+// The writer has to be gone already
+static void free_state(void) {
+    if (fl.free_q != NULL) {
+        vQueueDelete(fl.free_q);
+        fl.free_q = NULL;
+    }
+    if (fl.ready_q != NULL) {
+        vQueueDelete(fl.ready_q);
+        fl.ready_q = NULL;
+    }
+    if (fl.map != NULL) {
+        esp_partition_munmap(fl.map_handle);
+        fl.map = NULL;
+    }
+    free(fl.storage);
+    fl.storage = NULL;
+    fl.cur = NULL;
+}
+
+esp_err_t flash_log_open(const flash_log_config_t* config) {
+    if (config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (fl.task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    fl.config = *config;
+    if (fl.config.partition_label == NULL) {
+        fl.config.partition_label = CONFIG_FLASH_LOG_PARTITION_LABEL;
+    }
+    if (fl.config.num_buffers == 0) {
+        fl.config.num_buffers = FLASH_LOG_DEFAULT_BUFFERS;
+    }
+    fl.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, fl.config.partition_label);
+    if (fl.part == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Whole sectors only, and at least two so erasing one never takes the whole log
+    fl.sector_size = fl.part->erase_size;
+    if (fl.sector_size < RECORD_SIZE || fl.sector_size % RECORD_SIZE != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t num_sectors = fl.part->size / fl.sector_size;
+    if (num_sectors < 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    fl.slots_per_sector = fl.sector_size / RECORD_SIZE;
+    fl.num_slots = num_sectors * fl.slots_per_sector;
+
+    esp_err_t err = ESP_OK;
+    if (fl.config.format) {
+        err = esp_partition_erase_range(fl.part, 0, num_sectors * fl.sector_size);
+    }
+    if (err == ESP_OK) {
+        const void* map;
+        err = esp_partition_mmap(fl.part, 0, num_sectors * fl.sector_size, ESP_PARTITION_MMAP_DATA, &map, &fl.map_handle);
+        fl.map = (err == ESP_OK) ? map : NULL;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    recover();
+
+    const size_t num = fl.config.num_buffers;
+    fl.storage = malloc(num * RECORD_SIZE);
+    fl.free_q = xQueueCreate(num, sizeof(uint8_t*));
+    fl.ready_q = xQueueCreate(num, sizeof(uint8_t*));
+    if (fl.done == NULL) {
+        fl.done = xSemaphoreCreateBinary();
+    }
+    if (fl.storage == NULL || fl.free_q == NULL || fl.ready_q == NULL || fl.done == NULL) {
+        free_state();
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < num; i++) {
+        uint8_t* buf = &fl.storage[i * RECORD_SIZE];
+        xQueueSend(fl.free_q, &buf, 0);
+    }
+    memset(&stats, 0, sizeof(stats));
+    stats.next_seq = fl.next_seq;
+    stats.num_slots = fl.num_slots;
+
+    if (xTaskCreate(flash_log_task, "Flash log", FLASH_LOG_TASK_STACK, NULL, fl.config.task_priority, &fl.task) != pdPASS) {
+        fl.task = NULL;
+        free_state();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t flash_log_close(void) {
+    if (fl.task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    flash_log_flush();
+    // Behind every record already queued, so they all get written first. The queue may be
+    // full of them, but the writer makes room
+    uint8_t* stop = NULL;
+    xQueueSend(fl.ready_q, &stop, portMAX_DELAY);
+    xSemaphoreTake(fl.done, portMAX_DELAY);
+    fl.task = NULL;
+    free_state();
+    return ESP_OK;
+}
+
+void flash_log_flush(void) {
+    if (fl.cur != NULL && ((record_header_t*)fl.cur)->scans > 0) {
+        // Can't fail: the queue holds every buffer
+        xQueueSend(fl.ready_q, &fl.cur, 0);
+        fl.cur = NULL;
+    }
+}
+
+esp_err_t flash_log_append(int64_t timestamp_us, uint32_t sample_rate_hz,
+                           const int16_t* const* channels, size_t num_channels, size_t len) {
+    if (fl.task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (sample_rate_hz == 0 || num_channels == 0 || num_channels > FLASH_LOG_MAX_CHANNELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const int64_t log_us = timestamp_us + fl.time_base_us;
+    const size_t max_scans = (RECORD_SIZE - FLASH_LOG_HEADER_LEN) / (num_channels * sizeof(int16_t));
+    // How far off the block can start from where the record ends and still be the same run.
+    // Less than a block, so a dropped block starts a new record
+    const int64_t slack_us = (int64_t)len * 1000000 / sample_rate_hz / 2;
+
+    for (size_t done = 0; done < len;) {
+        int64_t t = log_us + (int64_t)done * 1000000 / sample_rate_hz;
+        if (fl.cur != NULL) {
+            const record_header_t* hdr = (const record_header_t*)fl.cur;
+            int64_t gap = t - end_us(hdr);
+            if (hdr->sample_rate_hz != sample_rate_hz || hdr->num_channels != num_channels ||
+                gap > slack_us || gap < -slack_us) {
+                flash_log_flush();
+            }
+        }
+        if (fl.cur == NULL) {
+            if (xQueueReceive(fl.free_q, &fl.cur, 0) != pdTRUE) {
+                fl.cur = NULL;
+                portENTER_CRITICAL(&lock);
+                stats.dropped_scans += len - done;
+                portEXIT_CRITICAL(&lock);
+                return ESP_ERR_NO_MEM;
+            }
+            record_header_t* hdr = (record_header_t*)fl.cur;
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->magic = RECORD_MAGIC;
+            hdr->timestamp_us = t;
+            hdr->sample_rate_hz = sample_rate_hz;
+            hdr->num_channels = (uint8_t)num_channels;
+        }
+
+        record_header_t* hdr = (record_header_t*)fl.cur;
+        size_t n = max_scans - hdr->scans;
+        if (n > len - done) {
+            n = len - done;
+        }
+        // Interleave by scan so a record can be cut at any scan
+        int16_t* out = (int16_t*)(hdr + 1) + (size_t)hdr->scans * num_channels;
+        for (size_t i = done; i < done + n; i++) {
+            for (size_t ch = 0; ch < num_channels; ch++) {
+                *out++ = channels[ch][i];
+            }
+        }
+        hdr->scans += n;
+        done += n;
+        if (hdr->scans == max_scans) {
+            flash_log_flush();
+        }
+    }
+    return ESP_OK;
+}
+
+int64_t flash_log_time(int64_t timestamp_us) {
+    return timestamp_us + fl.time_base_us;
+}
+
+// A record the walk can return: plausible and written before the walk started
+static const record_header_t* walk_header(const flash_log_cursor_t* cursor, size_t pos) {
+    const record_header_t* hdr = header_at((cursor->start + pos) % fl.num_slots);
+    if (!plausible(hdr) || (int32_t)(hdr->seq - cursor->end_seq) >= 0) {
+        return NULL;
+    }
+    return hdr;
+}
+
+void flash_log_find(int64_t from_us, flash_log_cursor_t* cursor) {
+    portENTER_CRITICAL(&lock);
+    cursor->start = fl.head;
+    cursor->end_seq = fl.next_seq;
+    portEXIT_CRITICAL(&lock);
+    cursor->started = false;
+
+    // Going round from the head, records are oldest first, so their end times only go up.
+    // Binary search for the first that ends at or after from_us, stepping over empty slots
+    size_t lo = 0;
+    size_t hi = fl.num_slots;
+    size_t found = fl.num_slots;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t pos = mid;
+        const record_header_t* hdr = NULL;
+        while (pos < hi && (hdr = walk_header(cursor, pos)) == NULL) {
+            pos++;
+        }
+        if (hdr == NULL) {
+            hi = mid;
+        }
+        else if (end_us(hdr) < from_us) {
+            lo = pos + 1;
+        }
+        else {
+            found = pos;
+            hi = mid;
+        }
+    }
+    cursor->pos = found;
+}
+
+bool flash_log_next(flash_log_cursor_t* cursor, flash_log_record_t* record) {
+    while (cursor->pos < fl.num_slots) {
+        const record_header_t* hdr = walk_header(cursor, cursor->pos++);
+        // Sequence numbers only go up along the walk. One that doesn't was written over since
+        if (hdr == NULL || (cursor->started && (int32_t)(hdr->seq - cursor->last_seq) <= 0) ||
+            record_crc(hdr) != hdr->crc) {
+            continue;
+        }
+        record->seq = hdr->seq;
+        record->timestamp_us = hdr->timestamp_us;
+        record->sample_rate_hz = hdr->sample_rate_hz;
+        record->scans = hdr->scans;
+        record->num_channels = hdr->num_channels;
+        record->samples = (const int16_t*)(hdr + 1);
+        cursor->last_seq = hdr->seq;
+        cursor->started = true;
+        return true;
+    }
+    return false;
+}
+
+bool flash_log_still_valid(const flash_log_record_t* record) {
+    const record_header_t* hdr = (const record_header_t*)((const uint8_t*)record->samples - FLASH_LOG_HEADER_LEN);
+    return hdr->magic == RECORD_MAGIC && hdr->seq == record->seq;
+}
+
+void flash_log_get_stats(flash_log_stats_t* out) {
+    portENTER_CRITICAL(&lock);
+    *out = stats;
+    portEXIT_CRITICAL(&lock);
+}
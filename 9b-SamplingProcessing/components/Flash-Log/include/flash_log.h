@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/**
+ * Append-only sample log on a dedicated flash data partition, kept across resets.
+ *
+ * Blocks of samples are batched in RAM into fixed size records (CONFIG_FLASH_LOG_RECORD_SIZE)
+ * and a writer task writes each full one at the head of the log. The partition is used as a
+ * ring: when the head moves into a sector it's erased first, taking the oldest records with
+ * it. Every sector is erased once per lap, so wear is spread evenly with no bookkeeping.
+ *
+ * Record layout in flash, little endian:
+ *   0-3    magic
+ *   4-7    sequence number, +1 per record for the life of the log
+ *   8-15   log time of the first scan, us
+ *   16-19  sample rate, Hz
+ *   20-21  scans in the record
+ *   22     channels
+ *   23     reserved
+ *   24-27  CRC32 of the header (with this field 0) and the samples
+ *   28-31  reserved
+ *   32-    samples, int16_t, scans interleaved by channel
+ * A record only ever holds evenly spaced scans at one rate, so the time of every sample
+ * follows from the header. A rate change, channel change or gap starts a new record.
+ *
+ * Log time is esp_timer time plus where the log had got to before this boot, so it keeps
+ * increasing across resets (the time the board was off is left out).
+ *
+ * On open the record headers are scanned through the memory-mapped partition to find the
+ * head. A record torn by a reset fails its CRC and is skipped, and writing resumes at the
+ * next sector so nothing is ever programmed over a partly written record.
+ *
+ * Reads go straight through the same mapping: records come back as pointers into flash, with
+ * no copy. Records are in time order, so a time range is found by binary search. A record
+ * within a sector of the head can be erased under a reader that holds on to it for a whole lap
+ * of writes; flash_log_still_valid says if that happened.
+ *
+ * Only one task may append.
+ */
+
+#define FLASH_LOG_HEADER_LEN 32
+#define FLASH_LOG_MAX_CHANNELS 8
+#define FLASH_LOG_DEFAULT_BUFFERS 3
+
+typedef struct {
+    const char* partition_label;    // NULL for CONFIG_FLASH_LOG_PARTITION_LABEL
+    size_t num_buffers;             // Records batched in RAM. 0 for FLASH_LOG_DEFAULT_BUFFERS
+    bool format;                    // Erase the whole partition and start an empty log
+    uint32_t task_priority;         // Priority of the writer task
+} flash_log_config_t;
+
+typedef struct {
+    uint32_t seq;
+    int64_t timestamp_us;           // Log time of the first scan
+    uint32_t sample_rate_hz;
+    uint16_t scans;
+    uint8_t num_channels;
+    const int16_t* samples;         // scans * num_channels samples, interleaved. Points into flash
+} flash_log_record_t;
+
+// Where a walk through the log is up to
+typedef struct {
+    size_t start;                   // Slot the head was at when the walk started
+    size_t pos;                     // Slots from start already looked at
+    uint32_t end_seq;               // First record written after the walk started
+    uint32_t last_seq;              // Last record returned
+    bool started;                   // last_seq is valid
+} flash_log_cursor_t;
+
+typedef struct {
+    uint32_t records;               // Records written since open
+    uint32_t bytes;                 // Bytes written, headers included
+    uint32_t erases;                // Sectors erased since open
+    uint32_t dropped_scans;         // Scans with no RAM buffer to go in
+    int64_t write_us;               // Time spent erasing and writing
+    int64_t max_write_us;           // Longest single record, including its erase
+    uint32_t write_errors;          // Records the flash driver refused. Their slot is skipped
+    uint32_t next_seq;              // Sequence number the next record will get
+    size_t num_slots;               // Records the partition holds
+} flash_log_stats_t;
+
+esp_err_t flash_log_open(const flash_log_config_t* config);
+// Write out the unfinished record and everything queued, let the writer finish and unmap the
+// partition. Blocks for as long as those writes take
+esp_err_t flash_log_close(void);
+
+// Add len scans of num_channels, channels[ch][i] being sample i of channel ch, taken at
+// sample_rate_hz with the first at esp_timer time timestamp_us. Never waits on flash: if the
+// writer has every buffer, the scans are dropped and counted
+esp_err_t flash_log_append(int64_t timestamp_us, uint32_t sample_rate_hz,
+                           const int16_t* const* channels, size_t num_channels, size_t len);
+// Hand the unfinished record to the writer now
+void flash_log_flush(void);
+
+// Log time of esp_timer time timestamp_us in this boot
+int64_t flash_log_time(int64_t timestamp_us);
+
+// Start a walk at the first record that ends at or after log time from_us. INT64_MIN for the
+// oldest record. Records written after this aren't part of the walk
+void flash_log_find(int64_t from_us, flash_log_cursor_t* cursor);
+// Next good record of the walk, false at the end. Checks the record's CRC
+bool flash_log_next(flash_log_cursor_t* cursor, flash_log_record_t* record);
+// Whether a record from flash_log_next is still in flash as it was returned
+bool flash_log_still_valid(const flash_log_record_t* record);
+
+void flash_log_get_stats(flash_log_stats_t* stats);
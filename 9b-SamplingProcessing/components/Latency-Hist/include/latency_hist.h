@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Log-linear histogram of non-negative latencies (any unit, the sampler uses microseconds).
+ *
+ * Values below LATENCY_HIST_SUB get a bucket each. Above that every power of two is split
+ * into LATENCY_HIST_SUB equal buckets, so a bucket is never wider than 1/8 of its value:
+ * fine detail where jitter is small, and still a fixed ~700 bytes for anything up to 16 s.
+ * Bigger values land in the last bucket.
+ *
+ * Recording is a couple of relaxed atomic adds, so one task can record while any other
+ * task reads. Readers may see a count that's a sample or two ahead of the buckets.
+ */
+
+#define LATENCY_HIST_SUB_BITS 3
+#define LATENCY_HIST_SUB (1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS 24
+#define LATENCY_HIST_BUCKETS ((LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB)
+
+typedef struct {
+    atomic_uint buckets[LATENCY_HIST_BUCKETS];
+    atomic_uint count;
+    atomic_uint max;
+} latency_hist_t;
+
+void latency_hist_reset(latency_hist_t* h);
+void latency_hist_record(latency_hist_t* h, uint32_t value);
+// Bucket by bucket copy, for reading a consistent-enough snapshot while the source is live
+void latency_hist_copy(latency_hist_t* dst, const latency_hist_t* src);
+
+uint32_t latency_hist_count(const latency_hist_t* h);
+uint32_t latency_hist_max(const latency_hist_t* h);
+// Upper bound of the bucket holding the given fraction (0 to 1) of the samples, so at worst
+// 1/8 high. 0 if empty
+uint32_t latency_hist_percentile(const latency_hist_t* h, float fraction);
+
+// Smallest value that goes in bucket i. Bucket i holds lower(i) to lower(i + 1) - 1
+uint32_t latency_hist_bucket_lower(size_t i);
+uint32_t latency_hist_bucket_count(const latency_hist_t* h, size_t i);
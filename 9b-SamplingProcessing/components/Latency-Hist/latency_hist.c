@@ -0,0 +1,87 @@
+#include "latency_hist.h"
+
+
+static inline size_t bucket_of(uint32_t value) {
+    if (value >= (1u << LATENCY_HIST_MAX_BITS)) {
+        value = (1u << LATENCY_HIST_MAX_BITS) - 1;
+    }
+    if (value < LATENCY_HIST_SUB) {
+        return value;
+    }
+    // The top LATENCY_HIST_SUB_BITS + 1 bits pick the bucket: the leading 1 says which power
+    // of two, the bits after it which slice of it
+    unsigned shift = (31 - __builtin_clz(value)) - LATENCY_HIST_SUB_BITS;
+    return (shift + 1) * LATENCY_HIST_SUB + ((value >> shift) - LATENCY_HIST_SUB);
+}
+
+uint32_t latency_hist_bucket_lower(size_t i) {
+    if (i < LATENCY_HIST_SUB) {
+        return (uint32_t)i;
+    }
+    size_t shift = i / LATENCY_HIST_SUB - 1;
+    return (uint32_t)((LATENCY_HIST_SUB + i % LATENCY_HIST_SUB) << shift);
+}
+
+void latency_hist_reset(latency_hist_t* h) {
+    for (size_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        atomic_store_explicit(&h->buckets[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+}
+
+void latency_hist_record(latency_hist_t* h, uint32_t value) {
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+
+    unsigned max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, value,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void latency_hist_copy(latency_hist_t* dst, const latency_hist_t* src) {
+    for (size_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        atomic_store_explicit(&dst->buckets[i], latency_hist_bucket_count(src, i), memory_order_relaxed);
+    }
+    atomic_store_explicit(&dst->count, latency_hist_count(src), memory_order_relaxed);
+    atomic_store_explicit(&dst->max, latency_hist_max(src), memory_order_relaxed);
+}
+
+uint32_t latency_hist_count(const latency_hist_t* h) {
+    return atomic_load_explicit((atomic_uint*)&h->count, memory_order_relaxed);
+}
+
+uint32_t latency_hist_max(const latency_hist_t* h) {
+    return atomic_load_explicit((atomic_uint*)&h->max, memory_order_relaxed);
+}
+
+uint32_t latency_hist_bucket_count(const latency_hist_t* h, size_t i) {
+    return atomic_load_explicit((atomic_uint*)&h->buckets[i], memory_order_relaxed);
+}
+
+uint32_t latency_hist_percentile(const latency_hist_t* h, float fraction) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        total += latency_hist_bucket_count(h, i);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    // Rank of the sample we're after, 1 based
+    uint32_t rank = (uint32_t)(fraction * total + 0.5f);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint32_t max = latency_hist_max(h);
+    uint32_t seen = 0;
+    for (size_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        seen += latency_hist_bucket_count(h, i);
+        if (seen >= rank) {
+            uint32_t upper = (i + 1 < LATENCY_HIST_BUCKETS) ? latency_hist_bucket_lower(i + 1) - 1 : UINT32_MAX;
+            return (upper < max) ? upper : max;
+        }
+    }
+    return max;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Multi-resolution history of a sample stream for window queries, RRD style.
+ *
+ * Each level is a ring of fixed length time buckets holding the sum, count, min and max of
+ * the samples in them: say 100 ms buckets for the last few seconds, 1 s buckets for the last
+ * minutes and 1 min buckets for the last hours. Samples only go into the finest level. When
+ * time moves on to the next bucket the finished one is folded into the level above, so a
+ * sample costs the same however many levels there are. Every level's bucket length has to be
+ * a multiple of the one below so buckets nest.
+ *
+ * A query over any window picks the finest level that still goes back far enough and adds up
+ * its buckets in the window, plus the unfinished bucket of each level below (not folded in
+ * yet). That's at most a ring's worth of buckets whatever the window, never the raw samples.
+ * Windows are widened to whole buckets of the level used, and the result says what it
+ * actually covers.
+ *
+ * Buckets are tagged with their bucket number (time / bucket length) and found by it modulo
+ * the ring length, so a gap in the samples just leaves stale buckets that no query matches.
+ */
+
+#define ROLLUP_MAX_LEVELS 4
+
+typedef struct {
+    int64_t bucket_us;  // Bucket length, a multiple of the level below's
+    size_t len;         // Buckets kept
+} rollup_level_config_t;
+
+typedef struct {
+    int64_t sum;
+    uint32_t slot;      // Bucket number. ROLLUP_EMPTY if unused
+    uint32_t count;
+    int16_t min;
+    int16_t max;
+} rollup_bucket_t;
+
+#define ROLLUP_EMPTY UINT32_MAX
+
+typedef struct {
+    int64_t bucket_us;
+    size_t len;
+    rollup_bucket_t* buckets;   // buckets[slot % len]
+    uint32_t cur;               // Bucket being filled. ROLLUP_EMPTY before the first sample
+} rollup_level_t;
+
+typedef struct {
+    size_t num_levels;
+    rollup_level_t levels[ROLLUP_MAX_LEVELS];
+    int64_t last_us;            // Time of the newest sample
+} rollup_stats_t;
+
+typedef struct {
+    int64_t from_us;    // What the result covers: whole buckets, from_us inclusive to to_us exclusive
+    int64_t to_us;
+    int64_t bucket_us;  // Resolution of the level used
+    uint32_t count;
+    int64_t sum;
+    float mean;
+    int min;
+    int max;
+} rollup_stats_result_t;
+
+// Levels finest first. Times must be 0 or later
+esp_err_t rollup_stats_init(rollup_stats_t* r, const rollup_level_config_t* levels, size_t num_levels);
+void rollup_stats_free(rollup_stats_t* r);
+void rollup_stats_reset(rollup_stats_t* r);
+
+// n samples period_us apart, the first at timestamp_us. Time must not go backwards between
+// calls: samples older than the bucket being filled go into it anyway
+void rollup_stats_push_block(rollup_stats_t* r, int64_t timestamp_us, int64_t period_us, const int16_t* samples, size_t n);
+
+// Stats over the buckets that overlap [from_us, to_us). Count 0 if none hold anything
+void rollup_stats_query(const rollup_stats_t* r, int64_t from_us, int64_t to_us, rollup_stats_result_t* result);
+
+// Stats over the last window_us up to the newest sample
+static inline void rollup_stats_last(const rollup_stats_t* r, int64_t window_us, rollup_stats_result_t* result) {
+    rollup_stats_query(r, r->last_us - window_us + 1, r->last_us + 1, result);
+}
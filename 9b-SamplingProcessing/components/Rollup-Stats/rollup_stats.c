@@ -0,0 +1,201 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rollup_stats.h"
+#include "block_kernels.h"
+
+
+esp_err_t rollup_stats_init(rollup_stats_t* r, const rollup_level_config_t* levels, size_t num_levels) {
+    if (r == NULL || levels == NULL || num_levels == 0 || num_levels > ROLLUP_MAX_LEVELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t l = 0; l < num_levels; l++) {
+        if (levels[l].bucket_us <= 0 || levels[l].len == 0 ||
+            (l > 0 && levels[l].bucket_us % levels[l - 1].bucket_us != 0)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    memset(r, 0, sizeof(*r));
+    for (size_t l = 0; l < num_levels; l++) {
+        r->levels[l].bucket_us = levels[l].bucket_us;
+        r->levels[l].len = levels[l].len;
+        r->levels[l].buckets = malloc(levels[l].len * sizeof(rollup_bucket_t));
+        if (r->levels[l].buckets == NULL) {
+            rollup_stats_free(r);
+            return ESP_ERR_NO_MEM;
+        }
+        r->num_levels = l + 1;
+    }
+    rollup_stats_reset(r);
+    return ESP_OK;
+}
+
+void rollup_stats_free(rollup_stats_t* r) {
+    for (size_t l = 0; l < r->num_levels; l++) {
+        free(r->levels[l].buckets);
+        r->levels[l].buckets = NULL;
+    }
+    r->num_levels = 0;
+}
+
+void rollup_stats_reset(rollup_stats_t* r) {
+    for (size_t l = 0; l < r->num_levels; l++) {
+        rollup_level_t* lv = &r->levels[l];
+        for (size_t i = 0; i < lv->len; i++) {
+            lv->buckets[i].slot = ROLLUP_EMPTY;
+        }
+        lv->cur = ROLLUP_EMPTY;
+    }
+    r->last_us = 0;
+}
+
+static inline void bucket_clear(rollup_bucket_t* b, uint32_t slot) {
+    b->sum = 0;
+    b->slot = slot;
+    b->count = 0;
+    b->min = INT16_MAX;
+    b->max = INT16_MIN;
+}
+
+static rollup_bucket_t* enter(rollup_stats_t* r, size_t l, uint32_t slot);
+
+// Fold the bucket level l is filling into the level above
+static void fold(rollup_stats_t* r, size_t l) {
+    const rollup_level_t* lv = &r->levels[l];
+    const rollup_bucket_t* b = &lv->buckets[lv->cur % lv->len];
+    if (l + 1 >= r->num_levels || b->count == 0) {
+        return;
+    }
+    const rollup_level_t* up = &r->levels[l + 1];
+    rollup_bucket_t* ub = enter(r, l + 1, (uint32_t)((int64_t)lv->cur * lv->bucket_us / up->bucket_us));
+    ub->sum += b->sum;
+    ub->count += b->count;
+    if (b->min < ub->min) {
+        ub->min = b->min;
+    }
+    if (b->max > ub->max) {
+        ub->max = b->max;
+    }
+}
+
+// The bucket level l should add to for bucket number slot. Moving on to a new bucket folds the
+// last one upward first
+static rollup_bucket_t* enter(rollup_stats_t* r, size_t l, uint32_t slot) {
+    rollup_level_t* lv = &r->levels[l];
+    if (lv->cur == ROLLUP_EMPTY || slot > lv->cur) {
+        if (lv->cur != ROLLUP_EMPTY) {
+            fold(r, l);
+        }
+        lv->cur = slot;
+        bucket_clear(&lv->buckets[slot % lv->len], slot);
+    }
+    return &lv->buckets[lv->cur % lv->len];
+}
+
+void rollup_stats_push_block(rollup_stats_t* r, int64_t timestamp_us, int64_t period_us, const int16_t* samples, size_t n) {
+    const int64_t bucket_us = r->levels[0].bucket_us;
+
+    // Split the block where it crosses into the next bucket and reduce each run in one go
+    for (size_t i = 0; i < n;) {
+        const int64_t t = timestamp_us + (int64_t)i * period_us;
+        const uint32_t slot = (uint32_t)(t / bucket_us);
+        size_t run = n - i;
+        if (period_us > 0) {
+            int64_t left_us = (int64_t)(slot + 1) * bucket_us - t;
+            size_t fit = (size_t)((left_us + period_us - 1) / period_us);
+            if (fit < run) {
+                run = fit;
+            }
+        }
+
+        rollup_bucket_t* b = enter(r, 0, slot);
+        int16_t min, max;
+        block_minmax_i16(&samples[i], run, &min, &max);
+        b->sum += block_sum_i16(&samples[i], run);
+        b->count += run;
+        if (min < b->min) {
+            b->min = min;
+        }
+        if (max > b->max) {
+            b->max = max;
+        }
+        i += run;
+    }
+
+    if (n > 0) {
+        int64_t last_us = timestamp_us + (int64_t)(n - 1) * period_us;
+        if (last_us > r->last_us) {
+            r->last_us = last_us;
+        }
+    }
+}
+
+static inline void add_bucket(rollup_stats_result_t* result, const rollup_bucket_t* b) {
+    if (b->count == 0) {
+        return;
+    }
+    if (result->count == 0 || b->min < result->min) {
+        result->min = b->min;
+    }
+    if (result->count == 0 || b->max > result->max) {
+        result->max = b->max;
+    }
+    result->sum += b->sum;
+    result->count += b->count;
+}
+
+void rollup_stats_query(const rollup_stats_t* r, int64_t from_us, int64_t to_us, rollup_stats_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    if (from_us < 0) {
+        from_us = 0;
+    }
+    if (r->levels[0].cur == ROLLUP_EMPTY || to_us <= from_us) {
+        result->from_us = from_us;
+        result->to_us = from_us;
+        return;
+    }
+
+    // Finest level that still goes back to from_us, else the coarsest
+    size_t l = 0;
+    for (; l + 1 < r->num_levels; l++) {
+        const rollup_level_t* lv = &r->levels[l];
+        if (((int64_t)lv->cur - (int64_t)lv->len + 1) * lv->bucket_us <= from_us) {
+            break;
+        }
+    }
+    const rollup_level_t* lv = &r->levels[l];
+    int64_t first = from_us / lv->bucket_us;
+    int64_t last = (to_us - 1) / lv->bucket_us;
+    if (lv->cur != ROLLUP_EMPTY && first < (int64_t)lv->cur - (int64_t)lv->len + 1) {
+        first = (int64_t)lv->cur - (int64_t)lv->len + 1;
+    }
+
+    if (lv->cur != ROLLUP_EMPTY) {
+        const int64_t end = (last < (int64_t)lv->cur) ? last : lv->cur;
+        for (int64_t slot = first; slot <= end; slot++) {
+            const rollup_bucket_t* b = &lv->buckets[slot % lv->len];
+            if (b->slot == (uint32_t)slot) {
+                add_bucket(result, b);
+            }
+        }
+    }
+    // What the levels below haven't folded in yet
+    for (size_t k = 0; k < l; k++) {
+        const rollup_level_t* below = &r->levels[k];
+        const int64_t start_us = (int64_t)below->cur * below->bucket_us;
+        if (below->cur != ROLLUP_EMPTY && start_us + below->bucket_us > first * lv->bucket_us &&
+            start_us < (last + 1) * lv->bucket_us) {
+            add_bucket(result, &below->buckets[below->cur % below->len]);
+        }
+    }
+
+    // Never claim to cover time past the newest sample's bucket
+    const int64_t newest_end_us = (r->last_us / r->levels[0].bucket_us + 1) * r->levels[0].bucket_us;
+    result->from_us = first * lv->bucket_us;
+    result->to_us = ((last + 1) * lv->bucket_us < newest_end_us) ? (last + 1) * lv->bucket_us : newest_end_us;
+    result->bucket_us = lv->bucket_us;
+    if (result->count != 0) {
+        result->mean = (float)result->sum / result->count;
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Compressed history of one stream of 12-bit ADC samples, in a fixed amount of RAM.
+ *
+ * Samples are pushed in any block size and collected into segments of segment_len. Each full
+ * segment is compressed and appended to a byte ring (the arena). When the arena or the index
+ * is full the oldest segments are evicted, so it always holds the most recent history that
+ * fits. Segments are numbered from 0 as they're written and any segment still held can be
+ * decoded on its own by number.
+ *
+ * Compression is lossless: the first sample is kept as is, the rest become deltas, zigzag
+ * mapped to unsigned (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...). Each segment then uses whichever
+ * of these is smaller for it:
+ *  - Rice: k low bits as they are, the rest in unary. k comes from the segment's mean, so a
+ *    quiet signal costs 2-4 bits a sample. Big outliers escape to a fixed 17-bit code
+ *  - Varint: 7 bits per byte with a continue bit. Never more than 3 bytes a sample, and
+ *    byte aligned, so cheaper to decode for very busy segments
+ *
+ * A segment never mixes sample rates: pushing at a different rate finishes the current
+ * segment early. The timestamp of a segment is that of its first sample.
+ *
+ * Not thread safe. If one task pushes and another reads, they need a lock around both.
+ */
+
+#define SAMPLE_HISTORY_DEFAULT_SEGMENT_LEN 256
+
+typedef enum {
+    SAMPLE_HISTORY_RICE = 0,
+    SAMPLE_HISTORY_VARINT = 1,
+} sample_history_codec_t;
+
+typedef struct {
+    uint32_t id;                // Segment number
+    int64_t timestamp_us;       // Time of the first sample
+    uint32_t sample_rate_hz;
+    uint16_t count;             // Samples in the segment
+    uint16_t bytes;             // Compressed size in the arena
+    sample_history_codec_t codec;
+} sample_history_info_t;
+
+// Where a segment lives in the arena and what's needed to decode it
+typedef struct {
+    uint32_t offset;
+    uint16_t bytes;
+    uint16_t count;
+    int16_t first;              // First sample, as is
+    uint8_t codec;
+    uint8_t rice_k;
+    uint32_t sample_rate_hz;
+    int64_t timestamp_us;
+} sample_history_entry_t;
+
+typedef struct {
+    uint32_t segments;          // Segments held now
+    uint32_t evicted;           // Segments dropped to make room since init/reset
+    uint32_t samples;           // Samples held now, not counting the unfinished segment
+    uint32_t bytes;             // Arena bytes those segments take
+    uint32_t rice_segments;     // Segments written with each codec since init/reset
+    uint32_t varint_segments;
+} sample_history_stats_t;
+
+typedef struct {
+    uint8_t* arena;
+    size_t arena_size;
+    size_t head;                // Where the next segment goes
+    size_t tail;                // Start of the oldest segment
+    sample_history_entry_t* index;  // Segment id lives in index[id % max_segments]
+    size_t max_segments;
+    uint32_t first_id;          // Oldest segment held
+    uint32_t next_id;           // Number the next segment will get
+    uint32_t* zigzag;           // segment_len - 1 mapped deltas, while encoding
+    int16_t* pending;           // Samples of the unfinished segment
+    size_t segment_len;
+    size_t pending_len;
+    int64_t pending_timestamp_us;
+    uint32_t pending_rate_hz;
+    sample_history_stats_t stats;
+} sample_history_t;
+
+// arena_bytes of compressed history. max_segments 0 sizes the index for segments averaging
+// 1 bit per sample, segment_len 0 for SAMPLE_HISTORY_DEFAULT_SEGMENT_LEN (at most 65535)
+esp_err_t sample_history_init(sample_history_t* h, size_t arena_bytes, size_t max_segments, size_t segment_len);
+void sample_history_free(sample_history_t* h);
+// Forget everything, including the unfinished segment
+void sample_history_reset(sample_history_t* h);
+
+// Add n samples taken at sample_rate_hz, the first at timestamp_us. Compresses a segment every
+// segment_len samples. ESP_ERR_INVALID_SIZE if a segment can't fit in the arena even empty
+esp_err_t sample_history_push(sample_history_t* h, int64_t timestamp_us, uint32_t sample_rate_hz,
+                              const int16_t* samples, size_t n);
+// Compress whatever's in the unfinished segment now, e.g. right after a trigger
+esp_err_t sample_history_flush(sample_history_t* h);
+
+// Segments first to end - 1 can be read. first == end when there are none
+static inline uint32_t sample_history_first(const sample_history_t* h) {
+    return h->first_id;
+}
+static inline uint32_t sample_history_end(const sample_history_t* h) {
+    return h->next_id;
+}
+
+// ESP_ERR_NOT_FOUND if segment id was evicted or hasn't been written
+esp_err_t sample_history_get_info(const sample_history_t* h, uint32_t id, sample_history_info_t* info);
+// Decode segment id into out, which must hold segment_len samples. info can be NULL
+esp_err_t sample_history_read(const sample_history_t* h, uint32_t id, int16_t* out, sample_history_info_t* info);
+
+void sample_history_get_stats(const sample_history_t* h, sample_history_stats_t* stats);
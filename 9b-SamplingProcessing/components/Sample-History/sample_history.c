@@ -0,0 +1,380 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sample_history.h"
+
+
+#define MAX_SEGMENT_LEN 65535
+#define MAX_RICE_K 15
+#define RICE_ESCAPE 20          // Unary run that means a raw value follows instead
+#define RAW_BITS 17             // Zigzag of any int16 - int16 difference fits in 17 bits
+
+
+static inline uint32_t zigzag(int32_t d) {
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+    return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static inline size_t varint_len(uint32_t u) {
+    return (u < (1u << 7)) ? 1 : (u < (1u << 14)) ? 2 : 3;
+}
+
+// LSB first bit writer. Every write is at most 20 bits and it's flushed down below 32 after
+// each, so the 64-bit accumulator can't overflow
+typedef struct {
+    uint8_t* out;
+    uint64_t acc;
+    unsigned bits;
+} bit_writer_t;
+
+static inline void put_bits(bit_writer_t* w, uint32_t value, unsigned bits) {
+    w->acc |= (uint64_t)value << w->bits;
+    w->bits += bits;
+    while (w->bits >= 8) {
+        *w->out++ = (uint8_t)w->acc;
+        w->acc >>= 8;
+        w->bits -= 8;
+    }
+}
+
+static inline void flush_bits(bit_writer_t* w) {
+    if (w->bits > 0) {
+        *w->out++ = (uint8_t)w->acc;
+    }
+}
+
+// Reads past the end come back as 0 bits, so a short segment can't run off the arena
+typedef struct {
+    const uint8_t* in;
+    const uint8_t* end;
+    uint64_t acc;
+    unsigned bits;
+} bit_reader_t;
+
+static inline void refill(bit_reader_t* r) {
+    while (r->bits <= 56) {
+        uint64_t byte = (r->in < r->end) ? *r->in++ : 0;
+        r->acc |= byte << r->bits;
+        r->bits += 8;
+    }
+}
+
+static inline void skip_bits(bit_reader_t* r, unsigned bits) {
+    r->acc >>= bits;
+    r->bits -= bits;
+}
+
+static size_t rice_bits(const uint32_t* u, size_t n, unsigned k) {
+    size_t bits = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t q = u[i] >> k;
+        bits += (q < RICE_ESCAPE) ? q + 1 + k : RICE_ESCAPE + RAW_BITS;
+    }
+    return bits;
+}
+
+static void rice_encode(uint8_t* out, const uint32_t* u, size_t n, unsigned k) {
+    bit_writer_t w = {.out = out};
+    const uint32_t low_mask = (1u << k) - 1;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t q = u[i] >> k;
+        if (q < RICE_ESCAPE) {
+            put_bits(&w, (1u << q) - 1, q + 1);     // q ones then a zero
+            put_bits(&w, u[i] & low_mask, k);
+        }
+        else {
+            put_bits(&w, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+            put_bits(&w, u[i], RAW_BITS);
+        }
+    }
+    flush_bits(&w);
+}
+
+static void rice_decode(const uint8_t* in, size_t bytes, int16_t* out, size_t n, unsigned k) {
+    bit_reader_t r = {.in = in, .end = in + bytes};
+    const uint32_t low_mask = (1u << k) - 1;
+    int32_t x = out[0];
+
+    for (size_t i = 1; i < n; i++) {
+        refill(&r);
+        // Count the ones, stopping at an escape. acc holds at least 57 valid bits, more than
+        // an escape needs
+        unsigned q = (unsigned)__builtin_ctzll(~r.acc | (1ull << RICE_ESCAPE));
+        uint32_t u;
+        if (q >= RICE_ESCAPE) {
+            skip_bits(&r, RICE_ESCAPE);
+            u = (uint32_t)r.acc & ((1u << RAW_BITS) - 1);
+            skip_bits(&r, RAW_BITS);
+        }
+        else {
+            skip_bits(&r, q + 1);
+            u = (q << k) | ((uint32_t)r.acc & low_mask);
+            skip_bits(&r, k);
+        }
+        x += unzigzag(u);
+        out[i] = (int16_t)x;
+    }
+}
+
+static void varint_encode(uint8_t* out, const uint32_t* u, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t v = u[i];
+        while (v >= 0x80) {
+            *out++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *out++ = (uint8_t)v;
+    }
+}
+
+static void varint_decode(const uint8_t* in, size_t bytes, int16_t* out, size_t n) {
+    const uint8_t* end = in + bytes;
+    int32_t x = out[0];
+
+    for (size_t i = 1; i < n; i++) {
+        uint32_t u = 0;
+        for (unsigned shift = 0; in < end; shift += 7) {
+            uint8_t b = *in++;
+            u |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        x += unzigzag(u);
+        out[i] = (int16_t)x;
+    }
+}
+
+static void evict_oldest(sample_history_t* h) {
+    const sample_history_entry_t* e = &h->index[h->first_id % h->max_segments];
+    h->stats.segments--;
+    h->stats.samples -= e->count;
+    h->stats.bytes -= e->bytes;
+    h->stats.evicted++;
+
+    h->first_id++;
+    if (h->first_id == h->next_id) {
+        h->head = 0;
+        h->tail = 0;
+    }
+    else {
+        h->tail = h->index[h->first_id % h->max_segments].offset;
+    }
+}
+
+// Find len contiguous bytes at the head of the arena, evicting as needed. Segments are never
+// split, so when there's no room before the end of the arena the head wraps to 0 and the
+// tail end goes unused for a lap
+static size_t reserve(sample_history_t* h, size_t len) {
+    if (h->next_id - h->first_id == h->max_segments) {
+        evict_oldest(h);
+    }
+    while (true) {
+        bool empty = (h->first_id == h->next_id);
+        bool wrapped = !empty && h->head <= h->tail;
+        if (!wrapped) {
+            if (h->head + len <= h->arena_size) {
+                break;
+            }
+            if (len <= h->tail) {
+                h->head = 0;
+                break;
+            }
+        }
+        else if (h->head + len <= h->tail) {
+            break;
+        }
+        evict_oldest(h);
+    }
+    size_t offset = h->head;
+    h->head += len;
+    return offset;
+}
+
+esp_err_t sample_history_flush(sample_history_t* h) {
+    const size_t n = h->pending_len;
+    if (n == 0) {
+        return ESP_OK;
+    }
+
+    // Deltas, and the size of each encoding
+    uint64_t sum = 0;
+    size_t varint_bytes = 0;
+    for (size_t i = 1; i < n; i++) {
+        uint32_t u = zigzag((int32_t)h->pending[i] - h->pending[i - 1]);
+        h->zigzag[i - 1] = u;
+        sum += u;
+        varint_bytes += varint_len(u);
+    }
+    // Largest k with 2^k <= the mean. Rice is close to optimal there for the roughly
+    // geometric spread of deltas a sampled signal has
+    unsigned k = 0;
+    while (k < MAX_RICE_K && ((uint64_t)(n - 1) << (k + 1)) <= sum) {
+        k++;
+    }
+    size_t rice_bytes = (rice_bits(h->zigzag, n - 1, k) + 7) / 8;
+
+    sample_history_codec_t codec = (rice_bytes < varint_bytes) ? SAMPLE_HISTORY_RICE : SAMPLE_HISTORY_VARINT;
+    size_t len = (codec == SAMPLE_HISTORY_RICE) ? rice_bytes : varint_bytes;
+    if (len > h->arena_size || len > UINT16_MAX) {
+        h->pending_len = 0;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t offset = reserve(h, len);
+    if (codec == SAMPLE_HISTORY_RICE) {
+        rice_encode(&h->arena[offset], h->zigzag, n - 1, k);
+        h->stats.rice_segments++;
+    }
+    else {
+        varint_encode(&h->arena[offset], h->zigzag, n - 1);
+        h->stats.varint_segments++;
+    }
+
+    sample_history_entry_t* e = &h->index[h->next_id % h->max_segments];
+    e->offset = (uint32_t)offset;
+    e->bytes = (uint16_t)len;
+    e->count = (uint16_t)n;
+    e->first = h->pending[0];
+    e->codec = (uint8_t)codec;
+    e->rice_k = (uint8_t)k;
+    e->sample_rate_hz = h->pending_rate_hz;
+    e->timestamp_us = h->pending_timestamp_us;
+    h->next_id++;
+
+    h->stats.segments++;
+    h->stats.samples += n;
+    h->stats.bytes += len;
+    h->pending_len = 0;
+    return ESP_OK;
+}
+
+esp_err_t sample_history_push(sample_history_t* h, int64_t timestamp_us, uint32_t sample_rate_hz,
+                              const int16_t* samples, size_t n) {
+    if (sample_rate_hz == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    if (h->pending_len > 0 && sample_rate_hz != h->pending_rate_hz) {
+        err = sample_history_flush(h);
+    }
+
+    for (size_t done = 0; done < n && err == ESP_OK;) {
+        if (h->pending_len == 0) {
+            h->pending_timestamp_us = timestamp_us + (int64_t)done * 1000000 / sample_rate_hz;
+            h->pending_rate_hz = sample_rate_hz;
+        }
+        size_t chunk = h->segment_len - h->pending_len;
+        if (chunk > n - done) {
+            chunk = n - done;
+        }
+        memcpy(&h->pending[h->pending_len], &samples[done], chunk * sizeof(int16_t));
+        h->pending_len += chunk;
+        done += chunk;
+        if (h->pending_len == h->segment_len) {
+            err = sample_history_flush(h);
+        }
+    }
+    return err;
+}
+
+static const sample_history_entry_t* find(const sample_history_t* h, uint32_t id) {
+    // Unsigned, so ids before first_id wrap round to huge and fail too
+    if (id - h->first_id >= h->next_id - h->first_id) {
+        return NULL;
+    }
+    return &h->index[id % h->max_segments];
+}
+
+static void fill_info(const sample_history_entry_t* e, uint32_t id, sample_history_info_t* info) {
+    info->id = id;
+    info->timestamp_us = e->timestamp_us;
+    info->sample_rate_hz = e->sample_rate_hz;
+    info->count = e->count;
+    info->bytes = e->bytes;
+    info->codec = (sample_history_codec_t)e->codec;
+}
+
+esp_err_t sample_history_get_info(const sample_history_t* h, uint32_t id, sample_history_info_t* info) {
+    const sample_history_entry_t* e = find(h, id);
+    if (e == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    fill_info(e, id, info);
+    return ESP_OK;
+}
+
+esp_err_t sample_history_read(const sample_history_t* h, uint32_t id, int16_t* out, sample_history_info_t* info) {
+    const sample_history_entry_t* e = find(h, id);
+    if (e == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    out[0] = e->first;
+    if (e->codec == SAMPLE_HISTORY_RICE) {
+        rice_decode(&h->arena[e->offset], e->bytes, out, e->count, e->rice_k);
+    }
+    else {
+        varint_decode(&h->arena[e->offset], e->bytes, out, e->count);
+    }
+    if (info != NULL) {
+        fill_info(e, id, info);
+    }
+    return ESP_OK;
+}
+
+void sample_history_get_stats(const sample_history_t* h, sample_history_stats_t* stats) {
+    *stats = h->stats;
+}
+
+esp_err_t sample_history_init(sample_history_t* h, size_t arena_bytes, size_t max_segments, size_t segment_len) {
+    if (segment_len == 0) {
+        segment_len = SAMPLE_HISTORY_DEFAULT_SEGMENT_LEN;
+    }
+    if (h == NULL || arena_bytes == 0 || arena_bytes > UINT32_MAX || segment_len > MAX_SEGMENT_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (max_segments == 0) {
+        max_segments = arena_bytes * 8 / segment_len;
+        if (max_segments < 4) {
+            max_segments = 4;
+        }
+    }
+
+    h->arena = malloc(arena_bytes);
+    h->index = malloc(max_segments * sizeof(sample_history_entry_t));
+    h->zigzag = malloc(segment_len * sizeof(uint32_t));
+    h->pending = malloc(segment_len * sizeof(int16_t));
+    if (h->arena == NULL || h->index == NULL || h->zigzag == NULL || h->pending == NULL) {
+        sample_history_free(h);
+        return ESP_ERR_NO_MEM;
+    }
+    h->arena_size = arena_bytes;
+    h->max_segments = max_segments;
+    h->segment_len = segment_len;
+    sample_history_reset(h);
+    return ESP_OK;
+}
+
+void sample_history_free(sample_history_t* h) {
+    free(h->arena);
+    free(h->index);
+    free(h->zigzag);
+    free(h->pending);
+    h->arena = NULL;
+    h->index = NULL;
+    h->zigzag = NULL;
+    h->pending = NULL;
+}
+
+void sample_history_reset(sample_history_t* h) {
+    h->head = 0;
+    h->tail = 0;
+    h->first_id = 0;
+    h->next_id = 0;
+    h->pending_len = 0;
+    memset(&h->stats, 0, sizeof(h->stats));
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+
+/**
+ * Lock-free single-producer/single-consumer ring buffer for ADC samples.
+ *
+ * One side (a task or an ISR) pushes single samples, the other side pops them out
+ * a block at a time. Neither side ever takes a lock or makes a kernel call, so the
+ * producer can't be delayed by the consumer. When the ring is full the push fails
+ * and it's up to the producer to count the drop.
+ *
+ * head and tail are free-running counters, so head - tail is always the fill level
+ * and the capacity has to be a power of 2 for the index mask to work.
+ *
+ * The sampler hands over whole frames now (ADC-Sampler), so the only user left is
+ * 9b-bench-ring.c, which compares this ring with the old semaphore double buffer.
+ */
+typedef struct {
+    int16_t* buf;           // Storage supplied by the caller
+    size_t mask;            // capacity - 1
+    atomic_size_t head;     // Next slot to write. Only written by the producer
+    atomic_size_t tail;     // Next slot to read. Only written by the consumer
+} sample_ring_t;
+
+// Set up a ring on top of storage[capacity]. capacity must be a power of 2
+esp_err_t sample_ring_init(sample_ring_t* ring, int16_t* storage, size_t capacity);
+
+// Producer side. Safe to call from an ISR. Returns false if the ring is full
+bool sample_ring_push(sample_ring_t* ring, int16_t sample);
+
+// Consumer side. Copies up to max samples into dst and returns how many were copied
+size_t sample_ring_pop_block(sample_ring_t* ring, int16_t* dst, size_t max);
+
+// Number of samples waiting. Exact from the consumer side, a lower bound from the producer side
+size_t sample_ring_count(sample_ring_t* ring);
+
+static inline size_t sample_ring_capacity(const sample_ring_t* ring) {
+    return ring->mask + 1;
+}
@@ -0,0 +1,65 @@
+#include "sample_ring.h"
+#include "esp_attr.h"
+
+
+esp_err_t sample_ring_init(sample_ring_t* ring, int16_t* storage, size_t capacity) {
+    // Power of 2 check: only one bit set
+    if (ring == NULL || storage == NULL || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ring->buf = storage;
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ESP_OK;
+}
+
+bool IRAM_ATTR sample_ring_push(sample_ring_t* ring, int16_t sample) {
+    // Only this side writes head so a relaxed read is fine.
+    // Acquire on tail so we don't overwrite a slot the consumer is still copying out of
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail > ring->mask) {
+        return false;
+    }
+
+    ring->buf[head & ring->mask] = sample;
+    // Release so the sample is visible before the consumer sees the new head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+size_t sample_ring_pop_block(sample_ring_t* ring, int16_t* dst, size_t max) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t n = head - tail;
+
+    if (n > max) {
+        n = max;
+    }
+
+    // Copy out in at most 2 chunks: up to the end of storage, then from the start
+    size_t idx = tail & ring->mask;
+    size_t first = ring->mask + 1 - idx;
+    if (first > n) {
+        first = n;
+    }
+    for (size_t i = 0; i < first; i++) {
+        dst[i] = ring->buf[idx + i];
+    }
+    for (size_t i = first; i < n; i++) {
+        dst[i] = ring->buf[i - first];
+    }
+
+    // Release so the producer can't reuse the slots until we're done reading them
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+size_t sample_ring_count(sample_ring_t* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Sequence lock for publishing a small struct from one writer to any number of readers.
+ *
+ * The writer bumps the sequence number to odd, writes the data, then bumps it back to even.
+ * It never waits on anything, so it can't be held up by a reader the way a critical section
+ * or mutex would be. Readers copy the data out and check the sequence number didn't change
+ * underneath them, retrying if it did.
+ *
+ * Writer:
+ *     seqlock_write_begin(&lock);
+ *     shared = new_value;
+ *     seqlock_write_end(&lock);
+ *
+ * Reader:
+ *     uint32_t seq;
+ *     do {
+ *         seq = seqlock_read_begin(&lock);
+ *         copy = shared;
+ *     } while (seqlock_read_retry(&lock, seq));
+ *
+ * Only one writer at a time. On a single core a reader that preempted the writer mid-update
+ * will spin until the writer runs again, so a higher priority reader should back off
+ * (e.g. vTaskDelay) after a few retries instead of spinning forever.
+ */
+
+typedef struct {
+    atomic_uint_fast32_t seq;
+} seqlock_t;
+
+#define SEQLOCK_INITIALIZER { 0 }
+
+static inline void seqlock_write_begin(seqlock_t* lock) {
+    uint_fast32_t seq = atomic_load_explicit(&lock->seq, memory_order_relaxed);
+    atomic_store_explicit(&lock->seq, seq + 1, memory_order_relaxed);
+    // Readers must see the odd number before any of the new data
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void seqlock_write_end(seqlock_t* lock) {
+    uint_fast32_t seq = atomic_load_explicit(&lock->seq, memory_order_relaxed);
+    // ...and all of the new data before the even number
+    atomic_store_explicit(&lock->seq, seq + 1, memory_order_release);
+}
+
+// Returns the sequence number to pass to seqlock_read_retry. Odd means a write is in progress
+// and the read is bound to be retried
+static inline uint32_t seqlock_read_begin(seqlock_t* lock) {
+    return (uint32_t)atomic_load_explicit(&lock->seq, memory_order_acquire);
+}
+
+// True if the data read since seqlock_read_begin may be torn and has to be read again
+static inline bool seqlock_read_retry(seqlock_t* lock, uint32_t start) {
+    atomic_thread_fence(memory_order_acquire);
+    return (start & 1) || (uint32_t)atomic_load_explicit(&lock->seq, memory_order_relaxed) != start;
+}
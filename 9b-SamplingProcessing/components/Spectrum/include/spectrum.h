@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Streaming power spectrum of a block-fed signal, in fixed point.
+ *
+ * Samples are pushed in whatever blocks the sampler produces. Every hop samples, once len
+ * samples have come in, the last len are detrended, Hann windowed and run through a Q15 FFT,
+ * and power holds the new spectrum. hop < len gives overlapping windows (len / 2 is the usual
+ * 50%).
+ *
+ * The FFT is radix-4 with a single radix-2 stage first when len is an odd power of 2, on
+ * bit-reversed input. Each stage scales by 1/radix so nothing can overflow, which makes the
+ * result the DFT / len. Twiddles come from one table for SPECTRUM_MAX_LEN, built on first
+ * use, that smaller sizes stride through.
+ *
+ * Input is assumed to be 12-bit ADC codes. They're scaled up to +/-2^14 before the FFT to
+ * use as much of Q15 as possible while leaving room for the twiddle rotations.
+ */
+
+#define SPECTRUM_MIN_LEN 16
+#define SPECTRUM_MAX_LEN 1024
+
+typedef struct {
+    int16_t re;
+    int16_t im;
+} spectrum_cpx_t;
+
+typedef struct {
+    size_t len;                 // FFT size, a power of 2
+    size_t hop;                 // New samples between FFTs
+    int16_t* window;            // Hann, Q15
+    int16_t* samples;           // Last len samples, oldest at pos once full
+    size_t pos;
+    size_t count;               // Samples in the buffer, up to len
+    size_t since_fft;           // Samples pushed since the last FFT
+    spectrum_cpx_t* work;
+    uint32_t* power;            // len / 2 + 1 bins of re^2 + im^2, DC first
+    uint32_t frames;            // FFTs done since reset
+} spectrum_t;
+
+// Build the twiddle table. Called by spectrum_init, only needed to use spectrum_fft_q15 directly
+void spectrum_fft_setup(void);
+// In place FFT of len points (a power of 2 from SPECTRUM_MIN_LEN to SPECTRUM_MAX_LEN). The
+// result is scaled by 1 / len
+void spectrum_fft_q15(spectrum_cpx_t* x, size_t len);
+
+esp_err_t spectrum_init(spectrum_t* s, size_t len, size_t hop);
+void spectrum_free(spectrum_t* s);
+void spectrum_reset(spectrum_t* s);
+
+// Returns how many FFTs the block completed. Only the last one's spectrum is kept in power
+size_t spectrum_push_block(spectrum_t* s, const int16_t* samples, size_t n);
+
+static inline size_t spectrum_bins(const spectrum_t* s) {
+    return s->len / 2 + 1;
+}
@@ -0,0 +1,220 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spectrum.h"
+
+
+#define TWIDDLES (SPECTRUM_MAX_LEN * 3 / 4)
+#define INPUT_SHIFT 12      // 12-bit sample * Q15 window >> 12 = +/-2^14
+
+// W^k = cos(2 pi k / N) - j sin(2 pi k / N) for N = SPECTRUM_MAX_LEN. A radix-4 butterfly
+// needs up to W^3k with k < N / 4, hence 3/4 of a turn
+static spectrum_cpx_t twiddles[TWIDDLES];
+static volatile bool twiddles_ready = false;
+
+
+void spectrum_fft_setup(void) {
+    if (twiddles_ready) {
+        return;
+    }
+    for (size_t k = 0; k < TWIDDLES; k++) {
+        double angle = 2.0 * M_PI * k / SPECTRUM_MAX_LEN;
+        twiddles[k].re = (int16_t)lround(32767.0 * cos(angle));
+        twiddles[k].im = (int16_t)lround(-32767.0 * sin(angle));
+    }
+    twiddles_ready = true;
+}
+
+static inline bool is_pow2(size_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+static void bit_reverse(spectrum_cpx_t* x, size_t len) {
+    for (size_t i = 1, j = 0; i < len; i++) {
+        size_t bit = len >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            spectrum_cpx_t t = x[i];
+            x[i] = x[j];
+            x[j] = t;
+        }
+    }
+}
+
+// Q15 complex multiply. Both parts of v are within +/-2^15 and w is a unit twiddle, so the
+// 32-bit sums can't overflow
+static inline void cmul(int32_t re, int32_t im, spectrum_cpx_t w, int32_t* out_re, int32_t* out_im) {
+    *out_re = (re * w.re - im * w.im) >> 15;
+    *out_im = (re * w.im + im * w.re) >> 15;
+}
+
+void spectrum_fft_q15(spectrum_cpx_t* x, size_t len) {
+    bit_reverse(x, len);
+
+    // log2(len) odd: one radix-2 stage with no twiddles first, the rest are radix-4
+    size_t h = 1;
+    if (__builtin_ctz(len) & 1) {
+        for (size_t i = 0; i < len; i += 2) {
+            int32_t ar = x[i].re, ai = x[i].im;
+            int32_t br = x[i + 1].re, bi = x[i + 1].im;
+            x[i].re = (int16_t)((ar + br + 1) >> 1);
+            x[i].im = (int16_t)((ai + bi + 1) >> 1);
+            x[i + 1].re = (int16_t)((ar - br + 1) >> 1);
+            x[i + 1].im = (int16_t)((ai - bi + 1) >> 1);
+        }
+        h = 2;
+    }
+
+    // Each radix-4 stage is two radix-2 stages merged. With bit-reversed input the four
+    // points of a butterfly sit h apart as a, b, c, d and need twiddles W^0, W^2k, W^k, W^3k
+    // of the 4h point DFT this stage builds
+    for (; h < len; h *= 4) {
+        const size_t stride = SPECTRUM_MAX_LEN / (4 * h);
+        for (size_t base = 0; base < len; base += 4 * h) {
+            for (size_t k = 0; k < h; k++) {
+                spectrum_cpx_t* a = &x[base + k];
+                spectrum_cpx_t* b = a + h;
+                spectrum_cpx_t* c = b + h;
+                spectrum_cpx_t* d = c + h;
+
+                int32_t rr, ri, pr, pi, qr, qi;
+                cmul(b->re, b->im, twiddles[2 * k * stride], &rr, &ri);
+                cmul(c->re, c->im, twiddles[k * stride], &pr, &pi);
+                cmul(d->re, d->im, twiddles[3 * k * stride], &qr, &qi);
+
+                int32_t s0r = a->re + rr, s0i = a->im + ri;
+                int32_t s1r = a->re - rr, s1i = a->im - ri;
+                int32_t t0r = pr + qr, t0i = pi + qi;
+                int32_t t1r = pr - qr, t1i = pi - qi;
+
+                // X1 = s1 - j t1, X3 = s1 + j t1
+                a->re = (int16_t)((s0r + t0r + 2) >> 2);
+                a->im = (int16_t)((s0i + t0i + 2) >> 2);
+                b->re = (int16_t)((s1r + t1i + 2) >> 2);
+                b->im = (int16_t)((s1i - t1r + 2) >> 2);
+                c->re = (int16_t)((s0r - t0r + 2) >> 2);
+                c->im = (int16_t)((s0i - t0i + 2) >> 2);
+                d->re = (int16_t)((s1r - t1i + 2) >> 2);
+                d->im = (int16_t)((s1i + t1r + 2) >> 2);
+            }
+        }
+    }
+}
+
+esp_err_t spectrum_init(spectrum_t* s, size_t len, size_t hop) {
+    if (s == NULL || !is_pow2(len) || len < SPECTRUM_MIN_LEN || len > SPECTRUM_MAX_LEN ||
+        hop == 0 || hop > len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    spectrum_fft_setup();
+
+    s->window = malloc(len * sizeof(int16_t));
+    s->samples = malloc(len * sizeof(int16_t));
+    s->work = malloc(len * sizeof(spectrum_cpx_t));
+    s->power = malloc((len / 2 + 1) * sizeof(uint32_t));
+    if (s->window == NULL || s->samples == NULL || s->work == NULL || s->power == NULL) {
+        spectrum_free(s);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        s->window[i] = (int16_t)lround(32767.0 * 0.5 * (1.0 - cos(2.0 * M_PI * i / len)));
+    }
+    s->len = len;
+    s->hop = hop;
+    spectrum_reset(s);
+    return ESP_OK;
+}
+
+void spectrum_free(spectrum_t* s) {
+    free(s->window);
+    free(s->samples);
+    free(s->work);
+    free(s->power);
+    s->window = NULL;
+    s->samples = NULL;
+    s->work = NULL;
+    s->power = NULL;
+    s->len = 0;
+}
+
+void spectrum_reset(spectrum_t* s) {
+    s->pos = 0;
+    s->count = 0;
+    s->since_fft = 0;
+    s->frames = 0;
+    memset(s->power, 0, (s->len / 2 + 1) * sizeof(uint32_t));
+}
+
+// Window the last len samples into work, FFT them and update power
+static void run_fft(spectrum_t* s) {
+    const size_t len = s->len;
+
+    // Take the mean out first so the ADC's DC offset doesn't leak into the low bins through
+    // the window's sidelobes
+    int32_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += s->samples[i];
+    }
+    const int32_t mean = sum / (int32_t)len;
+
+    // samples is a ring with the oldest at pos
+    for (size_t i = 0; i < len; i++) {
+        size_t idx = s->pos + i;
+        if (idx >= len) {
+            idx -= len;
+        }
+        s->work[i].re = (int16_t)(((s->samples[idx] - mean) * (int32_t)s->window[i]) >> INPUT_SHIFT);
+        s->work[i].im = 0;
+    }
+
+    spectrum_fft_q15(s->work, len);
+
+    for (size_t i = 0; i <= len / 2; i++) {
+        int32_t re = s->work[i].re;
+        int32_t im = s->work[i].im;
+        s->power[i] = (uint32_t)(re * re) + (uint32_t)(im * im);
+    }
+    s->frames++;
+}
+
+size_t spectrum_push_block(spectrum_t* s, const int16_t* samples, size_t n) {
+    size_t ffts = 0;
+
+    while (n > 0) {
+        // Copy up to the next FFT, or the end of the block, in at most two runs around the ring
+        size_t chunk = s->hop - s->since_fft;
+        if (chunk > n) {
+            chunk = n;
+        }
+        for (size_t done = 0; done < chunk;) {
+            size_t run = s->len - s->pos;
+            if (run > chunk - done) {
+                run = chunk - done;
+            }
+            memcpy(&s->samples[s->pos], &samples[done], run * sizeof(int16_t));
+            done += run;
+            s->pos += run;
+            if (s->pos == s->len) {
+                s->pos = 0;
+            }
+        }
+        samples += chunk;
+        n -= chunk;
+        s->since_fft += chunk;
+        s->count = (s->count + chunk > s->len) ? s->len : s->count + chunk;
+
+        if (s->since_fft == s->hop) {
+            s->since_fft = 0;
+            if (s->count == s->len) {
+                run_fft(s);
+                ffts++;
+            }
+        }
+    }
+    return ffts;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Binary telemetry stream. Results and raw sample blocks are packed into small binary
+ * records, COBS-framed (so a 0x00 byte always means end of record and the decoder can pick
+ * up mid-stream), and batched into buffers that a writer task sends out in one UART write each.
+ *
+ * The producer never blocks and never formats anything. If the writer task has every
+ * buffer tied up the record is dropped and counted. Records carry a sequence number so the
+ * host can see where that happened.
+ *
+ * Record layout before framing, little endian:
+ *   0     type (telemetry_rec_type_t)
+ *   1     TELEMETRY_REC_AVG: number of channels. TELEMETRY_REC_RAW: ADC channel. Otherwise 0
+ *   2-3   sequence number, +1 per record
+ *   4-7   timestamp, low 32 bits of esp_timer_get_time()
+ *   8-    TELEMETRY_REC_AVG: one float per channel. TELEMETRY_REC_RAW: int16_t samples
+ *         TELEMETRY_REC_RATE: uint32_t first frame at the new rate, uint32_t new rate in Hz
+ *
+ * telemetry_decode.py turns the stream back into CSV on the host.
+ *
+ * Only one task may send records.
+ */
+
+#define TELEMETRY_HEADER_LEN 8
+#define TELEMETRY_MAX_PAYLOAD 1024
+
+#define TELEMETRY_DEFAULT_BATCH_SIZE 512
+#define TELEMETRY_DEFAULT_BATCHES 4
+#define TELEMETRY_DEFAULT_FLUSH_MS 100
+
+typedef enum {
+    TELEMETRY_REC_AVG = 1,
+    TELEMETRY_REC_RAW = 2,
+    TELEMETRY_REC_RATE = 3,
+} telemetry_rec_type_t;
+
+// Where full batches go. Returns the number of bytes written
+typedef size_t (*telemetry_write_fn_t)(const uint8_t* data, size_t len, void* ctx);
+
+typedef struct {
+    size_t batch_size;              // Bytes per batch buffer. 0 for TELEMETRY_DEFAULT_BATCH_SIZE
+    size_t num_batches;             // 0 for TELEMETRY_DEFAULT_BATCHES
+    uint32_t flush_ms;              // Send a part full batch once its oldest record is this old, even if nothing else comes. 0 for the default
+    telemetry_write_fn_t write;     // Optional. NULL for the UART from menuconfig (stdout on linux)
+    void* write_ctx;
+    uint32_t task_priority;         // Priority of the writer task
+} telemetry_config_t;
+
+typedef struct {
+    uint32_t records;               // Records queued for sending
+    uint32_t dropped_records;       // Records with no batch buffer to go in
+    uint32_t batches;               // Writes to the output
+    uint32_t bytes;                 // Bytes written, framing included
+} telemetry_stats_t;
+
+esp_err_t telemetry_start(const telemetry_config_t* config);
+// Sends whatever's batched and lets the writer finish. Blocks until it's all gone out
+esp_err_t telemetry_stop(void);
+
+// Queue a record. False if it was dropped or too big
+bool telemetry_send_avg(int64_t timestamp_us, const float* avg, size_t num_channels);
+bool telemetry_send_raw(int64_t timestamp_us, uint8_t channel, const int16_t* samples, size_t len);
+// The sample rate changed, starting with frame seq
+bool telemetry_send_rate(int64_t timestamp_us, uint32_t seq, uint32_t sample_rate_hz);
+// Hand the current batch to the writer task now instead of waiting for it to fill
+void telemetry_flush(void);
+
+void telemetry_get_stats(telemetry_stats_t* stats);
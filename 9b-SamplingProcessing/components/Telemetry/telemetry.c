@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "telemetry.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "driver/uart.h"
+#endif
+
+
+#define TELEMETRY_TASK_STACK 3072
+#define UART_RX_BUF 256     // The driver wants one even though nothing is read back
+
+// Worst case COBS size of a record, delimiter included
+#define COBS_MAX_LEN(len) ((len) + (len) / 254 + 2)
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    int64_t first_us;       // When the oldest record in it was added
+} telemetry_batch_t;
+
+static struct {
+    telemetry_config_t config;
+    telemetry_batch_t* batches;
+    uint8_t* storage;
+    telemetry_batch_t* cur;     // Batch being filled. NULL if none were free. Under cur_lock
+    SemaphoreHandle_t cur_lock; // So the writer can send a part full batch nobody's adding to
+    QueueHandle_t free_q;
+    QueueHandle_t ready_q;      // A NULL batch tells the writer to stop
+    TaskHandle_t task;
+    SemaphoreHandle_t done;     // Given by the writer on its way out
+    uint16_t seq;
+    uint8_t record[TELEMETRY_HEADER_LEN + TELEMETRY_MAX_PAYLOAD];
+} tm = {0};
+
+static telemetry_stats_t stats = {0};
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+// Consistent Overhead Byte Stuffing. Every 0x00 in the record is replaced with the distance
+// to the next one, so the only 0x00 in the output is the delimiter on the end
+static size_t cobs_encode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t code_idx = 0;
+    size_t o = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] != 0) {
+            out[o++] = in[i];
+            code++;
+        }
+        if (in[i] == 0 || code == 0xFF) {
+            out[code_idx] = code;
+            code_idx = o++;
+            code = 1;
+        }
+    }
+    out[code_idx] = code;
+    out[o++] = 0;
+    return o;
+}
+
+static size_t default_write(const uint8_t* data, size_t len, void* ctx) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+    size_t n = fwrite(data, 1, len, stdout);
+    fflush(stdout);
+    return n;
+#else
+    int n = uart_write_bytes(CONFIG_TELEMETRY_UART_NUM, data, len);
+    return (n > 0) ? (size_t)n : 0;
+#endif
+}
+
+static esp_err_t default_output_init(void) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+    return ESP_OK;
+#else
+    const uart_config_t uart_config = {
+        .baud_rate = CONFIG_TELEMETRY_UART_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    // No TX ring buffer: the writer task owns the batch until the UART has taken all of it,
+    // so there's no point copying it again
+    esp_err_t err = uart_driver_install(CONFIG_TELEMETRY_UART_NUM, UART_RX_BUF, 0, 0, NULL, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = uart_param_config(CONFIG_TELEMETRY_UART_NUM, &uart_config);
+    if (err == ESP_OK) {
+        err = uart_set_pin(CONFIG_TELEMETRY_UART_NUM, CONFIG_TELEMETRY_UART_TX_PIN,
+                           UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    }
+    if (err != ESP_OK) {
+        uart_driver_delete(CONFIG_TELEMETRY_UART_NUM);
+    }
+    return err;
+#endif
+}
+
+static void default_output_deinit(void) {
+#ifndef CONFIG_IDF_TARGET_LINUX
+    uart_driver_delete(CONFIG_TELEMETRY_UART_NUM);
+#endif
+}
+
+// Hand tm.cur to the writer. Caller holds cur_lock. Can't fail: the queue holds every batch
+static void flush_locked(void) {
+    if (tm.cur != NULL && tm.cur->len > 0) {
+        xQueueSend(tm.ready_q, &tm.cur, 0);
+        tm.cur = NULL;
+    }
+}
+
+// Sends batches as they're handed over. If none comes for flush_ms it sends the part full one
+// itself once it's old enough, so the last records before a quiet spell aren't held back until
+// the next one. Leaves once it gets to the NULL telemetry_stop queues after the last batch,
+// so it's never deleted in the middle of a write
+static void telemetry_task(void* param) {
+    const TickType_t flush_ticks = (pdMS_TO_TICKS(tm.config.flush_ms) > 0) ? pdMS_TO_TICKS(tm.config.flush_ms) : 1;
+    telemetry_batch_t* batch;
+
+    while (true) {
+        if (xQueueReceive(tm.ready_q, &batch, flush_ticks) != pdTRUE) {
+            xSemaphoreTake(tm.cur_lock, portMAX_DELAY);
+            if (tm.cur != NULL && esp_timer_get_time() - tm.cur->first_us >= (int64_t)tm.config.flush_ms * 1000) {
+                flush_locked();
+            }
+            xSemaphoreGive(tm.cur_lock);
+            continue;
+        }
+        if (batch == NULL) {
+            break;
+        }
+        size_t n = tm.config.write(batch->data, batch->len, tm.config.write_ctx);
+
+        portENTER_CRITICAL(&stats_lock);
+        stats.batches++;
+        stats.bytes += n;
+        portEXIT_CRITICAL(&stats_lock);
+
+        batch->len = 0;
+        xQueueSend(tm.free_q, &batch, 0);
+    }
+    xSemaphoreGive(tm.done);
+    vTaskDelete(NULL);
+}
+
+// The writer has to be gone already
+static void free_state(void) {
+    if (tm.free_q != NULL) {
+        vQueueDelete(tm.free_q);
+        tm.free_q = NULL;
+    }
+    if (tm.ready_q != NULL) {
+        vQueueDelete(tm.ready_q);
+        tm.ready_q = NULL;
+    }
+    free(tm.batches);
+    free(tm.storage);
+    tm.batches = NULL;
+    tm.storage = NULL;
+    tm.cur = NULL;
+}
+
+esp_err_t telemetry_start(const telemetry_config_t* config) {
+    if (config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (tm.task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    tm.config = *config;
+    if (tm.config.batch_size == 0) {
+        tm.config.batch_size = TELEMETRY_DEFAULT_BATCH_SIZE;
+    }
+    if (tm.config.num_batches == 0) {
+        tm.config.num_batches = TELEMETRY_DEFAULT_BATCHES;
+    }
+    if (tm.config.flush_ms == 0) {
+        tm.config.flush_ms = TELEMETRY_DEFAULT_FLUSH_MS;
+    }
+    if (tm.config.batch_size < COBS_MAX_LEN(TELEMETRY_HEADER_LEN)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (tm.config.write == NULL) {
+        esp_err_t err = default_output_init();
+        if (err != ESP_OK) {
+            return err;
+        }
+        tm.config.write = default_write;
+    }
+
+    const size_t num = tm.config.num_batches;
+    tm.seq = 0;
+    tm.batches = calloc(num, sizeof(telemetry_batch_t));
+    tm.storage = malloc(num * tm.config.batch_size);
+    tm.free_q = xQueueCreate(num, sizeof(telemetry_batch_t*));
+    tm.ready_q = xQueueCreate(num, sizeof(telemetry_batch_t*));
+    if (tm.cur_lock == NULL) {
+        tm.cur_lock = xSemaphoreCreateMutex();
+    }
+    if (tm.done == NULL) {
+        tm.done = xSemaphoreCreateBinary();
+    }
+    if (tm.batches == NULL || tm.storage == NULL || tm.free_q == NULL || tm.ready_q == NULL ||
+        tm.cur_lock == NULL || tm.done == NULL) {
+        free_state();
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < num; i++) {
+        telemetry_batch_t* batch = &tm.batches[i];
+        batch->data = &tm.storage[i * tm.config.batch_size];
+        xQueueSend(tm.free_q, &batch, 0);
+    }
+    memset(&stats, 0, sizeof(stats));
+
+    if (xTaskCreate(telemetry_task, "Telemetry", TELEMETRY_TASK_STACK, NULL, tm.config.task_priority, &tm.task) != pdPASS) {
+        tm.task = NULL;
+        free_state();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t telemetry_stop(void) {
+    if (tm.task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    telemetry_flush();
+    // Behind every batch already queued, so they all go out first. The queue may be full of
+    // them, but the writer makes room
+    telemetry_batch_t* stop = NULL;
+    xQueueSend(tm.ready_q, &stop, portMAX_DELAY);
+    xSemaphoreTake(tm.done, portMAX_DELAY);
+    tm.task = NULL;
+
+    bool default_output = (tm.config.write == default_write);
+    free_state();
+    if (default_output) {
+        default_output_deinit();
+    }
+    return ESP_OK;
+}
+
+void telemetry_flush(void) {
+    if (tm.task == NULL) {
+        return;
+    }
+    xSemaphoreTake(tm.cur_lock, portMAX_DELAY);
+    flush_locked();
+    xSemaphoreGive(tm.cur_lock);
+}
+
+// Frame the record in tm.record and add it to the current batch, starting a new batch if it
+// doesn't fit
+static bool queue_record(uint8_t type, uint8_t arg, int64_t timestamp_us, size_t payload_len) {
+    const size_t len = TELEMETRY_HEADER_LEN + payload_len;
+    const size_t max_len = COBS_MAX_LEN(len);
+    bool queued = false;
+
+    // Held for the one record, so the writer's flush can't take the batch out from under it
+    xSemaphoreTake(tm.cur_lock, portMAX_DELAY);
+    if (max_len <= tm.config.batch_size) {
+        if (tm.cur != NULL && tm.cur->len + max_len > tm.config.batch_size) {
+            flush_locked();
+        }
+        if (tm.cur == NULL && xQueueReceive(tm.free_q, &tm.cur, 0) != pdTRUE) {
+            tm.cur = NULL;
+        }
+    }
+
+    if (tm.cur != NULL) {
+        uint32_t ts = (uint32_t)timestamp_us;
+        tm.record[0] = type;
+        tm.record[1] = arg;
+        tm.record[2] = (uint8_t)tm.seq;
+        tm.record[3] = (uint8_t)(tm.seq >> 8);
+        tm.record[4] = (uint8_t)ts;
+        tm.record[5] = (uint8_t)(ts >> 8);
+        tm.record[6] = (uint8_t)(ts >> 16);
+        tm.record[7] = (uint8_t)(ts >> 24);
+
+        if (tm.cur->len == 0) {
+            tm.cur->first_us = timestamp_us;
+        }
+        tm.cur->len += cobs_encode(tm.record, len, &tm.cur->data[tm.cur->len]);
+        queued = true;
+
+        if (timestamp_us - tm.cur->first_us >= (int64_t)tm.config.flush_ms * 1000) {
+            flush_locked();
+        }
+    }
+    xSemaphoreGive(tm.cur_lock);
+    // Counts even if dropped, so the host sees the gap
+    tm.seq++;
+
+    portENTER_CRITICAL(&stats_lock);
+    if (queued) {
+        stats.records++;
+    }
+    else {
+        stats.dropped_records++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    return queued;
+}
+
+bool telemetry_send_avg(int64_t timestamp_us, const float* avg, size_t num_channels) {
+    size_t payload_len = num_channels * sizeof(float);
+    if (tm.task == NULL || num_channels > UINT8_MAX || payload_len > TELEMETRY_MAX_PAYLOAD) {
+        return false;
+    }
+    // Both targets are little endian, so the floats go out as they are in memory
+    memcpy(&tm.record[TELEMETRY_HEADER_LEN], avg, payload_len);
+    return queue_record(TELEMETRY_REC_AVG, (uint8_t)num_channels, timestamp_us, payload_len);
+}
+
+bool telemetry_send_raw(int64_t timestamp_us, uint8_t channel, const int16_t* samples, size_t len) {
+    size_t payload_len = len * sizeof(int16_t);
+    if (tm.task == NULL || payload_len > TELEMETRY_MAX_PAYLOAD) {
+        return false;
+    }
+    memcpy(&tm.record[TELEMETRY_HEADER_LEN], samples, payload_len);
+    return queue_record(TELEMETRY_REC_RAW, channel, timestamp_us, payload_len);
+}
+
+bool telemetry_send_rate(int64_t timestamp_us, uint32_t seq, uint32_t sample_rate_hz) {
+    if (tm.task == NULL) {
+        return false;
+    }
+    memcpy(&tm.record[TELEMETRY_HEADER_LEN], &seq, sizeof(seq));
+    memcpy(&tm.record[TELEMETRY_HEADER_LEN + sizeof(seq)], &sample_rate_hz, sizeof(sample_rate_hz));
+    return queue_record(TELEMETRY_REC_RATE, 0, timestamp_us, sizeof(seq) + sizeof(sample_rate_hz));
+}
+
+void telemetry_get_stats(telemetry_stats_t* out) {
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
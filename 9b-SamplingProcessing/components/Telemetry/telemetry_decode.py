@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""
+Decodes the Telemetry component's binary stream into CSV.
+
+Averages go to stdout (or --out) as  seq,timestamp_us,ch0,ch1,...
+Raw blocks go to --raw if given, one row per sample as  seq,timestamp_us,channel,index,value
+where timestamp_us is when the block was finished and index counts from the oldest sample.
+Sample rate changes go to --rates if given as  seq,timestamp_us,frame,rate_hz
+where frame is the first sampler frame at the new rate.
+
+    telemetry_decode.py capture.bin > avg.csv
+    telemetry_decode.py /dev/ttyUSB0 --baud 921600 --raw raw.csv > avg.csv    (needs pyserial)
+
+Anything that isn't a valid record (console text, a partial record at the start) is skipped.
+Gaps in the sequence numbers are counted and reported on stderr at the end.
+"""
+import argparse
+import struct
+import sys
+
+HEADER = struct.Struct("<BBHI")
+REC_AVG = 1
+REC_RAW = 2
+REC_RATE = 3
+RATE = struct.Struct("<II")
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0 or i + code > len(frame):
+            return None
+        out += frame[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def frames(stream, live):
+    """Yields each 0x00 delimited chunk of the stream. A live stream is read until Ctrl+C."""
+    buf = bytearray()
+    while True:
+        data = stream.read(4096)
+        if not data:
+            if live:
+                continue
+            break
+        buf += data
+        while True:
+            end = buf.find(0)
+            if end < 0:
+                break
+            yield bytes(buf[:end])
+            del buf[:end + 1]
+
+
+def open_input(path, baud):
+    """Returns the stream and whether it's live (a serial port)."""
+    if path == "-":
+        return sys.stdin.buffer, False
+    if path.startswith("/dev/tty") or path.upper().startswith("COM"):
+        import serial
+        return serial.Serial(path, baud, timeout=1), True
+    return open(path, "rb"), False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("input", help="capture file, serial port, or - for stdin")
+    parser.add_argument("--baud", type=int, default=921600)
+    parser.add_argument("--out", help="averages CSV (default stdout)")
+    parser.add_argument("--raw", help="raw samples CSV (raw records are skipped if not given)")
+    parser.add_argument("--rates", help="sample rate changes CSV (skipped if not given)")
+    args = parser.parse_args()
+
+    avg_out = open(args.out, "w") if args.out else sys.stdout
+    raw_out = open(args.raw, "w") if args.raw else None
+    if raw_out:
+        raw_out.write("seq,timestamp_us,channel,index,value\n")
+    rates_out = open(args.rates, "w") if args.rates else None
+    if rates_out:
+        rates_out.write("seq,timestamp_us,frame,rate_hz\n")
+
+    records = bad = missing = 0
+    last_seq = None
+    ts_high = 0         # Timestamps are the low 32 bits, so track the wraps
+    last_ts = None
+    avg_channels = None
+
+    try:
+        for frame in frames(*open_input(args.input, args.baud)):
+            rec = cobs_decode(frame)
+            if rec is None or len(rec) < HEADER.size:
+                bad += 1
+                continue
+            rec_type, arg, seq, ts = HEADER.unpack_from(rec)
+            payload = rec[HEADER.size:]
+            if rec_type == REC_AVG and len(payload) == arg * 4:
+                values = struct.unpack(f"<{arg}f", payload)
+            elif rec_type == REC_RAW and len(payload) % 2 == 0:
+                values = struct.unpack(f"<{len(payload) // 2}h", payload)
+            elif rec_type == REC_RATE and len(payload) == RATE.size:
+                values = RATE.unpack(payload)
+            else:
+                bad += 1
+                continue
+
+            records += 1
+            if last_seq is not None:
+                missing += (seq - last_seq - 1) & 0xFFFF
+            last_seq = seq
+            if last_ts is not None and ts < last_ts:
+                ts_high += 1 << 32
+            last_ts = ts
+            timestamp = ts_high + ts
+
+            if rec_type == REC_AVG:
+                if avg_channels != arg:
+                    avg_channels = arg
+                    avg_out.write("seq,timestamp_us," + ",".join(f"ch{i}" for i in range(arg)) + "\n")
+                avg_out.write(f"{seq},{timestamp}," + ",".join(f"{v:.3f}" for v in values) + "\n")
+            elif rec_type == REC_RATE:
+                if rates_out:
+                    rates_out.write(f"{seq},{timestamp},{values[0]},{values[1]}\n")
+            elif raw_out:
+                for i, v in enumerate(values):
+                    raw_out.write(f"{seq},{timestamp},{arg},{i},{v}\n")
+    except KeyboardInterrupt:
+        pass
+
+    print(f"{records} records, {missing} missing, {bad} bad frames skipped", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
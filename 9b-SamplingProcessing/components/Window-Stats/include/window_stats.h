@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Sliding-window statistics over the last len samples, updated in O(1) per sample.
+ *
+ * Mean and variance come from running integer sums, so they don't drift no matter how
+ * long it runs. Min and max come from monotonic deques: each sample goes in once and comes
+ * out once, so a window of thousands of samples costs the same per sample as a window of 10.
+ *
+ * The window length is set at runtime and can be changed with window_stats_resize.
+ * Until the window fills up the stats cover however many samples have been pushed.
+ */
+
+typedef struct {
+    uint32_t seq;       // Sample number, used to tell when it's slid out of the window
+    int16_t value;
+} window_stats_entry_t;
+
+typedef struct {
+    window_stats_entry_t* entries;
+    size_t head;        // Oldest entry
+    size_t count;
+} window_stats_deque_t;
+
+typedef struct {
+    size_t len;                 // Window length
+    int16_t* samples;           // Last len samples, oldest at pos once full
+    size_t pos;                 // Next slot to write
+    size_t count;               // Samples in the window, up to len
+    uint32_t seq;               // Samples pushed since reset
+    int64_t sum;
+    int64_t sum_sq;
+    window_stats_deque_t min_q; // Increasing values, front is the min
+    window_stats_deque_t max_q; // Decreasing values, front is the max
+} window_stats_t;
+
+typedef struct {
+    size_t count;
+    float mean;
+    float variance;     // Population variance
+    int min;
+    int max;
+} window_stats_result_t;
+
+// Allocate a window of len samples
+esp_err_t window_stats_init(window_stats_t* ws, size_t len);
+void window_stats_free(window_stats_t* ws);
+// Change the window length. The window starts over empty
+esp_err_t window_stats_resize(window_stats_t* ws, size_t len);
+void window_stats_reset(window_stats_t* ws);
+
+void window_stats_push(window_stats_t* ws, int16_t sample);
+// Same result as pushing one at a time, but the sums for the block are done with the block kernels
+void window_stats_push_block(window_stats_t* ws, const int16_t* samples, size_t n);
+
+// Stats over the current window. All zeros if nothing's been pushed
+void window_stats_get(const window_stats_t* ws, window_stats_result_t* result);
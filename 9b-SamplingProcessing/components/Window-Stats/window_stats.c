@@ -0,0 +1,165 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "window_stats.h"
+#include "block_kernels.h"
+
+
+esp_err_t window_stats_init(window_stats_t* ws, size_t len) {
+    if (ws == NULL || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ws->samples = malloc(len * sizeof(int16_t));
+    ws->min_q.entries = malloc(len * sizeof(window_stats_entry_t));
+    ws->max_q.entries = malloc(len * sizeof(window_stats_entry_t));
+    if (ws->samples == NULL || ws->min_q.entries == NULL || ws->max_q.entries == NULL) {
+        window_stats_free(ws);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ws->len = len;
+    window_stats_reset(ws);
+    return ESP_OK;
+}
+
+void window_stats_free(window_stats_t* ws) {
+    free(ws->samples);
+    free(ws->min_q.entries);
+    free(ws->max_q.entries);
+    ws->samples = NULL;
+    ws->min_q.entries = NULL;
+    ws->max_q.entries = NULL;
+    ws->len = 0;
+}
+
+esp_err_t window_stats_resize(window_stats_t* ws, size_t len) {
+    if (ws == NULL || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    window_stats_free(ws);
+    return window_stats_init(ws, len);
+}
+
+void window_stats_reset(window_stats_t* ws) {
+    ws->pos = 0;
+    ws->count = 0;
+    ws->seq = 0;
+    ws->sum = 0;
+    ws->sum_sq = 0;
+    ws->min_q.head = 0;
+    ws->min_q.count = 0;
+    ws->max_q.head = 0;
+    ws->max_q.count = 0;
+}
+
+// Index of the i'th entry from the front of a deque that wraps at len
+static inline size_t deque_idx(const window_stats_deque_t* q, size_t i, size_t len) {
+    size_t idx = q->head + i;
+    return (idx >= len) ? idx - len : idx;
+}
+
+// Push onto the back of a monotonic deque. Entries at the back that the new value beats
+// can never be the min (or max) again, so they're dropped. keep_less picks min vs max.
+static inline void deque_push(window_stats_deque_t* q, size_t len, uint32_t seq, int16_t value, bool keep_less) {
+    while (q->count > 0) {
+        int back = q->entries[deque_idx(q, q->count - 1, len)].value;
+        if (keep_less ? (back < value) : (back > value)) {
+            break;
+        }
+        q->count--;
+    }
+    window_stats_entry_t* e = &q->entries[deque_idx(q, q->count, len)];
+    e->seq = seq;
+    e->value = value;
+    q->count++;
+}
+
+// Drop the front entry if it's slid out of the window
+static inline void deque_expire(window_stats_deque_t* q, size_t len, uint32_t oldest_seq) {
+    if (q->count > 0 && (int32_t)(q->entries[q->head].seq - oldest_seq) < 0) {
+        q->head = (q->head + 1 >= len) ? 0 : q->head + 1;
+        q->count--;
+    }
+}
+
+void window_stats_push(window_stats_t* ws, int16_t sample) {
+    // Take the oldest sample out of the sums once the window is full
+    if (ws->count == ws->len) {
+        int old = ws->samples[ws->pos];
+        ws->sum -= old;
+        ws->sum_sq -= (int64_t)old * old;
+    }
+    else {
+        ws->count++;
+    }
+
+    ws->samples[ws->pos] = sample;
+    ws->pos = (ws->pos + 1 >= ws->len) ? 0 : ws->pos + 1;
+    ws->sum += sample;
+    ws->sum_sq += (int64_t)sample * sample;
+
+    // Only one sample leaves the window per push so at most one entry expires from each deque
+    uint32_t oldest_seq = ws->seq + 1 - (uint32_t)ws->count;
+    deque_expire(&ws->min_q, ws->len, oldest_seq);
+    deque_expire(&ws->max_q, ws->len, oldest_seq);
+    deque_push(&ws->min_q, ws->len, ws->seq, sample, true);
+    deque_push(&ws->max_q, ws->len, ws->seq, sample, false);
+    ws->seq++;
+}
+
+void window_stats_push_block(window_stats_t* ws, const int16_t* samples, size_t n) {
+    while (n > 0) {
+        // Work in chunks that don't wrap around the sample storage so the kernels see contiguous blocks
+        size_t chunk = ws->len - ws->pos;
+        if (chunk > n) {
+            chunk = n;
+        }
+        int16_t* slot = &ws->samples[ws->pos];
+
+        // While filling up, pos == count so everything from pos on is empty
+        if (ws->count == ws->len) {
+            ws->sum -= block_sum_i16(slot, chunk);
+            ws->sum_sq -= block_sum_sq_i16(slot, chunk);
+        }
+        ws->sum += block_sum_i16(samples, chunk);
+        ws->sum_sq += block_sum_sq_i16(samples, chunk);
+        memcpy(slot, samples, chunk * sizeof(int16_t));
+
+        // The deques still need one step per sample
+        for (size_t i = 0; i < chunk; i++) {
+            if (ws->count < ws->len) {
+                ws->count++;
+            }
+            uint32_t oldest_seq = ws->seq + 1 - (uint32_t)ws->count;
+            deque_expire(&ws->min_q, ws->len, oldest_seq);
+            deque_expire(&ws->max_q, ws->len, oldest_seq);
+            deque_push(&ws->min_q, ws->len, ws->seq, samples[i], true);
+            deque_push(&ws->max_q, ws->len, ws->seq, samples[i], false);
+            ws->seq++;
+        }
+
+        ws->pos = (ws->pos + chunk >= ws->len) ? 0 : ws->pos + chunk;
+        samples += chunk;
+        n -= chunk;
+    }
+}
+
+void window_stats_get(const window_stats_t* ws, window_stats_result_t* result) {
+    size_t n = ws->count;
+    result->count = n;
+    if (n == 0) {
+        result->mean = 0.0f;
+        result->variance = 0.0f;
+        result->min = 0;
+        result->max = 0;
+        return;
+    }
+
+    // n*sum_sq - sum^2 is exact in 64 bits for 12-bit samples and windows up to ~100k,
+    // so the only rounding is the final divide
+    result->mean = (float)ws->sum / (float)n;
+    result->variance = (float)((int64_t)n * ws->sum_sq - ws->sum * ws->sum) / ((float)n * (float)n);
+    result->min = ws->min_q.entries[ws->min_q.head].value;
+    result->max = ws->max_q.entries[ws->max_q.head].value;
+}
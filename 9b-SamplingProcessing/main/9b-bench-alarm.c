@@ -0,0 +1,63 @@
+/**
+ * Threshold alarm latency: crossing to handler through the sampler's fast path, compared with
+ * waiting for the averager.
+ *
+ * Runs the pipeline with a HIGH_CODES / LOW_CODES alarm on every channel. The mock's sine
+ * swings through both, so every channel crosses twice a period. For each rate it reports
+ * crossings handled and dropped, and the crossing sample -> alarm task latency (p50, p99,
+ * max). For comparison, "block path" is the worst a reaction in calc_avg_task could do: the
+ * sample can be a whole frame old when the frame completes, then the frame still has to get
+ * through the averager.
+ *
+ * On hardware with the oneshot backend every sample is checked as it's read, so the alarm
+ * latency is a task switch. The mock (and the continuous backend) produce a frame at a time,
+ * so on the linux target the alarm path still saves the averager but not the frame.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "9b-pipeline.h"
+
+
+#define RUN_MS 3000
+#define HIGH_CODES 3000
+#define LOW_CODES 1000
+
+static const char* TAG = "bench";
+static latency_hist_t latency;
+static const uint32_t rates_hz[] = {100, 1000, 10000};
+
+
+void app_main(void) {
+    ESP_LOGI(TAG, "    rate  alarms dropped  alarm p50  alarm p99  alarm max  block path");
+    for (size_t r = 0; r < sizeof(rates_hz) / sizeof(rates_hz[0]); r++) {
+        pipeline_config_t config = {
+            .sample_rate_hz = rates_hz[r],
+            .log_results = false,
+        };
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            config.alarm[ch].high = HIGH_CODES;
+            config.alarm[ch].low = LOW_CODES;
+        }
+
+        if (pipeline_start(&config) != ESP_OK) {
+            ESP_LOGE(TAG, "%" PRIu32 " Hz: pipeline didn't start", rates_hz[r]);
+            pipeline_stop();
+            continue;
+        }
+        vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+        pipeline_get_alarm_latency(&latency);
+        pipeline_stop();
+
+        pipeline_metrics_t m;
+        pipeline_get_metrics(&m);
+        int64_t block_path_us = (int64_t)FRAME_LEN * 1000000 / rates_hz[r] + m.latency_max_us;
+
+        ESP_LOGI(TAG, "%8" PRIu32 " %7" PRIu32 " %7" PRIu32 " %8" PRIu32 "us %8" PRIu32 "us %8" PRIu32 "us %9" PRId64 "us",
+                 rates_hz[r], m.alarms, m.alarms_dropped, latency_hist_percentile(&latency, 0.5f),
+                 latency_hist_percentile(&latency, 0.99f), latency_hist_max(&latency), block_path_us);
+    }
+}
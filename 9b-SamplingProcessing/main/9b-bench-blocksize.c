@@ -0,0 +1,112 @@
+/**
+ * Fixed BUF_SIZE blocks vs. the pipeline's tuned block size, across sample rates.
+ *
+ * on_result spins for COST_US per published average, standing in for per-block work downstream
+ * (a network publish, a display update), so each block costs about the same however long it is.
+ * At every rate the pipeline runs RUN_MS with the block fixed at FRAME_LEN, then RUN_MS tuning
+ * it for TARGET_US end to end within the default overhead budget. Reported per run:
+ *  - block: raw samples per channel per frame it ended on, and how many times it changed
+ *  - overhead: measured per-block cost and what it came to as a share of the CPU (tuned only)
+ *  - cpu: sampler + averager busy time over the run
+ *  - e2e: filling a block at that rate plus the mean and worst frame ready -> published
+ *  - samples dropped
+ * Fixed blocks should burn more and more of the CPU on overhead as the rate goes up, until
+ * frames drop. Tuned blocks should grow with the rate to stay around the budget, and stay
+ * small at low rates where latency is all there is to win.
+ * Then a tuned run changes rate under it (ADC_sampler_set_rate) and reports the block size
+ * every REPORT_MS, to see it re-tune on each change.
+ *
+ * On the host the mock catches up in bursts after each tick it sleeps, so short frames lose a
+ * few to the pool there however idle the CPU is.
+ *
+ * Meant for the linux target with the mock backend, but runs the same on hardware.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "ADC-sampler.h"
+#include "9b-pipeline.h"
+
+
+#define COST_US 100
+#define TARGET_US 5000
+#define RATES_HZ {500, 2000, 10000, 20000, 40000}
+#define RUN_MS 2000
+#define STEP_RATES_HZ {1000, 20000, 2000}
+#define STEP_MS 1500
+#define REPORT_MS 250
+
+static const char* TAG = "bench";
+
+
+static void on_result(const pipeline_avg_t* avg, void* ctx) {
+    int64_t until = esp_timer_get_time() + COST_US;
+    while (esp_timer_get_time() < until) {
+    }
+}
+
+static void run(uint32_t rate, bool tuned) {
+    pipeline_config_t config = {
+        .sample_rate_hz = rate,
+        .log_results = false,
+        .on_result = on_result,
+        .latency_target_us = tuned ? TARGET_US : 0,
+    };
+    pipeline_metrics_t m;
+
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(pipeline_start(&config));
+    vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+    pipeline_get_metrics(&m);
+    int64_t elapsed = esp_timer_get_time() - start;
+    ESP_ERROR_CHECK(pipeline_stop());
+
+    float cpu = (float)(m.sampler_busy_us + m.avg_busy_us) * 100 / elapsed;
+    float fill_us = (float)m.block_len * 1000000 / rate;
+    float latency_us = m.blocks ? (float)m.latency_sum_us / m.blocks : 0.0f;
+    ESP_LOGI(TAG, "%-5s %6" PRIu32 " %5" PRIu32 " %5" PRIu32 " %8.1f %8.1f%% %5.1f%% %8.0f %8.0f %8" PRIu32,
+             tuned ? "tuned" : "fixed", rate, m.block_len, m.block_tunes, m.block_overhead_us, m.block_overhead_pct,
+             cpu, fill_us + latency_us, fill_us + m.latency_max_us, m.dropped_samples);
+}
+
+static void run_steps(void) {
+    static const uint32_t rates[] = STEP_RATES_HZ;
+    pipeline_config_t config = {
+        .sample_rate_hz = rates[0],
+        .log_results = false,
+        .on_result = on_result,
+        .latency_target_us = TARGET_US,
+    };
+    pipeline_metrics_t m;
+
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(pipeline_start(&config));
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        ESP_ERROR_CHECK(ADC_sampler_set_rate(rates[i]));
+        for (int ms = 0; ms < STEP_MS; ms += REPORT_MS) {
+            vTaskDelay(pdMS_TO_TICKS(REPORT_MS));
+            pipeline_get_metrics(&m);
+            ESP_LOGI(TAG, "  %5.2f s  %6" PRIu32 " Hz  block %3" PRIu32 "  overhead %5.1f%%  %6" PRIu32 " dropped",
+                     (esp_timer_get_time() - start) / 1e6, m.sample_rate_hz, m.block_len, m.block_overhead_pct,
+                     m.dropped_samples);
+        }
+    }
+    ESP_ERROR_CHECK(pipeline_stop());
+}
+
+void app_main(void) {
+    static const uint32_t rates[] = RATES_HZ;
+
+    ESP_LOGI(TAG, "%d us per block downstream, %d us latency target, blocks of %d to %d samples",
+             COST_US, TARGET_US, DECIM_FILTER_FACTOR, MAX_FRAME_LEN);
+    ESP_LOGI(TAG, "mode    rate block tunes overhead     (cpu)   cpu  e2e avg  e2e max  dropped");
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        run(rates[i], false);
+        run(rates[i], true);
+    }
+    ESP_LOGI(TAG, "Rate steps:");
+    run_steps();
+}
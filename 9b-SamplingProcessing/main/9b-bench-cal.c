@@ -0,0 +1,124 @@
+/**
+ * Raw code to mV: a calibration call per sample vs. the ADC-Cal lookup table.
+ *
+ * A block of BLOCK_LEN raw codes is converted over and over both ways, and the results are
+ * compared sample for sample. Reported: ns per sample each way, the speedup, and how long
+ * building the table takes (a calibration call for each of the 4096 codes, once per channel).
+ *
+ * On hardware the per-sample path is adc_cali_raw_to_voltage on ADC1 channel 0 at 12 dB, and
+ * the table is built from the same calibration. The linux target has no calibration driver,
+ * so there both use a stand-in with the same shape of maths as esp_adc's curve fitting scheme:
+ * a 64-bit line fit then a polynomial error correction.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "adc_cal.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#endif
+
+
+#define BLOCK_LEN 1024
+#define PASSES 200
+
+static const char* TAG = "bench";
+
+static int16_t raw[BLOCK_LEN];
+static int16_t mv_call[BLOCK_LEN];
+static int16_t mv_lut[BLOCK_LEN];
+
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+// Error correction polynomial in uV, each coefficient a ratio like the scheme's tables. About
+// +/-15 mV over the range
+static const int64_t err_coef[] = {-2000, 12, -4, 5};
+static const int64_t err_div[] = {1, 1, 1000, 10000000};
+
+static int cal_call(int raw_code) {
+    // Line fit: coefficients in the same fixed point as the scheme's
+    const int64_t coeff_a = 3100LL * 65536 / 4095;
+    int64_t v = ((int64_t)raw_code * coeff_a + 32768) / 65536;
+    int64_t err = 0;
+    int64_t term = 1;
+    for (size_t i = 0; i < sizeof(err_coef) / sizeof(err_coef[0]); i++) {
+        err += term * err_coef[i] / err_div[i];
+        term *= raw_code;
+    }
+    return (int)(v - err / 1000);
+}
+#else
+static adc_cali_handle_t cali_handle;
+
+static int cal_call(int raw_code) {
+    int v = 0;
+    adc_cali_raw_to_voltage(cali_handle, raw_code, &v);
+    return v;
+}
+#endif
+
+void app_main(void) {
+    adc_cal_lut_t lut;
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1, .chan = ADC_CHANNEL_0, .atten = ADC_ATTEN_DB_12, .bitwidth = ADC_BITWIDTH_12,
+    };
+    ESP_ERROR_CHECK(adc_cali_create_scheme_curve_fitting(&cali_config, &cali_handle));
+#else
+    adc_cali_line_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1, .atten = ADC_ATTEN_DB_12, .bitwidth = ADC_BITWIDTH_12,
+    };
+    ESP_ERROR_CHECK(adc_cali_create_scheme_line_fitting(&cali_config, &cali_handle));
+#endif
+#endif
+
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(adc_cal_lut_init(&lut, 0, 0, ADC_CAL_ATTEN_DB_12));
+#ifdef CONFIG_IDF_TARGET_LINUX
+    // No calibration to build from, so fill it from the stand-in the same way
+    for (int code = 0; code < ADC_CAL_LUT_LEN; code++) {
+        lut.mv[code] = (int16_t)cal_call(code);
+    }
+#endif
+    int64_t build_us = esp_timer_get_time() - start;
+
+    uint32_t state = 1;
+    for (size_t i = 0; i < BLOCK_LEN; i++) {
+        state = state * 1103515245u + 12345u;
+        raw[i] = (int16_t)((state >> 16) & (ADC_CAL_LUT_LEN - 1));
+    }
+
+    start = esp_timer_get_time();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < BLOCK_LEN; i++) {
+            mv_call[i] = (int16_t)cal_call(raw[i]);
+        }
+    }
+    int64_t call_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int pass = 0; pass < PASSES; pass++) {
+        adc_cal_lut_convert(&lut, raw, mv_lut, BLOCK_LEN);
+    }
+    int64_t lut_us = esp_timer_get_time() - start;
+
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < BLOCK_LEN; i++) {
+        mismatches += (mv_call[i] != mv_lut[i]);
+    }
+
+    const double samples = (double)BLOCK_LEN * PASSES;
+    ESP_LOGI(TAG, "Table built in %" PRId64 " us (%s)", build_us, lut.calibrated ? "calibrated" : "stand-in / nominal");
+    ESP_LOGI(TAG, "per-sample call %7.2f ns/sample", call_us * 1000.0 / samples);
+    ESP_LOGI(TAG, "table lookup    %7.2f ns/sample  %.1fx  %s", lut_us * 1000.0 / samples,
+             (double)call_us / (lut_us > 0 ? lut_us : 1), mismatches ? "MISMATCH" : "ok");
+    adc_cal_lut_free(&lut);
+}
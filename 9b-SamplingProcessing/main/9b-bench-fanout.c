@@ -0,0 +1,243 @@
+/**
+ * Fanning sampler frames out to several consumers: copying vs. ADC-Sampler subscribers.
+ *
+ * Cost: the main consumer plus 0 to MAX_EXTRA extra consumers that each read every frame.
+ *  - copy: how it had to be done before subscribers, the main consumer copies each frame into
+ *    a queue per extra consumer (by value, the frame's samples included) and releases it
+ *  - fanout: each extra consumer subscribes and gets the same frame by reference
+ * Reported per frame: time spent handing frames over (sampler task + copies), and frames the
+ * sampler dropped because the pool ran dry.
+ *
+ * Lag: the main consumer and three subscribers that keep up to different degrees
+ *  - fast: releases every frame straight away
+ *  - slow: takes SLOW_MS over each frame, longer than a frame period, so it keeps falling behind
+ *  - stalls: like fast, but sits on a frame for STALL_MS every STALL_EVERY_MS
+ * Reported per subscriber: frames it got and missed, its deepest backlog and frame ready ->
+ * acquired lag, plus what the main consumer lost. Only the slow subscribers should miss frames.
+ *
+ * Meant for the linux target with the mock backend, but runs the same on hardware.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "ADC-sampler.h"
+
+
+#define RATE_HZ 20000
+#define NUM_CHANNELS 4
+#define FRAME_LEN 100
+#define MAX_EXTRA 3
+#define SUB_QUEUE_LEN 4
+#define NUM_FRAMES (3 + MAX_EXTRA * (SUB_QUEUE_LEN + 1))   // Main consumer's 3 plus what every subscriber can hold
+#define RUN_MS 2000
+#define SLOW_MS 8
+#define STALL_EVERY_MS 500
+#define STALL_MS 50
+
+static const char* TAG = "bench";
+static const char* sub_names[] = {"fast", "slow", "stalls"};
+
+// A frame copied out for one consumer
+typedef struct {
+    uint32_t seq;
+    int16_t samples[NUM_CHANNELS][FRAME_LEN];
+} frame_copy_t;
+
+static TaskHandle_t main_task_handle = NULL;
+static volatile bool running;
+static volatile int32_t sink;   // So the readers' sums aren't optimised away
+static QueueHandle_t copy_qs[MAX_EXTRA];
+static size_t num_copies;
+static int64_t copy_us;         // Main consumer's time spent copying
+static uint32_t main_frames;
+
+
+static int32_t read_frame(const int16_t* const* samples) {
+    int32_t sum = 0;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        for (size_t i = 0; i < FRAME_LEN; i++) {
+            sum += samples[ch][i];
+        }
+    }
+    return sum;
+}
+
+static void main_consumer_task(void* param) {
+    static frame_copy_t copy;
+
+    while (running) {
+        const ADC_sampler_frame_t* frame = ADC_sampler_acquire(pdMS_TO_TICKS(10));
+        if (frame == NULL) {
+            continue;
+        }
+        sink = read_frame(frame->samples);
+        if (num_copies > 0) {
+            int64_t start = esp_timer_get_time();
+            copy.seq = frame->seq;
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                memcpy(copy.samples[ch], frame->samples[ch], FRAME_LEN * sizeof(int16_t));
+            }
+            for (size_t i = 0; i < num_copies; i++) {
+                xQueueSend(copy_qs[i], &copy, 0);
+            }
+            copy_us += esp_timer_get_time() - start;
+        }
+        main_frames++;
+        ADC_sampler_release(frame);
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+// param is the index of its queue in copy_qs
+static void copy_reader_task(void* param) {
+    static frame_copy_t copies[MAX_EXTRA];
+    size_t idx = (size_t)param;
+    frame_copy_t* mine = &copies[idx];
+
+    while (running) {
+        if (xQueueReceive(copy_qs[idx], mine, pdMS_TO_TICKS(10)) == pdTRUE) {
+            const int16_t* samples[NUM_CHANNELS];
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                samples[ch] = mine->samples[ch];
+            }
+            sink = read_frame(samples);
+        }
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+static ADC_sampler_sub_t* subs[MAX_EXTRA];
+static int sub_kind[MAX_EXTRA];    // Index into sub_names
+
+// param is the index of its subscriber in subs
+static void sub_reader_task(void* param) {
+    size_t idx = (size_t)param;
+    int64_t next_stall = esp_timer_get_time() + STALL_EVERY_MS * 1000;
+
+    while (running) {
+        const ADC_sampler_frame_t* frame = ADC_sampler_sub_acquire(subs[idx], pdMS_TO_TICKS(10));
+        if (frame == NULL) {
+            continue;
+        }
+        sink = read_frame(frame->samples);
+        if (sub_kind[idx] == 1) {
+            vTaskDelay(pdMS_TO_TICKS(SLOW_MS));
+        }
+        else if (sub_kind[idx] == 2 && esp_timer_get_time() >= next_stall) {
+            vTaskDelay(pdMS_TO_TICKS(STALL_MS));
+            next_stall = esp_timer_get_time() + STALL_EVERY_MS * 1000;
+        }
+        ADC_sampler_release(frame);
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+static void configure(void) {
+    ADC_sampler_config_t config = {
+        .sample_rate_hz = RATE_HZ,
+        .frame_len = FRAME_LEN,
+        .num_frames = NUM_FRAMES,
+        .overrun_policy = ADC_SAMPLER_OVERRUN_DROP_NEWEST,
+        .channels = {0, 1, 2, 3},
+        .num_channels = NUM_CHANNELS,
+        .on_frame = NULL,
+        .task_priority = 5,
+    };
+    ESP_ERROR_CHECK(ADC_sampler_config(&config));
+    main_frames = 0;
+    copy_us = 0;
+}
+
+// Start everything, run for RUN_MS, stop and wait for the num_tasks consumers to finish
+static void run(size_t num_tasks, ADC_sampler_stats_t* stats) {
+    ESP_ERROR_CHECK(ADC_sampler_start());
+    vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+    ESP_ERROR_CHECK(ADC_sampler_stop());
+    running = false;
+    for (size_t i = 0; i < num_tasks; i++) {
+        // One count per consumer, so don't clear them all at once
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    }
+    ADC_sampler_get_stats(stats);
+}
+
+static void bench_cost(bool fanout, size_t extra) {
+    ADC_sampler_stats_t stats;
+    configure();
+    running = true;
+    num_copies = fanout ? 0 : extra;
+    for (size_t i = 0; i < extra; i++) {
+        if (fanout) {
+            ESP_ERROR_CHECK(ADC_sampler_subscribe(SUB_QUEUE_LEN, &subs[i]));
+            sub_kind[i] = 0;
+            xTaskCreate(sub_reader_task, "sub", 4096, (void*)i, 4, NULL);
+        }
+        else {
+            copy_qs[i] = xQueueCreate(SUB_QUEUE_LEN, sizeof(frame_copy_t));
+            xTaskCreate(copy_reader_task, "copy", 4096, (void*)i, 4, NULL);
+        }
+    }
+    xTaskCreate(main_consumer_task, "main", 4096, NULL, 4, NULL);
+    run(extra + 1, &stats);
+    ESP_ERROR_CHECK(ADC_sampler_deinit());
+    if (!fanout) {
+        for (size_t i = 0; i < extra; i++) {
+            vQueueDelete(copy_qs[i]);
+        }
+    }
+
+    double handoff_us = (double)(stats.busy_us + copy_us) / (stats.frames ? stats.frames : 1);
+    ESP_LOGI(TAG, "%-7s %5d %9" PRIu32 " %9" PRIu32 " %16.2f %13.2f", fanout ? "fanout" : "copy", (int)extra,
+             stats.frames, stats.dropped_frames, handoff_us, (double)copy_us / (stats.frames ? stats.frames : 1));
+}
+
+static void bench_lag(void) {
+    ADC_sampler_stats_t stats;
+    configure();
+    running = true;
+    num_copies = 0;
+    for (size_t i = 0; i < MAX_EXTRA; i++) {
+        ESP_ERROR_CHECK(ADC_sampler_subscribe(SUB_QUEUE_LEN, &subs[i]));
+        sub_kind[i] = (int)i;
+        xTaskCreate(sub_reader_task, "sub", 4096, (void*)i, 4, NULL);
+    }
+    xTaskCreate(main_consumer_task, "main", 4096, NULL, 4, NULL);
+    run(MAX_EXTRA + 1, &stats);
+
+    ESP_LOGI(TAG, "main consumer: %" PRIu32 " frames, %" PRIu32 " dropped", main_frames, stats.dropped_frames);
+    ESP_LOGI(TAG, "subscriber    frames   dropped  max queued   lag p50   lag p99   lag max");
+    for (size_t i = 0; i < MAX_EXTRA; i++) {
+        ADC_sampler_sub_stats_t sub_stats;
+        static latency_hist_t lag;
+        ADC_sampler_get_sub_stats(subs[i], &sub_stats, &lag);
+        ESP_LOGI(TAG, "%-10s %9" PRIu32 " %9" PRIu32 " %11" PRIu32 " %7" PRIu32 "us %7" PRIu32 "us %7" PRIu32 "us",
+                 sub_names[i], sub_stats.frames, sub_stats.dropped_frames, sub_stats.max_waiting,
+                 latency_hist_percentile(&lag, 0.5f), latency_hist_percentile(&lag, 0.99f), latency_hist_max(&lag));
+    }
+    ESP_ERROR_CHECK(ADC_sampler_deinit());
+}
+
+void app_main(void) {
+    main_task_handle = xTaskGetCurrentTaskHandle();
+
+    ESP_LOGI(TAG, "%d Hz, %d channels x %d samples/frame, %d frames, subscriber queues of %d",
+             RATE_HZ, NUM_CHANNELS, FRAME_LEN, NUM_FRAMES, SUB_QUEUE_LEN);
+    ESP_LOGI(TAG, "method  extra    frames   dropped handoff us/frame copy us/frame");
+    for (size_t extra = 0; extra <= MAX_EXTRA; extra++) {
+        bench_cost(false, extra);
+    }
+    for (size_t extra = 1; extra <= MAX_EXTRA; extra++) {
+        bench_cost(true, extra);
+    }
+
+    ESP_LOGI(TAG, "Lag: %d ms per frame (slow), %d ms stall every %d ms (stalls)", SLOW_MS, STALL_MS, STALL_EVERY_MS);
+    bench_lag();
+}
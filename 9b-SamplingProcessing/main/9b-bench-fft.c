@@ -0,0 +1,120 @@
+/**
+ * Cost and accuracy of the Spectrum component's fixed-point FFT.
+ *
+ * For sizes 64 to 1024 it reports
+ *  - cycles per FFT, and per point per log2(N) to compare sizes fairly
+ *  - SNR of the Q15 result against a double precision DFT of the same input (a full-scale
+ *    random signal), i.e. how much the per-stage scaling and twiddle rounding cost
+ *  - cycles per sample of the streaming stage (window, FFT, power) at 50% overlap, which is
+ *    what calc_avg_task pays per channel with pipeline_config_t.spectrum_len set
+ *
+ * On the linux target the cycle count comes from the x86 TSC, on hardware from the CPU cycle
+ * counter.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "spectrum.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "Only the x86 TSC is wired up as a cycle counter for the linux target"
+#endif
+#include <x86intrin.h>
+static inline uint64_t cycles(void) { return __rdtsc(); }
+#else
+#include "esp_cpu.h"
+static inline uint64_t cycles(void) { return esp_cpu_get_cycle_count(); }
+#endif
+
+#define MIN_LEN 64
+#define MAX_LEN 1024
+#define POINTS_PER_RUN (1 << 18)    // Each size runs enough FFTs to cover this many points
+#define STREAM_SAMPLES (1 << 17)
+#define STREAM_BLOCK 40             // FRAME_LEN with the default decimation factor
+
+static const char* TAG = "bench";
+
+static spectrum_cpx_t input[MAX_LEN];
+static spectrum_cpx_t work[MAX_LEN];
+static int16_t adc[STREAM_SAMPLES];
+
+
+static double snr_db(const spectrum_cpx_t* in, const spectrum_cpx_t* out, size_t len) {
+    double signal = 0, noise = 0;
+    for (size_t k = 0; k < len; k++) {
+        double re = 0, im = 0;
+        for (size_t n = 0; n < len; n++) {
+            double angle = -2.0 * M_PI * (double)((k * n) % len) / len;
+            re += in[n].re * cos(angle) - in[n].im * sin(angle);
+            im += in[n].re * sin(angle) + in[n].im * cos(angle);
+        }
+        re /= len;
+        im /= len;
+        signal += re * re + im * im;
+        noise += (re - out[k].re) * (re - out[k].re) + (im - out[k].im) * (im - out[k].im);
+    }
+    return 10.0 * log10(signal / noise);
+}
+
+static double stream_cycles(size_t len) {
+    spectrum_t s;
+    ESP_ERROR_CHECK(spectrum_init(&s, len, len / 2));
+    uint64_t start = cycles();
+    for (size_t i = 0; i < STREAM_SAMPLES; i += STREAM_BLOCK) {
+        spectrum_push_block(&s, &adc[i], STREAM_BLOCK);
+    }
+    uint64_t elapsed = cycles() - start;
+    spectrum_free(&s);
+    return elapsed / (double)STREAM_SAMPLES;
+}
+
+void app_main(void) {
+    spectrum_fft_setup();
+    for (size_t i = 0; i < MAX_LEN; i++) {
+        input[i].re = (int16_t)((rand() & 0x7FFF) - 0x4000);
+        input[i].im = (int16_t)((rand() & 0x7FFF) - 0x4000);
+    }
+    for (size_t i = 0; i < STREAM_SAMPLES; i++) {
+        adc[i] = (int16_t)(2048 + 1000 * sin(i * 0.3) + (rand() & 0xFF));
+    }
+
+    ESP_LOGI(TAG, "   len    cycles/FFT  cycles/(N log2 N)   SNR dB   stream cycles/sample");
+    for (size_t len = MIN_LEN; len <= MAX_LEN; len *= 2) {
+        const size_t reps = POINTS_PER_RUN / len;
+
+        // Copy in isn't free, so time it on its own and take it back out
+        uint64_t start = cycles();
+        for (size_t r = 0; r < reps; r++) {
+            for (size_t i = 0; i < len; i++) {
+                work[i] = input[i];
+            }
+            __asm__ volatile("" ::: "memory");
+        }
+        uint64_t copy = cycles() - start;
+
+        start = cycles();
+        for (size_t r = 0; r < reps; r++) {
+            for (size_t i = 0; i < len; i++) {
+                work[i] = input[i];
+            }
+            spectrum_fft_q15(work, len);
+            __asm__ volatile("" ::: "memory");
+        }
+        double per_fft = (cycles() - start - copy) / (double)reps;
+
+        for (size_t i = 0; i < len; i++) {
+            work[i] = input[i];
+        }
+        spectrum_fft_q15(work, len);
+
+        ESP_LOGI(TAG, "%6zu %13.0f %18.2f %8.1f %22.1f", len, per_fft,
+                 per_fft / (len * (double)__builtin_ctz(len)), snr_db(input, work, len), stream_cycles(len));
+        vTaskDelay(1);     // Let the idle task run so the watchdog stays quiet on hardware
+    }
+}
@@ -0,0 +1,195 @@
+/**
+ * Write bandwidth, recovery time and time-range query latency of the Flash-Log sample log.
+ *
+ * The log is formatted, then NUM_CHANNELS channels at RATE_HZ are appended in FRAME_LEN scan
+ * blocks as fast as the writer takes them, for LAPS times round the partition so every sector
+ * gets erased and written over. Timestamps are made up from the scan index rather than taken,
+ * so the run covers minutes of log in seconds. Reported:
+ *  - sustained write bandwidth, and the mean and worst time to write a record (the worst
+ *    includes a sector erase)
+ *  - how long open takes to find the head again after a close, and whether the sequence
+ *    numbers carry on where they stopped
+ *  - a walk of the whole log: records, time order and every sample checked against what was
+ *    appended
+ *  - latency to find and read 1 s, 10 s and 60 s windows at random points in the log
+ *
+ * On the linux target the partition is ESP-IDF's host partition emulation, so the numbers
+ * only mean something on hardware, with the partitions.csv of this project flashed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "flash_log.h"
+
+
+#define NUM_CHANNELS 4
+#define RATE_HZ 1000
+#define FRAME_LEN 20
+#define LAPS 5 / 4
+#define QUERIES 50
+#define SCANS_PER_RECORD ((CONFIG_FLASH_LOG_RECORD_SIZE - FLASH_LOG_HEADER_LEN) / (NUM_CHANNELS * sizeof(int16_t)))
+
+static const char* TAG = "bench";
+
+static int16_t block[NUM_CHANNELS][FRAME_LEN];
+static volatile int32_t sink;
+
+
+// Sample of channel ch at scan i, so a read can be checked without keeping what was written
+static inline int16_t expected(uint64_t i, size_t ch) {
+    return (int16_t)((i * 7 + ch * 1000) & 0xFFF);
+}
+
+static int64_t scan_us(uint64_t i) {
+    return (int64_t)(i * 1000000 / RATE_HZ);
+}
+
+static void write_log(uint64_t* scans_out) {
+    const int16_t* channels[NUM_CHANNELS];
+    flash_log_stats_t stats;
+    flash_log_get_stats(&stats);
+    const uint32_t records = stats.num_slots * LAPS;
+    uint64_t scan = 0;
+
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        channels[ch] = block[ch];
+    }
+    int64_t start = esp_timer_get_time();
+    while (stats.records < records) {
+        // Full speed means as fast as the writer goes, not dropping: keep one buffer free for
+        // the record being filled
+        while ((uint32_t)(scan / SCANS_PER_RECORD) - stats.records >= FLASH_LOG_DEFAULT_BUFFERS - 1) {
+            vTaskDelay(1);
+            flash_log_get_stats(&stats);
+        }
+        for (size_t i = 0; i < FRAME_LEN; i++) {
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                block[ch][i] = expected(scan + i, ch);
+            }
+        }
+        ESP_ERROR_CHECK(flash_log_append(scan_us(scan), RATE_HZ, channels, NUM_CHANNELS, FRAME_LEN));
+        scan += FRAME_LEN;
+        flash_log_get_stats(&stats);
+    }
+    // And the last, part full record
+    flash_log_flush();
+    const uint32_t filled = (uint32_t)((scan + SCANS_PER_RECORD - 1) / SCANS_PER_RECORD);
+    while (stats.records < filled) {
+        vTaskDelay(1);
+        flash_log_get_stats(&stats);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "Wrote %" PRIu32 " records, %" PRIu32 " KB in %" PRId64 " ms: %.1f KB/s, %.0f scans/s",
+             stats.records, stats.bytes / 1024, elapsed / 1000, stats.bytes * 1e6 / 1024.0 / elapsed, scan * 1e6 / elapsed);
+    ESP_LOGI(TAG, "Per record %.0f us mean, %" PRId64 " us max, %" PRIu32 " sector erases, %" PRIu32 " dropped scans, %" PRIu32 " errors",
+             (double)stats.write_us / stats.records, stats.max_write_us, stats.erases, stats.dropped_scans, stats.write_errors);
+    *scans_out = scan;
+}
+
+static void reopen(void) {
+    flash_log_stats_t stats;
+    flash_log_get_stats(&stats);
+    const uint32_t next_seq = stats.next_seq;
+    ESP_ERROR_CHECK(flash_log_close());
+
+    const flash_log_config_t config = {.task_priority = 5};
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(flash_log_open(&config));
+    int64_t elapsed = esp_timer_get_time() - start;
+    flash_log_get_stats(&stats);
+    ESP_LOGI(TAG, "Reopened in %" PRId64 " us, next seq %" PRIu32 " (was %" PRIu32 ") %s",
+             elapsed, stats.next_seq, next_seq, stats.next_seq == next_seq ? "ok" : "MISMATCH");
+}
+
+// Every record oldest first. Returns the log time the oldest record starts at
+static int64_t walk(uint64_t scans) {
+    flash_log_cursor_t cursor;
+    flash_log_record_t rec;
+    uint32_t records = 0;
+    uint32_t mismatches = 0;
+    int64_t first_us = 0;
+    int64_t last_us = INT64_MIN;
+
+    int64_t start = esp_timer_get_time();
+    flash_log_find(INT64_MIN, &cursor);
+    while (flash_log_next(&cursor, &rec)) {
+        if (records++ == 0) {
+            first_us = rec.timestamp_us;
+        }
+        if (rec.timestamp_us <= last_us) {
+            mismatches++;
+        }
+        last_us = rec.timestamp_us;
+        const uint64_t first_scan = (uint64_t)rec.timestamp_us * RATE_HZ / 1000000;
+        for (size_t i = 0; i < rec.scans; i++) {
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                if (rec.samples[i * NUM_CHANNELS + ch] != expected(first_scan + i, ch)) {
+                    mismatches++;
+                }
+            }
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "Walked %" PRIu32 " records in %" PRId64 " us, %.1f s of log up to scan %" PRIu64 " %s",
+             records, elapsed, (scan_us(scans) - first_us) / 1e6, scans, mismatches ? "MISMATCH" : "ok");
+    return first_us;
+}
+
+static void query(int64_t oldest_us, int64_t newest_us, int64_t window_us) {
+    int64_t find_us = 0;
+    int64_t total_us = 0;
+    uint64_t scans = 0;
+    int32_t sum = 0;
+
+    srand(1);
+    for (int q = 0; q < QUERIES; q++) {
+        const int64_t from = oldest_us + (int64_t)((double)rand() / RAND_MAX * (newest_us - oldest_us - window_us));
+        const int64_t to = from + window_us;
+        flash_log_cursor_t cursor;
+        flash_log_record_t rec;
+
+        int64_t start = esp_timer_get_time();
+        flash_log_find(from, &cursor);
+        find_us += esp_timer_get_time() - start;
+        while (flash_log_next(&cursor, &rec) && rec.timestamp_us < to) {
+            // Touch every sample so the read through the mapping is counted
+            for (size_t i = 0; i < (size_t)rec.scans * rec.num_channels; i++) {
+                sum += rec.samples[i];
+            }
+            scans += rec.scans;
+        }
+        total_us += esp_timer_get_time() - start;
+    }
+    sink = sum;
+    ESP_LOGI(TAG, "%3" PRId64 " s window: find %6.1f us, find + read %8.1f us, %6" PRIu64 " scans",
+             window_us / 1000000, (double)find_us / QUERIES, (double)total_us / QUERIES, scans / QUERIES);
+}
+
+void app_main(void) {
+    const flash_log_config_t config = {
+        .partition_label = NULL,
+        .num_buffers = FLASH_LOG_DEFAULT_BUFFERS,
+        .format = true,
+        .task_priority = 5,
+    };
+    uint64_t scans;
+
+    ESP_LOGI(TAG, "%d channels at %d Hz, %d byte records of %d scans", NUM_CHANNELS, RATE_HZ,
+             CONFIG_FLASH_LOG_RECORD_SIZE, (int)SCANS_PER_RECORD);
+    ESP_ERROR_CHECK(flash_log_open(&config));
+    write_log(&scans);
+    reopen();
+
+    const int64_t oldest_us = walk(scans);
+    const int64_t newest_us = scan_us(scans);
+    query(oldest_us, newest_us, 1000000);
+    query(oldest_us, newest_us, 10000000);
+    query(oldest_us, newest_us, 60000000);
+    ESP_ERROR_CHECK(flash_log_close());
+}
@@ -0,0 +1,144 @@
+/**
+ * Compression ratio and speed of the Sample-History store.
+ *
+ * Each signal is pushed through a history in FRAME_LEN blocks, like the pipeline does, then
+ * every segment still held is decoded and checked against the original. Reported per signal:
+ *  - bits per sample and ratio against raw int16, arena bytes only (the index adds
+ *    sizeof(sample_history_entry_t) per segment on top)
+ *  - which codec the segments picked
+ *  - encode and decode speed in Msamples/s
+ *  - how many seconds of one channel at 1 kHz a 16 KB history holds at that ratio
+ *
+ * Signals:
+ *  - mock: what the ADC-Sampler mock backend makes, a 5 Hz sine plus +/-8 codes of noise
+ *  - quiet: a flat input with the same noise, the common case on a real board
+ *  - steps: a square wave between two levels, long flat runs with big jumps
+ *  - replay: real samples, if HISTORY_REPLAY_CSV names a raw CSV from
+ *    telemetry_decode.py --raw (the last column of each row is the sample)
+ *
+ * Meant for the linux target (idf.py --preview set-target linux).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sample_history.h"
+#include "9b-pipeline.h"
+
+
+#define SIGNAL_LEN (1 << 20)
+#define ARENA_BYTES (SIGNAL_LEN * 3)  // Bigger than any signal even at 17 bits a sample, so every sample is checked
+#define REPORT_ARENA_BYTES (16 * 1024)
+#define DECODE_PASSES 4
+
+static const char* TAG = "bench";
+
+static int16_t signal[SIGNAL_LEN];
+static int16_t decoded[HISTORY_SEGMENT_LEN];
+
+
+static uint32_t noise(void) {
+    static uint32_t state = 1;
+    state = state * 1103515245u + 12345u;
+    return (state >> 24) & 0xF;
+}
+
+static size_t make_signal(int kind) {
+    for (size_t i = 0; i < SIGNAL_LEN; i++) {
+        int v = 2048;
+        if (kind == 0) {
+            v += (int)(1500.0f * sinf(2.0f * (float)M_PI * 5.0f * i / 1000.0f));
+        }
+        else if (kind == 2) {
+            v = ((i / 500) & 1) ? 3500 : 600;
+        }
+        signal[i] = (int16_t)(v + (int)noise() - 8);
+    }
+    return SIGNAL_LEN;
+}
+
+// Last column of each row. Returns how many samples were read
+static size_t load_replay(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Can't open %s", path);
+        return 0;
+    }
+    char line[128];
+    size_t n = 0;
+    while (n < SIGNAL_LEN && fgets(line, sizeof(line), f) != NULL) {
+        const char* last = strrchr(line, ',');
+        char* end;
+        long v = strtol(last != NULL ? last + 1 : line, &end, 10);
+        if (end != (last != NULL ? last + 1 : line)) {
+            signal[n++] = (int16_t)v;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static void bench(const char* name, size_t len) {
+    sample_history_t h = {0};
+    sample_history_stats_t stats;
+    ESP_ERROR_CHECK(sample_history_init(&h, ARENA_BYTES, 0, HISTORY_SEGMENT_LEN));
+
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < len; i += FRAME_LEN) {
+        size_t n = (len - i < FRAME_LEN) ? len - i : FRAME_LEN;
+        sample_history_push(&h, (int64_t)i * 1000, 1000, &signal[i], n);
+    }
+    sample_history_flush(&h);
+    int64_t encode_us = esp_timer_get_time() - start;
+    sample_history_get_stats(&h, &stats);
+
+    // Newest segment last, so walk back from the end of the signal
+    uint32_t mismatches = 0;
+    size_t end = len;
+    for (uint32_t id = sample_history_end(&h); id-- > sample_history_first(&h);) {
+        sample_history_info_t info;
+        sample_history_read(&h, id, decoded, &info);
+        end -= info.count;
+        if (memcmp(decoded, &signal[end], info.count * sizeof(int16_t)) != 0) {
+            mismatches++;
+        }
+    }
+
+    start = esp_timer_get_time();
+    for (int pass = 0; pass < DECODE_PASSES; pass++) {
+        for (uint32_t id = sample_history_first(&h); id != sample_history_end(&h); id++) {
+            sample_history_read(&h, id, decoded, NULL);
+        }
+    }
+    int64_t decode_us = esp_timer_get_time() - start;
+
+    double bits = stats.bytes * 8.0 / stats.samples;
+    ESP_LOGI(TAG, "%-8s %8" PRIu32 " %6.2f %6.2f %6" PRIu32 " %6" PRIu32 " %8.1f %8.1f %8.0f  %s",
+             name, stats.samples, bits, 16.0 / bits, stats.rice_segments, stats.varint_segments,
+             (double)stats.samples / encode_us, (double)stats.samples * DECODE_PASSES / decode_us,
+             REPORT_ARENA_BYTES * 8.0 / bits / 1000.0, mismatches ? "MISMATCH" : "ok");
+    sample_history_free(&h);
+}
+
+void app_main(void) {
+    static const char* names[] = {"mock", "quiet", "steps"};
+
+    ESP_LOGI(TAG, "%d sample segments, pushed %d at a time", HISTORY_SEGMENT_LEN, FRAME_LEN);
+    ESP_LOGI(TAG, "signal    samples  bits  ratio   rice varint  enc MS/s dec MS/s  s/16KB@1kHz");
+    for (int kind = 0; kind < 3; kind++) {
+        bench(names[kind], make_signal(kind));
+    }
+
+    const char* replay = getenv("HISTORY_REPLAY_CSV");
+    if (replay != NULL) {
+        size_t len = load_replay(replay);
+        if (len > 0) {
+            bench("replay", len);
+        }
+    }
+}
@@ -0,0 +1,95 @@
+/**
+ * Microbenchmark for the Block-Kernels reductions against the original averaging loop
+ * (int samples converted to float one at a time).
+ *
+ * Reports cycles per sample for block sizes 10 to 4096. On the linux target the cycle count
+ * comes from the x86 TSC, on hardware from the CPU cycle counter.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "block_kernels.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "Only the x86 TSC is wired up as a cycle counter for the linux target"
+#endif
+#include <x86intrin.h>
+static inline uint64_t cycles(void) { return __rdtsc(); }
+#else
+#include "esp_cpu.h"
+static inline uint64_t cycles(void) { return esp_cpu_get_cycle_count(); }
+#endif
+
+#define MAX_BLOCK 4096
+#define SAMPLES_PER_RUN (1 << 20)   // Each size runs enough reps to cover this many samples
+
+static const char* TAG = "bench";
+static const size_t block_sizes[] = {10, 64, 256, 1024, 4096};
+
+static int int_block[MAX_BLOCK];
+static int16_t block[MAX_BLOCK];
+static int16_t mv_block[MAX_BLOCK];
+// Results go here so the compiler can't throw the work away
+static volatile float sink_f;
+static volatile int64_t sink_i;
+
+
+// The averaging loop from the original calc_avg_task
+static float float_average(const int* buf, size_t n) {
+    float avg = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        avg += (float)buf[i];
+    }
+    return avg / n;
+}
+
+void app_main(void) {
+    for (size_t i = 0; i < MAX_BLOCK; i++) {
+        int_block[i] = rand() & 0xFFF;
+        block[i] = (int16_t)int_block[i];
+    }
+    const int32_t scale = BLOCK_MV_SCALE_Q16(3100, 4095);
+
+    ESP_LOGI(TAG, "cycles/sample:   block   float avg      sum   sum_sq   minmax   to_mV");
+    for (size_t b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++) {
+        size_t n = block_sizes[b];
+        size_t reps = SAMPLES_PER_RUN / n;
+        double total = (double)reps * n;
+        int16_t lo, hi;
+        uint64_t t0, t1, t2, t3, t4, t5;
+
+        t0 = cycles();
+        for (size_t r = 0; r < reps; r++) {
+            sink_f = float_average(int_block, n);
+        }
+        t1 = cycles();
+        for (size_t r = 0; r < reps; r++) {
+            sink_i = block_sum_i16(block, n);
+        }
+        t2 = cycles();
+        for (size_t r = 0; r < reps; r++) {
+            sink_i = block_sum_sq_i16(block, n);
+        }
+        t3 = cycles();
+        for (size_t r = 0; r < reps; r++) {
+            block_minmax_i16(block, n, &lo, &hi);
+            sink_i = lo + hi;
+        }
+        t4 = cycles();
+        for (size_t r = 0; r < reps; r++) {
+            block_scale_to_mv_i16(block, mv_block, n, scale, 0);
+            sink_i = mv_block[0];
+        }
+        t5 = cycles();
+
+        ESP_LOGI(TAG, "               %6zu   %9.2f %8.2f %8.2f %8.2f %7.2f", n,
+                 (t1 - t0) / total, (t2 - t1) / total, (t3 - t2) / total, (t4 - t3) / total, (t5 - t4) / total);
+        // Let the idle task run between sizes
+        vTaskDelay(1);
+    }
+}
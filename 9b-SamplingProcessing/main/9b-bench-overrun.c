@@ -0,0 +1,127 @@
+/**
+ * Overrun policy comparison for the ADC-Sampler frame pool under consumer stalls.
+ *
+ * A consumer task acquires frames and releases them straight away, except that every
+ * STALL_EVERY_MS it sits on a frame for STALL_MS, far longer than the pool can cover. For each
+ * overrun policy it reports
+ *  - what happened to the frames sampled during the stalls (dropped / overwritten / spares used)
+ *  - the sequence gaps the consumer saw
+ *  - sampling jitter: how far each frame's timestamp strays from start + seq * frame period. The
+ *    sampler never waits for the consumer, so this should stay the same whatever the stalls do
+ *  - max age of a frame when the consumer got it. Overwrite oldest keeps this low after a stall,
+ *    the other two hand over the backlog first
+ *
+ * Meant for the linux target with the mock backend, but runs the same on hardware.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "ADC-sampler.h"
+
+
+#define RATE_HZ 2000
+#define FRAME_LEN 20
+#define NUM_FRAMES 3
+#define RUN_MS 3000
+#define STALL_EVERY_MS 500
+#define STALL_MS 50
+
+static const char* TAG = "bench";
+static const char* policy_names[] = {"drop newest", "overwrite oldest", "spare pool"};
+
+static TaskHandle_t main_task_handle = NULL;
+static volatile bool running;
+
+static uint32_t acquired;
+static uint32_t seq_gaps;
+static int64_t max_jitter_us;
+static int64_t max_age_us;
+
+
+void consumer_task(void* param) {
+    const int64_t period_us = (int64_t)FRAME_LEN * 1000000 / RATE_HZ;
+    int64_t first_us = 0;
+    uint32_t first_seq = 0;
+    uint32_t next_seq = 0;
+    int64_t next_stall = esp_timer_get_time() + STALL_EVERY_MS * 1000;
+
+    while (running) {
+        const ADC_sampler_frame_t* frame = ADC_sampler_acquire(pdMS_TO_TICKS(10));
+        if (frame == NULL) {
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+
+        if (acquired == 0) {
+            first_us = frame->timestamp_us;
+            first_seq = frame->seq;
+        }
+        else {
+            if (frame->seq != next_seq) {
+                seq_gaps++;
+            }
+            int64_t jitter = llabs(frame->timestamp_us - (first_us + (int64_t)(frame->seq - first_seq) * period_us));
+            if (jitter > max_jitter_us) {
+                max_jitter_us = jitter;
+            }
+        }
+        if (now - frame->timestamp_us > max_age_us) {
+            max_age_us = now - frame->timestamp_us;
+        }
+        next_seq = frame->seq + 1;
+        acquired++;
+
+        if (now >= next_stall) {
+            vTaskDelay(pdMS_TO_TICKS(STALL_MS));
+            next_stall = esp_timer_get_time() + STALL_EVERY_MS * 1000;
+        }
+        ADC_sampler_release(frame);
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+void app_main(void) {
+    main_task_handle = xTaskGetCurrentTaskHandle();
+
+    ESP_LOGI(TAG, "%d Hz, %d samples/frame, %d frames, %d ms stall every %d ms",
+             RATE_HZ, FRAME_LEN, NUM_FRAMES, STALL_MS, STALL_EVERY_MS);
+    ESP_LOGI(TAG, "          policy    frames  acquired   dropped  overwrit    spares      gaps  jitter max   age max");
+    for (int p = ADC_SAMPLER_OVERRUN_DROP_NEWEST; p <= ADC_SAMPLER_OVERRUN_SPARE_POOL; p++) {
+        ADC_sampler_config_t config = {
+            .sample_rate_hz = RATE_HZ,
+            .frame_len = FRAME_LEN,
+            .num_frames = NUM_FRAMES,
+            .overrun_policy = (ADC_sampler_overrun_policy_t)p,
+            .channels = {0},
+            .num_channels = 1,
+            .on_frame = NULL,
+            .task_priority = 5,
+        };
+        ESP_ERROR_CHECK(ADC_sampler_config(&config));
+
+        acquired = 0;
+        seq_gaps = 0;
+        max_jitter_us = 0;
+        max_age_us = 0;
+        running = true;
+        xTaskCreate(consumer_task, "consumer", 4096, NULL, 4, NULL);
+        ESP_ERROR_CHECK(ADC_sampler_start());
+        vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+        ESP_ERROR_CHECK(ADC_sampler_stop());
+        running = false;
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        ADC_sampler_stats_t stats;
+        ADC_sampler_get_stats(&stats);
+        ESP_ERROR_CHECK(ADC_sampler_deinit());
+
+        ESP_LOGI(TAG, "%16s %9" PRIu32 " %9" PRIu32 " %9" PRIu32 " %9" PRIu32 " %9" PRIu32 " %9" PRIu32 " %9" PRId64 "us %7" PRId64 "us",
+                 policy_names[p], stats.frames, acquired, stats.dropped_frames, stats.overwritten_frames,
+                 stats.spare_frames_used, seq_gaps, max_jitter_us, max_age_us);
+    }
+}
@@ -0,0 +1,56 @@
+/**
+ * Sample-rate scaling stress test for the 9b pipeline.
+ *
+ * Runs the real pipeline (9b-pipeline.c) against the ADC-Sampler mock on the linux target and
+ * sweeps the scan rate from 10 Hz up to tens of kHz. For each rate it reports dropped samples,
+ * frame backlog, frame-ready to average-published latency, how much of the wall time the
+ * sampler and averager spent busy, and the 99th percentile and max of the sampling jitter.
+ * Where drops or backlog start climbing is where the pipeline saturates; where jitter starts
+ * climbing is where timing accuracy goes.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "9b-pipeline.h"
+
+
+#define RUN_MS 3000
+
+static const char* TAG = "bench";
+static latency_hist_t jitter;
+static const uint32_t rates_hz[] = {10, 100, 1000, 2000, 5000, 10000, 20000, 50000};
+
+
+void app_main(void) {
+    ESP_LOGI(TAG, "    rate   samples  dropped  overrun  backlog  lat avg  lat max   sampler  averager  jit p99  jit max");
+    for (size_t r = 0; r < sizeof(rates_hz) / sizeof(rates_hz[0]); r++) {
+        pipeline_config_t config = {
+            .sample_rate_hz = rates_hz[r],
+            .log_results = false,
+        };
+
+        int64_t start = esp_timer_get_time();
+        if (pipeline_start(&config) != ESP_OK) {
+            ESP_LOGE(TAG, "%" PRIu32 " Hz: pipeline didn't start", rates_hz[r]);
+            pipeline_stop();
+            continue;
+        }
+        vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+        pipeline_get_timing(&jitter, NULL);
+        pipeline_stop();
+        double elapsed_us = (double)(esp_timer_get_time() - start);
+
+        pipeline_metrics_t m;
+        pipeline_get_metrics(&m);
+        uint32_t samples = m.blocks * FRAME_LEN * NUM_CHANNELS;
+        double lat_avg = m.blocks ? (double)m.latency_sum_us / m.blocks : 0.0;
+
+        ESP_LOGI(TAG, "%8" PRIu32 " %9" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %6.0fus %6" PRId64 "us %8.1f%% %8.1f%% %6" PRIu32 "us %6" PRIu32 "us",
+                 rates_hz[r], samples, m.dropped_samples, m.sampler_overruns, m.max_frame_backlog,
+                 lat_avg, m.latency_max_us, 100.0 * m.sampler_busy_us / elapsed_us, 100.0 * m.avg_busy_us / elapsed_us,
+                 latency_hist_percentile(&jitter, 0.99f), latency_hist_max(&jitter));
+    }
+}
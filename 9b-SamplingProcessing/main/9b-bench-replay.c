@@ -0,0 +1,207 @@
+/**
+ * Pipeline throughput and golden output checks off a capture file, through the ADC-Sampler
+ * replay backend (select ADC Sampler -> Sampling backend -> Replay in menuconfig).
+ *
+ * The capture is REPLAY_CAPTURE if set (CSV, one scan per line, or raw int16 scans of
+ * NUM_CHANNELS), otherwise a synthetic one is written to replay-capture.bin: a sine, a square
+ * wave, a ramp and a flat line, each with a little noise.
+ *  - fast: the whole file through the pipeline as fast as the averager takes it. Reports
+ *    scans/s and how many times real time that is at RATE_HZ
+ *  - repeat: the same again, which has to give bit-identical results
+ *  - golden: the results are compared bit for bit against REPLAY_GOLDEN (default
+ *    replay-golden.bin). If there's no golden file yet this run's results are written to it,
+ *    so check a known-good build in first and rerun after changes
+ *  - real time: REALTIME_MS of the file at RATE_HZ, to see the pipeline keep up the way it would
+ *    on the ADC. Its results have to match the start of the fast run's unless frames were lost
+ * A result is each published pipeline_avg_t minus its timestamp, which depends on the pace.
+ *
+ * Meant for the linux target.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "ADC-sampler.h"
+#include "9b-pipeline.h"
+
+
+#define RATE_HZ 2000
+#define SYNTH_SCANS (1 << 20)
+#define REALTIME_MS 3000
+#define POLL_MS 10
+
+static const char* TAG = "bench";
+
+// What's compared: everything published except the time
+typedef struct {
+    uint32_t sample_count;
+    float avg[NUM_CHANNELS];
+} result_t;
+
+static result_t* results;
+static size_t num_results;
+static size_t max_results;
+
+
+static void on_result(const pipeline_avg_t* avg, void* ctx) {
+    if (num_results < max_results) {
+        result_t* r = &results[num_results];
+        r->sample_count = avg->sample_count;
+        memcpy(r->avg, avg->avg, sizeof(r->avg));
+    }
+    num_results++;
+}
+
+static uint32_t noise(void) {
+    static uint32_t state = 1;
+    state = state * 1103515245u + 12345u;
+    return (state >> 24) & 0xF;
+}
+
+static bool write_synthetic(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < SYNTH_SCANS; i++) {
+        int16_t scan[NUM_CHANNELS] = {
+            (int16_t)(2048 + 1500.0f * sinf(2.0f * (float)M_PI * 5.0f * i / RATE_HZ)),
+            (int16_t)(((i / 300) & 1) ? 3500 : 600),
+            (int16_t)(i % 4096),
+            2048,
+        };
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            scan[ch] += (int16_t)noise() - 8;
+        }
+        fwrite(scan, sizeof(scan), 1, f);
+    }
+    fclose(f);
+    return true;
+}
+
+// Run the pipeline over the capture until it runs out, or for max_ms. Returns how long it took
+static int64_t run(const char* path, bool fast, int64_t max_ms, pipeline_metrics_t* metrics) {
+    pipeline_config_t config = {
+        .sample_rate_hz = RATE_HZ,
+        .on_result = on_result,
+        .replay_path = path,
+        .replay_fast = fast,
+    };
+    num_results = 0;
+
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(pipeline_start(&config));
+    // Done once the file's out and the averager has had every frame
+    ADC_sampler_stats_t stats;
+    do {
+        vTaskDelay(pdMS_TO_TICKS(POLL_MS));
+        ADC_sampler_get_stats(&stats);
+        pipeline_get_metrics(metrics);
+    } while (!(ADC_sampler_done() && metrics->blocks == stats.frames) &&
+             (max_ms == 0 || esp_timer_get_time() - start < max_ms * 1000));
+    int64_t elapsed = esp_timer_get_time() - start;
+    pipeline_stop();
+    return elapsed;
+}
+
+// Index of the first result that differs, or n if they're all the same
+static size_t first_mismatch(const result_t* a, const result_t* b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (memcmp(&a[i], &b[i], sizeof(result_t)) != 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static void check_golden(const char* path, const result_t* fast, size_t n) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        f = fopen(path, "wb");
+        if (f == NULL || fwrite(fast, sizeof(result_t), n, f) != n) {
+            ESP_LOGE(TAG, "Can't write %s", path);
+        }
+        else {
+            ESP_LOGI(TAG, "golden:    no %s yet, recorded %d results", path, (int)n);
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        return;
+    }
+
+    result_t* golden = malloc(n * sizeof(result_t));
+    size_t golden_n = fread(golden, sizeof(result_t), n, f);
+    bool longer = (fgetc(f) != EOF);
+    fclose(f);
+    size_t bad = first_mismatch(fast, golden, golden_n);
+    if (bad < golden_n) {
+        ESP_LOGE(TAG, "golden:    MISMATCH at result %d: ch0 %.9g vs %.9g, count %" PRIu32 " vs %" PRIu32,
+                 (int)bad, fast[bad].avg[0], golden[bad].avg[0], fast[bad].sample_count, golden[bad].sample_count);
+    }
+    else if (golden_n != n || longer) {
+        ESP_LOGE(TAG, "golden:    MISMATCH, %d results vs %s%d in %s", (int)n, longer ? "over " : "", (int)golden_n, path);
+    }
+    else {
+        ESP_LOGI(TAG, "golden:    %d results bit-exact against %s", (int)n, path);
+    }
+    free(golden);
+}
+
+void app_main(void) {
+    const char* capture = getenv("REPLAY_CAPTURE");
+    const char* golden = getenv("REPLAY_GOLDEN");
+    if (capture == NULL) {
+        capture = "replay-capture.bin";
+        if (!write_synthetic(capture)) {
+            ESP_LOGE(TAG, "Can't write %s", capture);
+            return;
+        }
+    }
+    if (golden == NULL) {
+        golden = "replay-golden.bin";
+    }
+
+    // Plenty for a couple of million scans
+    max_results = 1 << 18;
+    results = malloc(max_results * sizeof(result_t));
+    result_t* first = malloc(max_results * sizeof(result_t));
+    if (results == NULL || first == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+        return;
+    }
+
+    pipeline_metrics_t metrics;
+    int64_t us = run(capture, true, 0, &metrics);
+    size_t n = (num_results < max_results) ? num_results : max_results;
+    uint64_t scans = (uint64_t)metrics.blocks * FRAME_LEN;
+    ESP_LOGI(TAG, "%s: %" PRIu64 " scans of %d channels, %d results", capture, scans, NUM_CHANNELS, (int)n);
+    ESP_LOGI(TAG, "fast:      %.3f s, %.0f scans/s, %.1fx real time at %d Hz, %" PRIu32 " dropped samples",
+             us / 1e6, scans * 1e6 / us, (double)scans * 1e6 / RATE_HZ / us, RATE_HZ, metrics.dropped_samples);
+    memcpy(first, results, n * sizeof(result_t));
+
+    run(capture, true, 0, &metrics);
+    size_t bad = first_mismatch(results, first, n);
+    if (num_results != n || bad != n) {
+        ESP_LOGE(TAG, "repeat:    MISMATCH at result %d of %d", (int)bad, (int)n);
+    }
+    else {
+        ESP_LOGI(TAG, "repeat:    %d results bit-exact", (int)n);
+    }
+
+    check_golden(golden, first, n);
+
+    us = run(capture, false, REALTIME_MS, &metrics);
+    size_t realtime_n = (num_results < n) ? num_results : n;
+    bad = first_mismatch(results, first, realtime_n);
+    ESP_LOGI(TAG, "real time: %.3f s, %" PRIu32 " blocks, %" PRIu32 " dropped samples, %" PRIu32 " overruns, latency max %" PRId64 " us, %s",
+             us / 1e6, metrics.blocks, metrics.dropped_samples, metrics.sampler_overruns, metrics.latency_max_us,
+             (bad == realtime_n) ? "matches fast" : (metrics.dropped_samples || metrics.sampler_overruns) ? "differs (lost frames)" : "MISMATCH");
+    free(first);
+    free(results);
+}
@@ -0,0 +1,162 @@
+/**
+ * Throughput benchmark: double buffer + counting semaphores vs. the lock-free sample ring.
+ *
+ * Meant for the linux target (idf.py --preview set-target linux) so it runs without hardware.
+ * A producer task pushes BENCH_SAMPLES fake samples as fast as it can and a higher priority
+ * consumer task averages them in BUF_SIZE blocks, the same way 9b-SamplingProcessing.c does.
+ * Every kernel call either side makes is counted so we can see the per-sample cost.
+ *
+ * The "fast path" count is the calls made for every sample. The "handoff" count is the one
+ * notification per block that tells the consumer a block is ready.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sample_ring.h"
+
+
+#define BUF_SIZE 10
+#define RING_SIZE 32
+#define BENCH_SAMPLES 1000000
+
+static const char* TAG = "bench";
+
+static TaskHandle_t main_task_handle = NULL;
+static TaskHandle_t consumer_handle = NULL;
+static volatile float bench_avg;
+
+// Kernel call counters, split into per-sample calls and per-block handoff calls
+static uint32_t fast_path_calls;
+static uint32_t handoff_calls;
+static uint32_t consumed;
+
+// Old scheme state
+static int16_t buf1[BUF_SIZE];
+static int16_t buf2[BUF_SIZE];
+static SemaphoreHandle_t buf1CntSem = NULL;
+static SemaphoreHandle_t buf2CntSem = NULL;
+
+// New scheme state
+static int16_t ring_storage[RING_SIZE];
+static sample_ring_t ring;
+
+
+static float average(const int16_t* block) {
+    float avg = 0.0;
+    for (size_t i = 0; i < BUF_SIZE; i++) {
+        avg += (float)block[i];
+    }
+    return avg / BUF_SIZE;
+}
+
+// Same buffer switching and semaphore handling as the original ADC_sample_task
+void sem_producer_task(void* param) {
+    int16_t* wBuf = buf1;
+    SemaphoreHandle_t wSem = buf1CntSem;
+    size_t wIdx = 0;
+
+    for (uint32_t n = 0; n < BENCH_SAMPLES; n++) {
+        if (wIdx >= BUF_SIZE) {
+            wBuf = (wBuf == buf1) ? buf2 : buf1;
+            wSem = (wSem == buf1CntSem) ? buf2CntSem : buf1CntSem;
+            wIdx = 0;
+            xTaskNotifyGive(consumer_handle);
+            handoff_calls++;
+        }
+
+        xSemaphoreTake(wSem, portMAX_DELAY);
+        fast_path_calls++;
+        wBuf[wIdx++] = (int16_t)(n & 0xFFF);
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+// Same semaphore handling as the original calc_avg_task
+void sem_consumer_task(void* param) {
+    int16_t* rBuf = buf1;
+    SemaphoreHandle_t rSem = buf1CntSem;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        handoff_calls++;
+
+        bench_avg = average(rBuf);
+        consumed += BUF_SIZE;
+        for (size_t i = 0; i < BUF_SIZE; i++) {
+            xSemaphoreGive(rSem);
+            fast_path_calls++;
+        }
+        rBuf = (rBuf == buf1) ? buf2 : buf1;
+        rSem = (rSem == buf1CntSem) ? buf2CntSem : buf1CntSem;
+    }
+}
+
+void ring_producer_task(void* param) {
+    size_t since_notify = 0;
+
+    for (uint32_t n = 0; n < BENCH_SAMPLES; n++) {
+        // Only retries if the consumer is a whole ring behind, which shouldn't happen
+        // since it runs at a higher priority
+        while (!sample_ring_push(&ring, (int16_t)(n & 0xFFF))) {
+            taskYIELD();
+            fast_path_calls++;
+        }
+
+        if (++since_notify >= BUF_SIZE) {
+            since_notify = 0;
+            xTaskNotifyGive(consumer_handle);
+            handoff_calls++;
+        }
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+void ring_consumer_task(void* param) {
+    int16_t block[BUF_SIZE];
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        handoff_calls++;
+
+        while (sample_ring_count(&ring) >= BUF_SIZE) {
+            sample_ring_pop_block(&ring, block, BUF_SIZE);
+            bench_avg = average(block);
+            consumed += BUF_SIZE;
+        }
+    }
+}
+
+static void run(const char* name, TaskFunction_t producer, TaskFunction_t consumer) {
+    fast_path_calls = 0;
+    handoff_calls = 0;
+    consumed = 0;
+
+    xTaskCreate(consumer, "consumer", 4096, NULL, 3, &consumer_handle);
+    int64_t start = esp_timer_get_time();
+    xTaskCreate(producer, "producer", 4096, NULL, 2, NULL);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    vTaskDelete(consumer_handle);
+
+    ESP_LOGI(TAG, "%s: %" PRIu32 " samples in %" PRId64 " us (%.0f samples/s)",
+             name, consumed, elapsed_us, consumed * 1e6 / (double)elapsed_us);
+    ESP_LOGI(TAG, "%s: fast path %.2f kernel calls/sample, handoff %.2f kernel calls/sample",
+             name, fast_path_calls / (double)BENCH_SAMPLES, handoff_calls / (double)BENCH_SAMPLES);
+}
+
+void app_main(void) {
+    main_task_handle = xTaskGetCurrentTaskHandle();
+
+    buf1CntSem = xSemaphoreCreateCounting(BUF_SIZE, BUF_SIZE);
+    buf2CntSem = xSemaphoreCreateCounting(BUF_SIZE, BUF_SIZE);
+    run("semaphores", sem_producer_task, sem_consumer_task);
+
+    ESP_ERROR_CHECK(sample_ring_init(&ring, ring_storage, RING_SIZE));
+    run("sample ring", ring_producer_task, ring_consumer_task);
+}
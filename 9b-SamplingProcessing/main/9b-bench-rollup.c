@@ -0,0 +1,127 @@
+/**
+ * Window query cost of the Rollup-Stats multi-resolution history vs. rescanning raw samples.
+ *
+ * Two hours of one channel at RATE_HZ (a slow sine plus noise, like the filtered output of the
+ * averager) are pushed through a rollup with the pipeline's levels, in BLOCK_LEN blocks. Then
+ * the last 1 s, 1 min and 1 h are queried at random points through the run, and each answer
+ * is checked against a scan of the raw samples over the span the rollup says it covered.
+ * Reported:
+ *  - push cost per sample
+ *  - per window: the level used, mean query time, and mean time for the raw scan it replaces
+ *
+ * Meant for the linux target (idf.py --preview set-target linux).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "rollup_stats.h"
+
+
+#define RATE_HZ 100
+#define PERIOD_US (1000000 / RATE_HZ)
+#define RUN_S (2 * 3600)
+#define SIGNAL_LEN (RUN_S * RATE_HZ)
+#define BLOCK_LEN 10
+#define QUERIES 200
+
+static const char* TAG = "bench";
+
+// Same as the pipeline's
+static const rollup_level_config_t levels[] = {
+    {.bucket_us = 100000, .len = 20},
+    {.bucket_us = 1000000, .len = 64},
+    {.bucket_us = 60000000, .len = 64},
+};
+
+static int16_t signal[SIGNAL_LEN];
+static volatile int64_t sink;
+
+
+static uint32_t noise(void) {
+    static uint32_t state = 1;
+    state = state * 1103515245u + 12345u;
+    return (state >> 24) & 0xF;
+}
+
+// Stats of the raw samples in [from_us, to_us)
+static void scan(int64_t from_us, int64_t to_us, rollup_stats_result_t* result) {
+    size_t first = (size_t)((from_us + PERIOD_US - 1) / PERIOD_US);
+    size_t end = (size_t)((to_us + PERIOD_US - 1) / PERIOD_US);
+    result->count = 0;
+    result->sum = 0;
+    result->min = INT16_MAX;
+    result->max = INT16_MIN;
+    for (size_t i = first; i < end && i < SIGNAL_LEN; i++) {
+        result->sum += signal[i];
+        result->count++;
+        result->min = (signal[i] < result->min) ? signal[i] : result->min;
+        result->max = (signal[i] > result->max) ? signal[i] : result->max;
+    }
+}
+
+static void bench_window(const int64_t window_us, const char* name) {
+    rollup_stats_t r;
+    rollup_stats_result_t result, expected;
+    int64_t query_us = 0;
+    int64_t scan_us = 0;
+    int64_t bucket_us = 0;
+    uint32_t mismatches = 0;
+    size_t pushed = 0;
+
+    ESP_ERROR_CHECK(rollup_stats_init(&r, levels, sizeof(levels) / sizeof(levels[0])));
+    srand(1);
+    for (int q = 0; q < QUERIES; q++) {
+        // Query points in order, pushing up to each
+        size_t upto = (size_t)(window_us / PERIOD_US) + (size_t)((SIGNAL_LEN - window_us / PERIOD_US) * (q + 1.0) / QUERIES);
+        upto -= upto % BLOCK_LEN;
+        for (; pushed < upto; pushed += BLOCK_LEN) {
+            rollup_stats_push_block(&r, (int64_t)pushed * PERIOD_US, PERIOD_US, &signal[pushed], BLOCK_LEN);
+        }
+
+        int64_t start = esp_timer_get_time();
+        rollup_stats_last(&r, window_us, &result);
+        query_us += esp_timer_get_time() - start;
+        bucket_us = result.bucket_us;
+
+        start = esp_timer_get_time();
+        scan(result.from_us, result.to_us, &expected);
+        scan_us += esp_timer_get_time() - start;
+        sink = expected.sum;
+
+        if (result.count != expected.count || result.sum != expected.sum || result.min != expected.min ||
+            result.max != expected.max) {
+            mismatches++;
+        }
+    }
+    rollup_stats_free(&r);
+
+    ESP_LOGI(TAG, "%-6s %8.1f s buckets %8.2f us %10.2f us  %s", name, bucket_us / 1e6,
+             (double)query_us / QUERIES, (double)scan_us / QUERIES, mismatches ? "MISMATCH" : "ok");
+}
+
+void app_main(void) {
+    for (size_t i = 0; i < SIGNAL_LEN; i++) {
+        signal[i] = (int16_t)(2048 + 1500.0f * sinf(2.0f * (float)M_PI * i / (600.0f * RATE_HZ)) + (int)noise() - 8);
+    }
+
+    rollup_stats_t r;
+    ESP_ERROR_CHECK(rollup_stats_init(&r, levels, sizeof(levels) / sizeof(levels[0])));
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < SIGNAL_LEN; i += BLOCK_LEN) {
+        rollup_stats_push_block(&r, (int64_t)i * PERIOD_US, PERIOD_US, &signal[i], BLOCK_LEN);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    rollup_stats_free(&r);
+
+    ESP_LOGI(TAG, "%d s at %d Hz in %d sample blocks: push %.1f ns/sample", RUN_S, RATE_HZ, BLOCK_LEN,
+             elapsed * 1000.0 / SIGNAL_LEN);
+    ESP_LOGI(TAG, "window    level used      query   raw rescan");
+    bench_window(1000000, "1 s");
+    bench_window(60000000, "1 min");
+    bench_window(3600000000LL, "1 h");
+}
@@ -0,0 +1,159 @@
+/**
+ * Throughput benchmark: publishing the latest averages under a critical section vs. a seqlock.
+ *
+ * A writer task updates a pipeline_avg_t as fast as it can while a reader task copies it out
+ * as fast as it can, for RUN_MS each scheme. The writer is pinned to core 0 and the reader to
+ * core 1 so they really contend for the data (on single core chips like the ESP32-C6 both
+ * end up on core 0 and take turns instead). Every field the writer stores is derived from the
+ * same counter, so the reader can tell if it ever got a torn copy.
+ *
+ * Meant for the linux target (idf.py --preview set-target linux) for a quick check, but the
+ * interesting numbers come from running it on a dual core chip.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "seqlock.h"
+#include "9b-pipeline.h"
+
+
+#define RUN_MS 2000
+#define READ_SPINS 16
+
+static const char* TAG = "bench";
+
+static TaskHandle_t main_task_handle = NULL;
+static volatile bool running;
+
+static pipeline_avg_t shared;
+static portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+static seqlock_t lock = SEQLOCK_INITIALIZER;
+
+static uint32_t writes;
+static uint32_t reads;
+static uint32_t retries;
+static uint32_t torn;
+
+
+static void fill(pipeline_avg_t* avg, uint32_t n) {
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        avg->avg[ch] = (float)n;
+    }
+    avg->timestamp_us = n;
+    avg->sample_count = n;
+}
+
+static bool consistent(const pipeline_avg_t* avg) {
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        if (avg->avg[ch] != (float)avg->sample_count) {
+            return false;
+        }
+    }
+    return avg->timestamp_us == avg->sample_count;
+}
+
+// Counters fit in a float exactly up to 2^24, so keep n below that
+static uint32_t next(uint32_t n) {
+    return (n + 1) & 0xFFFFFF;
+}
+
+void crit_writer_task(void* param) {
+    uint32_t n = 0;
+    while (running) {
+        n = next(n);
+        portENTER_CRITICAL(&spinlock);
+        fill(&shared, n);
+        portEXIT_CRITICAL(&spinlock);
+        writes++;
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+void crit_reader_task(void* param) {
+    pipeline_avg_t copy;
+    while (running) {
+        portENTER_CRITICAL(&spinlock);
+        copy = shared;
+        portEXIT_CRITICAL(&spinlock);
+        if (!consistent(&copy)) {
+            torn++;
+        }
+        reads++;
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+void seq_writer_task(void* param) {
+    uint32_t n = 0;
+    while (running) {
+        n = next(n);
+        seqlock_write_begin(&lock);
+        fill(&shared, n);
+        seqlock_write_end(&lock);
+        writes++;
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+// Same read loop as pipeline_get_avg
+void seq_reader_task(void* param) {
+    pipeline_avg_t copy;
+    while (running) {
+        uint32_t seq;
+        size_t tries = 0;
+        do {
+            if (++tries > READ_SPINS) {
+                vTaskDelay(1);
+            }
+            seq = seqlock_read_begin(&lock);
+            copy = shared;
+        } while (seqlock_read_retry(&lock, seq));
+        retries += tries - 1;
+
+        if (!consistent(&copy)) {
+            torn++;
+        }
+        reads++;
+    }
+    xTaskNotifyGive(main_task_handle);
+    vTaskDelete(NULL);
+}
+
+static void run(const char* name, TaskFunction_t writer, TaskFunction_t reader) {
+    writes = 0;
+    reads = 0;
+    retries = 0;
+    torn = 0;
+    fill(&shared, 0);
+
+    running = true;
+    int64_t start = esp_timer_get_time();
+    xTaskCreatePinnedToCore(writer, "writer", 4096, NULL, 2, NULL, 0);
+    xTaskCreatePinnedToCore(reader, "reader", 4096, NULL, 2, NULL, portNUM_PROCESSORS > 1 ? 1 : 0);
+    vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+    running = false;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int64_t elapsed_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "%s: %.0f writes/s, %.0f reads/s, %.3f retries/read, %" PRIu32 " torn reads",
+             name, writes * 1e6 / (double)elapsed_us, reads * 1e6 / (double)elapsed_us,
+             reads > 0 ? retries / (double)reads : 0.0, torn);
+}
+
+void app_main(void) {
+    main_task_handle = xTaskGetCurrentTaskHandle();
+    // Both tasks sit at priority 2, so stay above them to stop them on time
+    vTaskPrioritySet(NULL, 3);
+
+    ESP_LOGI(TAG, "%d core(s), %d ms per scheme", portNUM_PROCESSORS, RUN_MS);
+    run("critical section", crit_writer_task, crit_reader_task);
+    run("seqlock", seq_writer_task, seq_reader_task);
+}
@@ -0,0 +1,104 @@
+/**
+ * Load shedding vs. random frame loss when the averager can't keep up.
+ *
+ * The pipeline runs at RATE_HZ with on_result standing in for a heavy downstream stage: it
+ * spins for WORK_US per filtered sample averaged. The work is off for the first phase, then
+ * heavy enough to need more CPU than there is, then off again. Run once with load_shedding off
+ * and once with it on. Reported:
+ *  - every SHED_PERIOD: shedding level, load and samples dropped so far (shedding run)
+ *  - every step it took, from pipeline_get_shed_events
+ *  - per phase and run: samples dropped, results published and filtered samples averaged
+ * Without shedding the overload phase loses whole frames wherever the pool happens to run dry.
+ * With it the losses should stop after a step or two and the steps should be undone after
+ * the load goes away.
+ *
+ * Meant for the linux target with the mock backend, but runs the same on hardware.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "9b-pipeline.h"
+
+
+#define RATE_HZ 1000
+#define WORK_US 1500        // Per filtered sample: 1.5 s of work per s at RATE_HZ / DECIM_FILTER_FACTOR = 1000 samples/s
+#define PHASE_MS {2000, 4000, 8000}
+#define REPORT_MS 500
+
+static const char* TAG = "bench";
+static const char* phase_names[] = {"light", "overload", "light"};
+static const char* level_names[] = {"none", "telemetry", "decimate", "rate"};
+
+static volatile bool working;
+static uint32_t last_count;
+
+
+static void on_result(const pipeline_avg_t* avg, void* ctx) {
+    uint32_t samples = avg->sample_count - last_count;
+    last_count = avg->sample_count;
+    if (working) {
+        int64_t until = esp_timer_get_time() + (int64_t)samples * WORK_US;
+        while (esp_timer_get_time() < until) {
+        }
+    }
+}
+
+static void run(bool shedding) {
+    static const int phase_ms[] = PHASE_MS;
+    pipeline_config_t config = {
+        .sample_rate_hz = RATE_HZ,
+        .log_results = false,
+        .on_result = on_result,
+        .load_shedding = shedding,
+    };
+    pipeline_metrics_t metrics;
+    pipeline_metrics_t before = {0};
+    pipeline_avg_t avg;
+    uint32_t samples_before = 0;
+    uint32_t cursor = 0;
+    int64_t start = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Load shedding %s", shedding ? "on" : "off");
+    last_count = 0;
+    working = false;
+    ESP_ERROR_CHECK(pipeline_start(&config));
+    for (int phase = 0; phase < 3; phase++) {
+        working = (phase == 1);
+        for (int ms = 0; ms < phase_ms[phase]; ms += REPORT_MS) {
+            vTaskDelay(pdMS_TO_TICKS(REPORT_MS));
+            if (shedding) {
+                pipeline_get_metrics(&metrics);
+                ESP_LOGI(TAG, "  %6.1f s  %-9s level %-9s load %3" PRIu32 "%%  %7" PRIu32 " dropped",
+                         (esp_timer_get_time() - start) / 1e6, phase_names[phase], level_names[metrics.shed_level],
+                         metrics.load_pct, metrics.dropped_samples);
+            }
+        }
+        pipeline_get_metrics(&metrics);
+        pipeline_get_avg(&avg);
+        ESP_LOGI(TAG, "  %-9s %8" PRIu32 " samples dropped, %6" PRIu32 " results, %7" PRIu32 " filtered samples",
+                 phase_names[phase], metrics.dropped_samples - before.dropped_samples, metrics.blocks - before.blocks,
+                 avg.sample_count - samples_before);
+        before = metrics;
+        samples_before = avg.sample_count;
+    }
+    working = false;
+    ESP_ERROR_CHECK(pipeline_stop());
+
+    pipeline_shed_event_t events[16];
+    size_t n = pipeline_get_shed_events(events, 16, &cursor);
+    for (size_t i = 0; i < n; i++) {
+        ESP_LOGI(TAG, "  step at %6.1f s to %-9s load %3" PRIu32 "%%, backlog %" PRIu32 ", %" PRIu32 " frames lost",
+                 (events[i].timestamp_us - start) / 1e6, level_names[events[i].level], events[i].load_pct,
+                 events[i].max_backlog, events[i].dropped_frames);
+    }
+}
+
+void app_main(void) {
+    ESP_LOGI(TAG, "%d Hz, %d samples/frame, %d us of work per filtered sample while overloaded",
+             RATE_HZ, FRAME_LEN, WORK_US);
+    run(false);
+    run(true);
+}
@@ -0,0 +1,111 @@
+/**
+ * Cost of reporting results: the old ESP_LOGI float text vs. binary telemetry records.
+ *
+ * For BENCH_BLOCKS blocks of NUM_CHANNELS averages it times
+ *  - text: formatting the same "Ch %u average = %f (min %d, max %d, var %f)" lines calc_avg_task
+ *    used to log. Only the formatting is timed; the real ESP_LOGI also takes the log lock and
+ *    waits on the UART, so this is the best case for text
+ *  - avg records: telemetry_send_avg per block
+ *  - raw records: telemetry_send_raw per channel per block of RAW_LEN samples
+ * The telemetry output is a sink that just counts bytes, so nothing is waiting on I/O. If every
+ * batch is tied up the producer yields to the writer and retries, so no record is dropped and
+ * the time includes the writer's share.
+ *
+ * Bytes per block give the most blocks (or raw samples) per second each format could
+ * sustain over a UART at 115200 and 921600 baud (10 bits per byte).
+ *
+ * Meant for the linux target (idf.py --preview set-target linux).
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "telemetry.h"
+#include "9b-pipeline.h"
+
+
+#define BENCH_BLOCKS 20000
+#define RAW_LEN 40
+
+static const char* TAG = "bench";
+
+static volatile size_t sink_bytes;
+
+
+static size_t count_write(const uint8_t* data, size_t len, void* ctx) {
+    sink_bytes += len;
+    return len;
+}
+
+static void report(const char* name, int64_t elapsed_us, uint64_t bytes, uint32_t samples_per_block) {
+    double bytes_per_block = bytes / (double)BENCH_BLOCKS;
+    ESP_LOGI(TAG, "%-12s %7.2f us/block %8.1f bytes/block   max samples/s at 115200: %8.0f  at 921600: %8.0f",
+             name, elapsed_us / (double)BENCH_BLOCKS, bytes_per_block,
+             11520.0 / bytes_per_block * samples_per_block, 92160.0 / bytes_per_block * samples_per_block);
+}
+
+static void bench_text(void) {
+    char line[96];
+    uint64_t bytes = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t b = 0; b < BENCH_BLOCKS; b++) {
+        for (unsigned ch = 0; ch < NUM_CHANNELS; ch++) {
+            // Plus the "I (12345) : " prefix and newline ESP_LOGI adds
+            bytes += 14 + snprintf(line, sizeof(line), "Ch %u average = %f (min %d, max %d, var %f)",
+                                   ch, 2048.0f + b * 0.01f, 2000 + (int)ch, 2100, 12.5f);
+        }
+    }
+    report("text", esp_timer_get_time() - start, bytes, BUF_SIZE);
+}
+
+static void bench_telemetry(bool raw) {
+    static int16_t samples[RAW_LEN];
+    float avg[NUM_CHANNELS];
+    telemetry_stats_t stats;
+
+    telemetry_config_t config = {
+        .batch_size = 1024,
+        .num_batches = 8,
+        .write = count_write,
+        .task_priority = 2,     // Above us, so it never falls behind just for lack of CPU
+    };
+    sink_bytes = 0;
+    ESP_ERROR_CHECK(telemetry_start(&config));
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t b = 0; b < BENCH_BLOCKS; b++) {
+        if (raw) {
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                samples[b % RAW_LEN] = (int16_t)(b & 0xFFF);
+                while (!telemetry_send_raw(start + b, (uint8_t)ch, samples, RAW_LEN)) {
+                    taskYIELD();
+                }
+            }
+        }
+        else {
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                avg[ch] = 2048.0f + b * 0.01f;
+            }
+            while (!telemetry_send_avg(start + b, avg, NUM_CHANNELS)) {
+                taskYIELD();
+            }
+        }
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    telemetry_stop();
+    telemetry_get_stats(&stats);
+
+    report(raw ? "raw records" : "avg records", elapsed_us, sink_bytes, raw ? RAW_LEN : BUF_SIZE);
+    ESP_LOGI(TAG, "%-12s %" PRIu32 " records in %" PRIu32 " writes, producer waited on the writer %" PRIu32 " times",
+             "", stats.records, stats.batches, stats.dropped_records);
+}
+
+void app_main(void) {
+    ESP_LOGI(TAG, "%d blocks of %d channels", BENCH_BLOCKS, NUM_CHANNELS);
+    bench_text();
+    bench_telemetry(false);
+    bench_telemetry(true);
+}
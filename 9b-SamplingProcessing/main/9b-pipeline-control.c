@@ -0,0 +1,366 @@
+/**
+ * The averager's controllers: adaptive rate, load shedding and block size tuning. Each one
+ * measures over its own period and changes the sampler or the filters between frames. Apart
+ * from pipeline_start resetting them and pipeline_get_shed_events, only the averager calls in here.
+ */
+#include <math.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "ADC-sampler.h"
+#include "9b-pipeline-priv.h"
+
+// Adaptive rate thresholds, in filtered ADC codes or mV with calibrate (see pipeline_adapt_rate)
+#define ACTIVE_CODES 24.0f
+#define QUIET_CODES 8.0f
+#define QUIET_HOLD_US 2000000   // How long every channel has to stay quiet before each rate halving
+// Load shedding (see pipeline_shed_control)
+#define SHED_PERIOD_US 500000   // Load and backlog are measured over this long
+#define SHED_HIGH_PCT 85        // Load that counts as overloaded
+#define SHED_LOW_PCT 40         // Load that's low enough to undo a step. Under half of high, so undoing a halving doesn't tip it straight back over
+#define SHED_UP_PERIODS 2       // Overloaded periods in a row before the next step, so a one-off stall doesn't count
+#define SHED_DOWN_PERIODS 4     // Quiet periods in a row before undoing one. Doubles every time an undo is taken back
+#define SHED_MAX_BACKOFF 4
+#define SHED_LOG_LEN 16         // Steps kept for pipeline_get_shed_events
+// Block size tuning (see pipeline_block_control)
+#define TUNE_PERIOD_US 500000   // Overhead and processing time are measured over this long
+#define TUNE_DEFAULT_OVERHEAD_PCT 5
+
+static struct {
+    uint32_t rate_hz;           // Last rate asked of the sampler
+    uint32_t max_hz;            // Adaptive ceiling: config->max_rate_hz, or half that while shedding
+    float last_mean[NUM_CHANNELS];
+    int64_t quiet_since_us;     // Since when every channel has been under QUIET_CODES
+    bool primed;                // last_mean is valid
+} rate_ctl;
+
+// Load shedding state. Only the averager touches it, apart from the event log
+static struct {
+    pipeline_shed_level_t level;
+    int64_t period_start_us;
+    uint32_t idle_start;        // Idle task run time at the start of the period
+    uint32_t total_start;       // Run time counter at the start of the period
+    int64_t busy_start_us;      // Sampler + averager busy time at the start, if there's no idle count
+    uint32_t dropped_start;     // Sampler's dropped + overwritten frames at the start of the period
+    uint32_t max_backlog;       // Most frames waiting in this period
+    uint32_t over_periods;      // Overloaded periods in a row
+    uint32_t quiet_periods;     // Quiet periods in a row
+    uint32_t periods;           // Since start
+    uint32_t last_undo;         // Period of the last step undone, 0 for none since the level was last 0
+    uint32_t backoff;           // How many times SHED_DOWN_PERIODS has doubled
+} shed;
+static struct {
+    pipeline_shed_event_t entries[SHED_LOG_LEN];
+    uint32_t count;             // Steps logged since start. The next goes in entries[count % LEN]
+} shed_log;
+static portMUX_TYPE shed_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Block size tuning state. Averager only
+static struct {
+    size_t len;                 // Block size asked of the sampler
+    int64_t period_start_us;
+    int64_t overhead_sum_us;    // Averager time outside the sample stages this period
+    int64_t latency_sum_us;     // Frame ready -> published this period
+    int64_t deliver_start_us;   // Sampler's deliver_us at the start of the period
+    uint32_t frames;            // Frames averaged this period
+    float overhead_us;          // Per block, from the last period
+    float process_us;           // Frame ready -> published, from the last period
+    bool measured;              // A period has gone by, so the two above are valid
+} tune;
+
+static const pipeline_config_t* config;
+static pipeline_metrics_t* metrics;
+static decim_filter_t* filters;     // One per channel. Shedding changes their factor
+static const char* TAG = "";
+
+
+void pipeline_control_reset(const pipeline_config_t* pipeline_config, pipeline_metrics_t* pipeline_metrics, decim_filter_t* channel_filters) {
+    config = pipeline_config;
+    metrics = pipeline_metrics;
+    filters = channel_filters;
+    memset(&rate_ctl, 0, sizeof(rate_ctl));
+    rate_ctl.rate_hz = config->sample_rate_hz;
+    rate_ctl.max_hz = config->max_rate_hz;
+    memset(&shed, 0, sizeof(shed));
+    memset(&tune, 0, sizeof(tune));
+    tune.len = FRAME_LEN;
+    portENTER_CRITICAL(&shed_lock);
+    shed_log.count = 0;
+    portEXIT_CRITICAL(&shed_lock);
+}
+
+static void set_rate(uint32_t rate) {
+    if (rate != rate_ctl.rate_hz && ADC_sampler_set_rate(rate) == ESP_OK) {
+        rate_ctl.rate_hz = rate;
+    }
+}
+
+// Adaptive rate: a channel's activity is the larger of how far its average moved since the last
+// frame (slope) and its standard deviation over the window. Any channel reaching ACTIVE_CODES
+// sends the rate straight to the ceiling so a transient is caught at full rate. Once every
+// channel has stayed under QUIET_CODES for QUIET_HOLD_US the rate halves, down to the floor.
+// Between the two thresholds it stays put.
+void pipeline_adapt_rate(const window_stats_result_t* result, int64_t now_us) {
+    float activity = 0.0f;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        float slope = fabsf(result[ch].mean - rate_ctl.last_mean[ch]);
+        float spread = sqrtf(result[ch].variance);
+        activity = fmaxf(activity, fmaxf(slope, spread));
+        rate_ctl.last_mean[ch] = result[ch].mean;
+    }
+    if (!rate_ctl.primed) {
+        rate_ctl.primed = true;
+        rate_ctl.quiet_since_us = now_us;
+        return;
+    }
+
+    uint32_t rate = rate_ctl.rate_hz;
+    if (activity >= ACTIVE_CODES) {
+        rate = rate_ctl.max_hz;
+        rate_ctl.quiet_since_us = now_us;
+    }
+    else if (activity >= QUIET_CODES) {
+        rate_ctl.quiet_since_us = now_us;
+    }
+    else if (now_us - rate_ctl.quiet_since_us >= QUIET_HOLD_US) {
+        rate = (rate / 2 > config->min_rate_hz) ? rate / 2 : config->min_rate_hz;
+        rate_ctl.quiet_since_us = now_us;
+    }
+
+    set_rate(rate);
+}
+
+// Load over the period in %, from the idle task's run time if FreeRTOS keeps it. Without run
+// time stats it falls back on the time the sampler and averager say they were busy, which
+// misses everything else on the CPU
+static uint32_t shed_load_pct(int64_t now_us, bool start) {
+    uint32_t pct = 0;
+#if configGENERATE_RUN_TIME_STATS
+    uint32_t idle = (uint32_t)ulTaskGetIdleRunTimeCounter();
+    uint32_t total = (uint32_t)portGET_RUN_TIME_COUNTER_VALUE();
+    if (!start && total != shed.total_start) {
+        uint32_t idle_pct = (uint32_t)((uint64_t)(idle - shed.idle_start) * 100 / (total - shed.total_start));
+        pct = (idle_pct < 100) ? 100 - idle_pct : 0;
+    }
+    shed.idle_start = idle;
+    shed.total_start = total;
+#else
+    ADC_sampler_stats_t stats;
+    ADC_sampler_get_stats(&stats);
+    int64_t busy = stats.busy_us + metrics->avg_busy_us;
+    if (!start && now_us > shed.period_start_us) {
+        pct = (uint32_t)((busy - shed.busy_start_us) * 100 / (now_us - shed.period_start_us));
+        pct = (pct < 100) ? pct : 100;
+    }
+    shed.busy_start_us = busy;
+#endif
+    return pct;
+}
+
+void pipeline_control_begin(int64_t now_us) {
+    shed.period_start_us = now_us;
+    shed_load_pct(now_us, true);
+    tune.period_start_us = now_us;
+}
+
+pipeline_shed_level_t pipeline_shed_level(void) {
+    return shed.level;
+}
+
+void pipeline_shed_backlog(size_t waiting) {
+    if (waiting > shed.max_backlog) {
+        shed.max_backlog = waiting;
+    }
+}
+
+// Put every stage at the given level
+static void shed_apply(pipeline_shed_level_t level) {
+    size_t factor = (level >= PIPELINE_SHED_DECIMATE) ? DECIM_FILTER_SHED_FACTOR : DECIM_FILTER_FACTOR;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        decim_filter_set_factor(&filters[ch], factor);
+    }
+
+    // The continuous backend can't change rate, so there this step sheds nothing more
+    bool slow = (level >= PIPELINE_SHED_RATE);
+    if (config->min_rate_hz != 0) {
+        // Adaptive: lower the ceiling and let adapt_rate come back up to it when needed
+        rate_ctl.max_hz = slow ? config->max_rate_hz / 2 : config->max_rate_hz;
+        if (rate_ctl.max_hz < config->min_rate_hz) {
+            rate_ctl.max_hz = config->min_rate_hz;
+        }
+        if (rate_ctl.rate_hz > rate_ctl.max_hz) {
+            set_rate(rate_ctl.max_hz);
+        }
+    }
+    else {
+        set_rate(slow ? config->sample_rate_hz / 2 : config->sample_rate_hz);
+    }
+    shed.level = level;
+    metrics->shed_level = level;
+}
+
+// Level one step up or down from level. The telemetry step is skipped if there's none to shed
+static pipeline_shed_level_t shed_next(pipeline_shed_level_t level, int dir) {
+    level += dir;
+    if (level == PIPELINE_SHED_TELEMETRY && !config->telemetry_raw && !config->log_results) {
+        level += dir;
+    }
+    return level;
+}
+
+static void shed_step(pipeline_shed_level_t level, int64_t now_us, uint32_t load_pct, uint32_t dropped) {
+    pipeline_shed_event_t event = {
+        .timestamp_us = now_us,
+        .level = level,
+        .load_pct = load_pct,
+        .max_backlog = shed.max_backlog,
+        .dropped_frames = dropped,
+    };
+    shed_apply(level);
+    metrics->shed_steps++;
+
+    portENTER_CRITICAL(&shed_lock);
+    shed_log.entries[shed_log.count % SHED_LOG_LEN] = event;
+    shed_log.count++;
+    portEXIT_CRITICAL(&shed_lock);
+    ESP_LOGW(TAG, "Load %lu%%, backlog %lu, %lu dropped: load shedding level %d", (unsigned long)load_pct,
+             (unsigned long)event.max_backlog, (unsigned long)dropped, (int)level);
+}
+
+// Load shedding, run by the averager once a frame. Every SHED_PERIOD_US it looks at the CPU
+// load and how far behind the averager got. Overloaded (load at SHED_HIGH_PCT, a frame's worth
+// of backlog or any frame dropped) for SHED_UP_PERIODS takes the next step; quiet (load under
+// SHED_LOW_PCT, no backlog, nothing dropped) for the hold time undoes the last one. Anything
+// in between holds the level. A step undone and then taken again straight away means the
+// undo was premature, so the hold time doubles each time that happens, and goes back to
+// SHED_DOWN_PERIODS once everything has been undone and stayed that way.
+void pipeline_shed_control(int64_t now_us) {
+    if (now_us - shed.period_start_us < SHED_PERIOD_US) {
+        return;
+    }
+    ADC_sampler_stats_t stats;
+    ADC_sampler_get_stats(&stats);
+    uint32_t load_pct = shed_load_pct(now_us, false);
+    uint32_t lost = stats.dropped_frames + stats.overwritten_frames;
+    uint32_t dropped = lost - shed.dropped_start;
+    const uint32_t hold = SHED_DOWN_PERIODS << shed.backoff;
+    metrics->load_pct = load_pct;
+    shed.periods++;
+
+    if (load_pct >= SHED_HIGH_PCT || shed.max_backlog >= NUM_FRAMES - 1 || dropped > 0) {
+        shed.quiet_periods = 0;
+        if (++shed.over_periods >= SHED_UP_PERIODS && shed.level < PIPELINE_SHED_RATE) {
+            if (shed.last_undo != 0 && shed.periods - shed.last_undo <= 2 * hold && shed.backoff < SHED_MAX_BACKOFF) {
+                shed.backoff++;
+            }
+            shed_step(shed_next(shed.level, 1), now_us, load_pct, dropped);
+            shed.over_periods = 0;
+        }
+    }
+    else if (load_pct < SHED_LOW_PCT && shed.max_backlog <= 1) {
+        shed.over_periods = 0;
+        if (++shed.quiet_periods >= hold) {
+            if (shed.level > PIPELINE_SHED_NONE) {
+                shed_step(shed_next(shed.level, -1), now_us, load_pct, dropped);
+                shed.last_undo = shed.periods;
+            }
+            else {
+                shed.backoff = 0;
+                shed.last_undo = 0;
+            }
+            shed.quiet_periods = 0;
+        }
+    }
+    else {
+        shed.over_periods = 0;
+        shed.quiet_periods = 0;
+    }
+
+    shed.period_start_us = now_us;
+    shed.dropped_start = lost;
+    shed.max_backlog = 0;
+}
+
+// Smallest block, in raw samples per channel and whole filtered samples, whose overhead stays
+// within the CPU budget at rate, cut down to what still fills and gets published in time
+static size_t block_pick(uint32_t rate) {
+    const size_t step = decim_filter_get_factor(&filters[0]);
+    const size_t max_len = MAX_FRAME_LEN / step * step;
+    const float budget = (config->block_overhead_pct != 0) ? config->block_overhead_pct : TUNE_DEFAULT_OVERHEAD_PCT;
+
+    // overhead_us * rate / len <= budget % of a second
+    float cpu_len = tune.overhead_us * rate / (budget * 10000.0f);
+    // len / rate + process_us <= latency_target_us
+    float late_len = (config->latency_target_us - tune.process_us) * rate / 1000000.0f;
+    size_t len = (cpu_len < max_len) ? (size_t)ceilf(cpu_len / step) * step : max_len;
+    if (late_len < len) {
+        len = (late_len > 0.0f) ? (size_t)(late_len / step) * step : 0;
+    }
+    return (len < step) ? step : (len > max_len) ? max_len : len;
+}
+
+// Block size tuning, run by the averager once a frame. Every TUNE_PERIOD_US it works out what a
+// frame costs on top of its samples: the sampler's time handing it over plus the averager's
+// outside the per-sample stages (filter, spectrum, history...), which is the same whatever the
+// block size. That and the rate give the smallest block within the CPU budget, and the
+// processing time on top of filling it gives the largest that meets the latency target. A rate
+// change re-tunes straight away off the last period's numbers. The block grows as soon as it
+// has to and shrinks when it has to for latency, otherwise only by a quarter or more, so it
+// doesn't hop around on noise.
+void pipeline_block_control(int64_t overhead_us, int64_t latency_us, int64_t now_us, bool rate_changed) {
+    tune.overhead_sum_us += overhead_us;
+    tune.latency_sum_us += latency_us;
+    tune.frames++;
+
+    bool retune = rate_changed;
+    if (now_us - tune.period_start_us >= TUNE_PERIOD_US && tune.frames > 0) {
+        ADC_sampler_stats_t stats;
+        ADC_sampler_get_stats(&stats);
+        tune.overhead_us = (float)(tune.overhead_sum_us + stats.deliver_us - tune.deliver_start_us) / tune.frames;
+        tune.process_us = (float)tune.latency_sum_us / tune.frames;
+        tune.measured = true;
+        tune.period_start_us = now_us;
+        tune.overhead_sum_us = 0;
+        tune.latency_sum_us = 0;
+        tune.deliver_start_us = stats.deliver_us;
+        tune.frames = 0;
+        retune = true;
+    }
+    if (!retune || !tune.measured) {
+        return;
+    }
+
+    const uint32_t rate = metrics->sample_rate_hz;
+    size_t len = block_pick(rate);
+    bool late = (float)tune.len * 1000000.0f / rate + tune.process_us > config->latency_target_us;
+    if (len != tune.len && (len > tune.len || late || len * 4 <= tune.len * 3) &&
+        ADC_sampler_set_frame_len(len) == ESP_OK) {
+        tune.len = len;
+        metrics->block_len = len;
+        metrics->block_tunes++;
+    }
+    metrics->block_overhead_us = tune.overhead_us;
+    metrics->block_overhead_pct = tune.overhead_us * rate / tune.len / 10000.0f;
+}
+
+size_t pipeline_get_shed_events(pipeline_shed_event_t* events, size_t max, uint32_t* cursor) {
+    size_t n = 0;
+
+    portENTER_CRITICAL(&shed_lock);
+    uint32_t next = *cursor;
+    // A cursor from before the last start, or one that's been lapped
+    if ((int32_t)(shed_log.count - next) < 0) {
+        next = 0;
+    }
+    if (shed_log.count - next > SHED_LOG_LEN) {
+        next = shed_log.count - SHED_LOG_LEN;
+    }
+    for (; next != shed_log.count && n < max; next++, n++) {
+        events[n] = shed_log.entries[next % SHED_LOG_LEN];
+    }
+    portEXIT_CRITICAL(&shed_lock);
+
+    *cursor = next;
+    return n;
+}
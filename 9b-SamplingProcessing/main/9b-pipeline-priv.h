@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "decim_filter.h"
+#include "window_stats.h"
+#include "9b-pipeline.h"
+
+/**
+ * Between the pipeline and its controllers. 9b-pipeline.c owns the stages and the tasks,
+ * 9b-pipeline-control.c decides the rate, the shedding level and the block size.
+ */
+
+#define NUM_FRAMES 3    // Frames in the sampler's pool. The averager can hold 1 while the sampler fills the rest
+
+// Clear every controller for a new start. The pointers are the pipeline's own and stay valid
+// until the next reset: config for the settings, metrics for what they report, one filter per channel
+void pipeline_control_reset(const pipeline_config_t* config, pipeline_metrics_t* metrics, decim_filter_t* filters);
+// Start the first measuring period, once the sampler is about to start
+void pipeline_control_begin(int64_t now_us);
+
+// Adaptive rate, once a frame with every channel's window
+void pipeline_adapt_rate(const window_stats_result_t* result, int64_t now_us);
+
+pipeline_shed_level_t pipeline_shed_level(void);
+// Frames waiting behind the one the averager just took
+void pipeline_shed_backlog(size_t waiting);
+// Load shedding, once a frame
+void pipeline_shed_control(int64_t now_us);
+
+// Block size tuning, once a frame with that frame's per-block overhead and ready -> published latency
+void pipeline_block_control(int64_t overhead_us, int64_t latency_us, int64_t now_us, bool rate_changed);
@@ -0,0 +1,714 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "ADC-sampler.h"
+#include "window_stats.h"
+#include "decim_filter.h"
+#include "seqlock.h"
+#include "spectrum.h"
+#include "telemetry.h"
+#include "flash_log.h"
+#include "rollup_stats.h"
+#include "adc_cal.h"
+#include "9b-pipeline-priv.h"
+
+
+#define AVG_WINDOW_LEN 10   // Starting window for the average. Can be changed at runtime with window_stats_resize
+#define READ_SPINS 16   // Seqlock retries before a reader sleeps to let a preempted writer finish
+#define ALARM_TASK_PRIORITY 5   // Above the sampler (2), so a crossing preempts everything else in the pipeline
+#define LOGGER_QUEUE_LEN 2  // Frames the logger can fall behind by before it misses one
+#define STOP_POLL_MS 50     // How often an idle averager checks whether pipeline_stop wants it gone
+
+// ADC1 channels scanned on every timer tick. May have to mess with these to match the board
+static const uint8_t adc_channels[NUM_CHANNELS] = {0, 1, 2, 3};
+
+static pipeline_config_t config;
+// A task pipeline_stop asks to leave its loop instead of deleting it, so it never goes while
+// holding a lock or a frame. It checks stop at least every STOP_POLL_MS and gives done on the way out
+typedef struct {
+    TaskHandle_t handle;
+    atomic_bool stop;
+    SemaphoreHandle_t done;
+} pipeline_task_t;
+
+static pipeline_task_t avg_ctl;
+static pipeline_task_t alarm_ctl;
+static pipeline_task_t logger_ctl;
+static ADC_sampler_sub_t* logger_sub = NULL;    // The logger's own reference to every frame
+static latency_hist_t alarm_latency;    // Crossing sample taken -> alarm task running
+// Published with a seqlock instead of a critical section so the averager never masks interrupts
+// (and never delays the sampler's timer ISR) just to update it
+static seqlock_t adc_avg_lock = SEQLOCK_INITIALIZER;
+static pipeline_avg_t adc_avg;
+static decim_filter_t adc_filters[NUM_CHANNELS];
+static window_stats_t adc_stats[NUM_CHANNELS];
+static pipeline_metrics_t metrics;
+static spectrum_t adc_spectra[NUM_CHANNELS];
+// Published copies of each channel's latest spectrum, under their own seqlock so a reader
+// copying up to NUM_CHANNELS * 513 bins doesn't make pipeline_get_avg retry
+static seqlock_t spectrum_lock = SEQLOCK_INITIALIZER;
+static uint32_t spectrum_power[NUM_CHANNELS][SPECTRUM_MAX_LEN / 2 + 1];
+static uint32_t spectrum_frames;
+// The averager appends a frame at a time and readers decode a segment at a time under the
+// lock, so neither holds the other up for more than a few us
+static sample_history_t adc_history[NUM_CHANNELS];
+static SemaphoreHandle_t history_lock = NULL;
+static bool history_on = false;     // Under history_lock. Cleared before pipeline_stop frees it
+// Filtered samples at 100 ms for the last 2 s, 1 s for the last minute and 1 min for the last
+// hour, for pipeline_query_window. Under a mutex like the history: a query adds up at most a
+// level's worth of buckets
+static const rollup_level_config_t rollup_levels[] = {
+    {.bucket_us = 100000, .len = 20},
+    {.bucket_us = 1000000, .len = 64},
+    {.bucket_us = 60000000, .len = 64},
+};
+static rollup_stats_t adc_rollups[NUM_CHANNELS];
+static SemaphoreHandle_t rollup_lock = NULL;
+static bool rollup_on = false;      // Under rollup_lock. Cleared before pipeline_stop frees them
+// Raw code -> mV for each channel at the attenuation the sampler uses
+static adc_cal_lut_t adc_cal[NUM_CHANNELS];
+
+static const char* TAG = "";
+
+// Task to borrow each frame of FRAME_LEN samples per channel (or the tuned block size) from the
+// sampler, lowpass and decimate each channel down to BUF_SIZE samples, and write the average of
+// each channel's window to global. The filter reads straight out of the sampler's frame, and the frame is handed back
+// as soon as every channel has been filtered and its window updated.
+static void task_exit(pipeline_task_t* t) {
+    xSemaphoreGive(t->done);
+    vTaskDelete(NULL);
+}
+
+static void calc_avg_task(void* param) {
+    pipeline_task_t* t = param;
+    window_stats_result_t result[NUM_CHANNELS];
+    int16_t filtered[MAX_BUF_SIZE + 1]; // +1 in case a frame doesn't line up with the decimation phase
+    int16_t mv[MAX_FRAME_LEN];
+    size_t n = 0;
+    uint32_t last_dropped = 0;
+    ADC_sampler_stats_t sampler_stats;
+    uint32_t rate_cursor = 0;
+    ADC_sampler_rate_change_t changes[4];
+
+    while (!atomic_load(&t->stop)) {
+        const ADC_sampler_frame_t* frame = ADC_sampler_acquire(pdMS_TO_TICKS(STOP_POLL_MS));
+        if (frame == NULL) {
+            continue;
+        }
+        int64_t start = esp_timer_get_time();
+
+        size_t waiting = ADC_sampler_frames_waiting();
+        if (waiting > metrics.max_frame_backlog) {
+            metrics.max_frame_backlog = waiting;
+        }
+        pipeline_shed_backlog(waiting);
+
+        bool rate_changed = (frame->sample_rate_hz != metrics.sample_rate_hz);
+        if (rate_changed) {
+            metrics.sample_rate_hz = frame->sample_rate_hz;
+            // A spectrum across two rates means nothing
+            if (config.spectrum_len != 0) {
+                for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                    spectrum_reset(&adc_spectra[ch]);
+                }
+            }
+            // So the host can put the averages and raw blocks back on one time base
+            if (config.telemetry) {
+                size_t num_changes;
+                while ((num_changes = ADC_sampler_get_rate_changes(changes, 4, &rate_cursor)) > 0) {
+                    for (size_t i = 0; i < num_changes; i++) {
+                        telemetry_send_rate(changes[i].timestamp_us, changes[i].seq, changes[i].sample_rate_hz);
+                    }
+                }
+            }
+        }
+
+        // Everything from here to the release is per sample. The rest is per-block overhead
+        const int64_t samples_start = esp_timer_get_time();
+
+        // The spectra see the raw ADC rate, so they also have to run before the frame goes back
+        if (config.spectrum_len != 0) {
+            int64_t spectrum_start = samples_start;
+            size_t ffts = 0;
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                ffts = spectrum_push_block(&adc_spectra[ch], frame->samples[ch], frame->len);
+            }
+            // Every channel gets the same samples, so they all FFT on the same frame
+            if (ffts != 0) {
+                seqlock_write_begin(&spectrum_lock);
+                for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                    memcpy(spectrum_power[ch], adc_spectra[ch].power, spectrum_bins(&adc_spectra[ch]) * sizeof(uint32_t));
+                }
+                spectrum_frames = adc_spectra[0].frames;
+                seqlock_write_end(&spectrum_lock);
+                metrics.spectra += ffts;
+            }
+            metrics.spectrum_busy_us += esp_timer_get_time() - spectrum_start;
+        }
+
+        // Raw blocks are copied into a telemetry batch, so do it before the frame goes back.
+        // Telemetry takes records from one task only, so unlike the flash log this stays here
+        if (config.telemetry_raw && pipeline_shed_level() < PIPELINE_SHED_TELEMETRY) {
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                telemetry_send_raw(frame->timestamp_us, adc_channels[ch], frame->samples[ch], frame->len);
+            }
+        }
+
+        if (config.history_bytes != 0) {
+            int64_t first_us = frame->timestamp_us - (int64_t)(frame->len - 1) * 1000000 / frame->sample_rate_hz;
+            xSemaphoreTake(history_lock, portMAX_DELAY);
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                sample_history_push(&adc_history[ch], first_us, frame->sample_rate_hz, frame->samples[ch], frame->len);
+            }
+            xSemaphoreGive(history_lock);
+        }
+
+        // The last filtered sample lines up with the last raw one
+        const int64_t filtered_period_us = (int64_t)decim_filter_get_factor(&adc_filters[0]) * 1000000 / frame->sample_rate_hz;
+        if (config.rollup) {
+            xSemaphoreTake(rollup_lock, portMAX_DELAY);
+        }
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            const int16_t* samples = frame->samples[ch];
+            if (config.calibrate) {
+                adc_cal_lut_convert(&adc_cal[ch], samples, mv, frame->len);
+                samples = mv;
+            }
+            n = decim_filter_process(&adc_filters[ch], samples, frame->len, filtered);
+            window_stats_push_block(&adc_stats[ch], filtered, n);
+            window_stats_get(&adc_stats[ch], &result[ch]);
+            if (config.rollup && n > 0) {
+                rollup_stats_push_block(&adc_rollups[ch], frame->timestamp_us - (int64_t)(n - 1) * filtered_period_us,
+                                        filtered_period_us, filtered, n);
+            }
+        }
+        if (config.rollup) {
+            xSemaphoreGive(rollup_lock);
+        }
+        int64_t ready_us = frame->timestamp_us;
+        ADC_sampler_release(frame);
+        const int64_t samples_us = esp_timer_get_time() - samples_start;
+
+        seqlock_write_begin(&adc_avg_lock);
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            adc_avg.avg[ch] = result[ch].mean;
+        }
+        adc_avg.timestamp_us = ready_us;
+        adc_avg.sample_count += n;
+        seqlock_write_end(&adc_avg_lock);
+        // Only the averager writes adc_avg, so it can read it back without the lock
+        if (config.on_result != NULL) {
+            config.on_result(&adc_avg, config.result_ctx);
+        }
+
+        int64_t latency = esp_timer_get_time() - ready_us;
+        metrics.latency_sum_us += latency;
+        if (latency > metrics.latency_max_us) {
+            metrics.latency_max_us = latency;
+        }
+        metrics.blocks++;
+
+        if (config.min_rate_hz != 0) {
+            pipeline_adapt_rate(result, ready_us);
+        }
+
+        if (config.telemetry) {
+            float avg[NUM_CHANNELS];
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                avg[ch] = result[ch].mean;
+            }
+            telemetry_send_avg(ready_us, avg, NUM_CHANNELS);
+        }
+
+        if (config.log_results && pipeline_shed_level() < PIPELINE_SHED_TELEMETRY) {
+            for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+                ESP_LOGI(TAG, "Ch %u average = %f (min %d, max %d, var %f)", adc_channels[ch],
+                         result[ch].mean, result[ch].min, result[ch].max, result[ch].variance);
+            }
+
+            ADC_sampler_get_stats(&sampler_stats);
+            if (sampler_stats.dropped_frames != last_dropped) {
+                last_dropped = sampler_stats.dropped_frames;
+                ESP_LOGI(TAG, "Dropped %lu frames", (unsigned long)last_dropped);
+            }
+        }
+        int64_t end = esp_timer_get_time();
+        metrics.avg_busy_us += end - start;
+
+        if (config.latency_target_us != 0) {
+            pipeline_block_control(end - start - samples_us, latency, end, rate_changed);
+        }
+        if (config.load_shedding) {
+            pipeline_shed_control(esp_timer_get_time());
+        }
+    }
+    task_exit(t);
+}
+
+// Second consumer of every frame, copying it into the flash log. It has its own reference to
+// the frame, so the averager releases its reference without waiting for this and the copy is
+// off the averager's path
+static void logger_task(void* param) {
+    pipeline_task_t* t = param;
+
+    while (!atomic_load(&t->stop)) {
+        const ADC_sampler_frame_t* frame = ADC_sampler_sub_acquire(logger_sub, pdMS_TO_TICKS(STOP_POLL_MS));
+        if (frame == NULL) {
+            continue;
+        }
+        int64_t first_us = frame->timestamp_us - (int64_t)(frame->len - 1) * 1000000 / frame->sample_rate_hz;
+        flash_log_append(first_us, frame->sample_rate_hz, frame->samples, NUM_CHANNELS, frame->len);
+        ADC_sampler_release(frame);
+    }
+    task_exit(t);
+}
+
+// Handler for the sampler's threshold crossings. Doesn't wait for a frame, let alone the averager
+static void alarm_task(void* param) {
+    pipeline_task_t* t = param;
+    ADC_sampler_crossing_t crossing;
+
+    while (!atomic_load(&t->stop)) {
+        if (!ADC_sampler_wait_crossing(&crossing, pdMS_TO_TICKS(STOP_POLL_MS))) {
+            continue;
+        }
+        int64_t latency = esp_timer_get_time() - crossing.timestamp_us;
+        latency_hist_record(&alarm_latency, (latency > 0) ? (uint32_t)latency : 0);
+        metrics.alarms++;
+        if (config.on_alarm != NULL) {
+            config.on_alarm(&crossing, config.alarm_ctx);
+        }
+    }
+    task_exit(t);
+}
+
+static bool alarm_enabled(size_t ch) {
+    return config.alarm[ch].high > config.alarm[ch].low;
+}
+
+// Turns the history and rollups off before they're gone, so a reader isn't left decoding them,
+// then frees everything else the channels had. Every free is a no-op on a channel that wasn't set up
+static void channels_free(void) {
+    if (config.history_bytes != 0) {
+        xSemaphoreTake(history_lock, portMAX_DELAY);
+        history_on = false;
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            sample_history_free(&adc_history[ch]);
+        }
+        xSemaphoreGive(history_lock);
+    }
+    if (config.rollup) {
+        xSemaphoreTake(rollup_lock, portMAX_DELAY);
+        rollup_on = false;
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            rollup_stats_free(&adc_rollups[ch]);
+        }
+        xSemaphoreGive(rollup_lock);
+    }
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        decim_filter_free(&adc_filters[ch]);
+        window_stats_free(&adc_stats[ch]);
+        spectrum_free(&adc_spectra[ch]);
+        adc_cal_lut_free(&adc_cal[ch]);
+    }
+}
+
+static esp_err_t task_start(pipeline_task_t* t, TaskFunction_t fn, const char* name, uint32_t stack, UBaseType_t priority) {
+    if (t->done == NULL) {
+        t->done = xSemaphoreCreateBinary();
+        if (t->done == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    atomic_store(&t->stop, false);
+    if (xTaskCreate(fn, name, stack, t, priority, &t->handle) != pdPASS) {
+        t->handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// The task finishes what it's on and leaves
+static void task_stop(pipeline_task_t* t) {
+    if (t->handle != NULL) {
+        atomic_store(&t->stop, true);
+        xSemaphoreTake(t->done, portMAX_DELAY);
+        t->handle = NULL;
+    }
+}
+
+esp_err_t pipeline_start(const pipeline_config_t* pipeline_config) {
+    if (avg_ctl.handle != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t len = pipeline_config->spectrum_len;
+    if (len != 0 && (len < SPECTRUM_MIN_LEN || len > SPECTRUM_MAX_LEN || (len & (len - 1)) != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pipeline_config->min_rate_hz != 0 && (pipeline_config->min_rate_hz > pipeline_config->sample_rate_hz ||
+                                              pipeline_config->sample_rate_hz > pipeline_config->max_rate_hz)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Kept from one start to the next, so they're made before anything that would need undoing
+    if (pipeline_config->history_bytes != 0 && history_lock == NULL) {
+        history_lock = xSemaphoreCreateMutex();
+    }
+    if (pipeline_config->rollup && rollup_lock == NULL) {
+        rollup_lock = xSemaphoreCreateMutex();
+    }
+    if ((pipeline_config->history_bytes != 0 && history_lock == NULL) ||
+        (pipeline_config->rollup && rollup_lock == NULL)) {
+        return ESP_ERR_NO_MEM;
+    }
+    config = *pipeline_config;
+    memset(&metrics, 0, sizeof(metrics));
+    pipeline_control_reset(&config, &metrics, adc_filters);
+    metrics.sample_rate_hz = config.sample_rate_hz;
+    metrics.block_len = FRAME_LEN;
+    seqlock_write_begin(&adc_avg_lock);
+    memset(&adc_avg, 0, sizeof(adc_avg));
+    seqlock_write_end(&adc_avg_lock);
+    seqlock_write_begin(&spectrum_lock);
+    spectrum_frames = 0;
+    seqlock_write_end(&spectrum_lock);
+
+    // What's been set up so far, for cleanup to undo
+    esp_err_t err = ESP_OK;
+    bool telemetry_on = false;
+    bool flash_log_on = false;
+    bool sampler_on = false;
+
+    // Room for the longest block the tuning can pick, starting at the usual size
+    const size_t max_frame_len = (config.latency_target_us != 0) ? MAX_FRAME_LEN : FRAME_LEN;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        err = decim_filter_init(&adc_filters[ch], max_frame_len);
+        if (err != ESP_OK) {
+            goto cleanup;
+        }
+        err = window_stats_init(&adc_stats[ch], AVG_WINDOW_LEN);
+        if (err != ESP_OK) {
+            goto cleanup;
+        }
+        if (config.spectrum_len != 0) {
+            err = spectrum_init(&adc_spectra[ch], config.spectrum_len, config.spectrum_len / 2);
+            if (err != ESP_OK) {
+                goto cleanup;
+            }
+        }
+        if (config.history_bytes != 0) {
+            err = sample_history_init(&adc_history[ch], config.history_bytes, 0, HISTORY_SEGMENT_LEN);
+            if (err != ESP_OK) {
+                goto cleanup;
+            }
+        }
+        if (config.calibrate) {
+            err = adc_cal_lut_init(&adc_cal[ch], 0, adc_channels[ch], ADC_CAL_ATTEN_DB_12);
+            if (err != ESP_OK) {
+                goto cleanup;
+            }
+        }
+        if (config.rollup) {
+            err = rollup_stats_init(&adc_rollups[ch], rollup_levels, sizeof(rollup_levels) / sizeof(rollup_levels[0]));
+            if (err != ESP_OK) {
+                goto cleanup;
+            }
+        }
+    }
+    if (config.history_bytes != 0) {
+        xSemaphoreTake(history_lock, portMAX_DELAY);
+        history_on = true;
+        xSemaphoreGive(history_lock);
+    }
+    if (config.rollup) {
+        xSemaphoreTake(rollup_lock, portMAX_DELAY);
+        rollup_on = true;
+        xSemaphoreGive(rollup_lock);
+    }
+
+    ADC_sampler_config_t sampler_config = {
+        .sample_rate_hz = config.sample_rate_hz,
+        .frame_len = max_frame_len,
+        // The logger can keep a queue's worth plus the one it's reading out of the pool
+        .num_frames = NUM_FRAMES + (config.flash_log ? LOGGER_QUEUE_LEN + 1 : 0),
+        .overrun_policy = config.overrun_policy,
+        .num_channels = NUM_CHANNELS,
+        .on_frame = NULL,   // calc_avg_task borrows frames with ADC_sampler_acquire
+        .task_priority = 2,
+        .replay_path = config.replay_path,
+        .replay_fast = config.replay_fast,
+    };
+    memcpy(sampler_config.channels, adc_channels, sizeof(adc_channels));
+
+    if (config.telemetry) {
+        // Same priority as the averager. The writer blocks on the UART, never the averager
+        telemetry_config_t telemetry_config = {
+            .task_priority = 1,
+        };
+        err = telemetry_start(&telemetry_config);
+        if (err != ESP_OK) {
+            goto cleanup;
+        }
+        telemetry_on = true;
+    }
+    if (config.flash_log) {
+        // Below the averager: an erase takes tens of ms, and the RAM records cover it
+        flash_log_config_t flash_log_config = {
+            .task_priority = 0,
+        };
+        err = flash_log_open(&flash_log_config);
+        if (err != ESP_OK) {
+            goto cleanup;
+        }
+        flash_log_on = true;
+    }
+
+    err = ADC_sampler_config(&sampler_config);
+    if (err == ESP_OK && config.latency_target_us != 0 && ADC_sampler_set_frame_len(FRAME_LEN) != ESP_OK) {
+        // The continuous backend's frames are fixed, so go back to the usual size and don't tune
+        ESP_LOGW(TAG, "The sampler can't change its frame length, block size fixed at %d", FRAME_LEN);
+        config.latency_target_us = 0;
+        ADC_sampler_deinit();
+        sampler_config.frame_len = FRAME_LEN;
+        err = ADC_sampler_config(&sampler_config);
+    }
+    if (err != ESP_OK) {
+        goto cleanup;
+    }
+    sampler_on = true;
+    if (config.flash_log) {
+        err = ADC_sampler_subscribe(LOGGER_QUEUE_LEN, &logger_sub);
+        if (err != ESP_OK) {
+            goto cleanup;
+        }
+        // Same priority as the averager, which gets the frames first
+        err = task_start(&logger_ctl, logger_task, "Logger task", 3072, 1);
+        if (err != ESP_OK) {
+            goto cleanup;
+        }
+    }
+    latency_hist_reset(&alarm_latency);
+    pipeline_control_begin(esp_timer_get_time());
+    bool alarms = false;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        if (alarm_enabled(ch)) {
+            err = ADC_sampler_set_threshold(ch, &config.alarm[ch]);
+            if (err != ESP_OK) {
+                goto cleanup;
+            }
+            alarms = true;
+        }
+    }
+    if (alarms) {
+        err = task_start(&alarm_ctl, alarm_task, "Alarm task", 3072, ALARM_TASK_PRIORITY);
+        if (err != ESP_OK) {
+            goto cleanup;
+        }
+    }
+    // Bigger stack than the other tasks for the longest block's working buffers
+    err = task_start(&avg_ctl, calc_avg_task, "Calculator task", 4096, 1);
+    if (err != ESP_OK) {
+        goto cleanup;
+    }
+    err = ADC_sampler_start();
+    if (err == ESP_OK) {
+        return ESP_OK;
+    }
+
+    // Undo whatever got set up, in reverse
+cleanup:
+    task_stop(&avg_ctl);
+    task_stop(&alarm_ctl);
+    task_stop(&logger_ctl);
+    logger_sub = NULL;
+    if (sampler_on) {
+        ADC_sampler_deinit();
+    }
+    if (flash_log_on) {
+        flash_log_close();
+    }
+    if (telemetry_on) {
+        telemetry_stop();
+    }
+    channels_free();
+    return err;
+}
+
+esp_err_t pipeline_stop(void) {
+    // The averager has to go first since it may be blocked on the sampler's queue
+    task_stop(&avg_ctl);
+    // Same for the alarm task and the crossing queue, and the logger and its frame queue
+    task_stop(&alarm_ctl);
+    task_stop(&logger_ctl);
+    logger_sub = NULL;
+    ADC_sampler_stop();
+    ADC_sampler_deinit();
+    if (config.telemetry) {
+        telemetry_stop();
+    }
+    if (config.flash_log) {
+        flash_log_close();
+    }
+    channels_free();
+    return ESP_OK;
+}
+
+void pipeline_get_metrics(pipeline_metrics_t* out) {
+    ADC_sampler_stats_t sampler_stats;
+    ADC_sampler_get_stats(&sampler_stats);
+
+    *out = metrics;
+    out->dropped_samples = sampler_stats.dropped_samples;
+    out->overwritten_samples = sampler_stats.overwritten_samples;
+    out->spare_frames_used = sampler_stats.spare_frames_used;
+    out->sampler_overruns = sampler_stats.overruns;
+    out->sampler_busy_us = sampler_stats.busy_us;
+    out->rate_changes = sampler_stats.rate_changes;
+    out->alarms_dropped = sampler_stats.dropped_crossings;
+
+    if (logger_sub != NULL) {
+        ADC_sampler_sub_stats_t logger_stats;
+        latency_hist_t lag;
+        ADC_sampler_get_sub_stats(logger_sub, &logger_stats, &lag);
+        out->logger_dropped_frames = logger_stats.dropped_frames;
+        out->logger_max_backlog = logger_stats.max_waiting;
+        out->logger_lag_max_us = latency_hist_max(&lag);
+    }
+    if (config.telemetry) {
+        telemetry_stats_t telemetry_stats;
+        telemetry_get_stats(&telemetry_stats);
+        out->telemetry_dropped = telemetry_stats.dropped_records;
+    }
+    if (config.flash_log) {
+        flash_log_stats_t flash_log_stats;
+        flash_log_get_stats(&flash_log_stats);
+        out->flash_log_dropped = flash_log_stats.dropped_scans;
+    }
+}
+
+void pipeline_get_timing(latency_hist_t* jitter, latency_hist_t* read_latency) {
+    ADC_sampler_get_timing(jitter, read_latency);
+}
+
+void pipeline_get_alarm_latency(latency_hist_t* latency) {
+    latency_hist_copy(latency, &alarm_latency);
+}
+
+void pipeline_get_avg(pipeline_avg_t* avg) {
+    uint32_t seq;
+    size_t tries = 0;
+    do {
+        // Only happens if we preempted the averager mid-update. Let it finish
+        if (++tries > READ_SPINS) {
+            vTaskDelay(1);
+        }
+        seq = seqlock_read_begin(&adc_avg_lock);
+        *avg = adc_avg;
+    } while (seqlock_read_retry(&adc_avg_lock, seq));
+}
+
+uint32_t pipeline_get_spectrum(size_t ch, uint32_t* power) {
+    if (config.spectrum_len == 0 || ch >= NUM_CHANNELS) {
+        return 0;
+    }
+    uint32_t seq;
+    uint32_t frames;
+    size_t tries = 0;
+    do {
+        if (++tries > READ_SPINS) {
+            vTaskDelay(1);
+        }
+        seq = seqlock_read_begin(&spectrum_lock);
+        frames = spectrum_frames;
+        if (frames != 0) {
+            memcpy(power, spectrum_power[ch], (config.spectrum_len / 2 + 1) * sizeof(uint32_t));
+        }
+    } while (seqlock_read_retry(&spectrum_lock, seq));
+    return frames;
+}
+
+// Take history_lock if the history's on. Returns false, not holding it, if it's off or stopped
+static bool history_take(void) {
+    if (history_lock == NULL) {
+        return false;
+    }
+    xSemaphoreTake(history_lock, portMAX_DELAY);
+    if (!history_on) {
+        xSemaphoreGive(history_lock);
+        return false;
+    }
+    return true;
+}
+
+esp_err_t pipeline_history_range(size_t ch, uint32_t* first, uint32_t* end) {
+    if (ch >= NUM_CHANNELS || !history_take()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *first = sample_history_first(&adc_history[ch]);
+    *end = sample_history_end(&adc_history[ch]);
+    xSemaphoreGive(history_lock);
+    return ESP_OK;
+}
+
+esp_err_t pipeline_history_read(size_t ch, uint32_t id, int16_t* out, sample_history_info_t* info) {
+    if (ch >= NUM_CHANNELS || !history_take()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = sample_history_read(&adc_history[ch], id, out, info);
+    xSemaphoreGive(history_lock);
+    return err;
+}
+
+void pipeline_history_flush(void) {
+    if (!history_take()) {
+        return;
+    }
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        sample_history_flush(&adc_history[ch]);
+    }
+    xSemaphoreGive(history_lock);
+}
+
+esp_err_t pipeline_history_get_stats(size_t ch, sample_history_stats_t* stats) {
+    if (ch >= NUM_CHANNELS || !history_take()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sample_history_get_stats(&adc_history[ch], stats);
+    xSemaphoreGive(history_lock);
+    return ESP_OK;
+}
+
+// Take rollup_lock if the rollups are on. Returns false, not holding it, if they're off or stopped
+static bool rollup_take(void) {
+    if (rollup_lock == NULL) {
+        return false;
+    }
+    xSemaphoreTake(rollup_lock, portMAX_DELAY);
+    if (!rollup_on) {
+        xSemaphoreGive(rollup_lock);
+        return false;
+    }
+    return true;
+}
+
+esp_err_t pipeline_query_window(size_t ch, int64_t from_us, int64_t to_us, rollup_stats_result_t* result) {
+    if (ch >= NUM_CHANNELS || !rollup_take()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    rollup_stats_query(&adc_rollups[ch], from_us, to_us, result);
+    xSemaphoreGive(rollup_lock);
+    return ESP_OK;
+}
+
+esp_err_t pipeline_query_last(size_t ch, int64_t window_us, rollup_stats_result_t* result) {
+    if (ch >= NUM_CHANNELS || !rollup_take()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    rollup_stats_last(&adc_rollups[ch], window_us, result);
+    xSemaphoreGive(rollup_lock);
+    return ESP_OK;
+}
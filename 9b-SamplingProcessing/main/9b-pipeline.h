@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "decim_filter.h"
+#include "ADC-sampler.h"
+#include "spectrum.h"
+#include "sample_history.h"
+#include "rollup_stats.h"
+
+/**
+ * The 9b sampling/processing pipeline: ADC-Sampler frames are lent straight to calc_avg_task,
+ * which runs each channel through the Decim-Filter stage and averages what comes out. Every
+ * other stage (spectrum, history, flash log, rollups, calibration, alarms, adaptive rate, load
+ * shedding, block size tuning, replay) is off unless its field in pipeline_config_t is set,
+ * and is described there. Split out of app_main so the benchmarks can run the exact same pipeline.
+ */
+
+#define BUF_SIZE 10     // Filtered samples per channel averaged at a time (where a tuned block size starts)
+#define MAX_BUF_SIZE 50 // Most a tuned block size goes up to
+#define FRAME_LEN (BUF_SIZE * DECIM_FILTER_FACTOR)  // Raw samples per channel in each sampler frame
+#define MAX_FRAME_LEN (MAX_BUF_SIZE * DECIM_FILTER_FACTOR)
+#define NUM_CHANNELS 4
+#define HISTORY_SEGMENT_LEN SAMPLE_HISTORY_DEFAULT_SEGMENT_LEN  // Raw samples per history segment
+
+// Called from the alarm task for every threshold crossing
+typedef void (*pipeline_alarm_cb_t)(const ADC_sampler_crossing_t* crossing, void* ctx);
+
+// Latest published result. Readers always get all the fields from the same update
+typedef struct {
+    float avg[NUM_CHANNELS];    // Average of each channel's window
+    int64_t timestamp_us;       // When the newest sample in the window was taken (frame completion time)
+    uint32_t sample_count;      // Filtered samples per channel averaged since the pipeline started
+} pipeline_avg_t;
+
+// Called from the averager with every result it publishes
+typedef void (*pipeline_result_cb_t)(const pipeline_avg_t* avg, void* ctx);
+
+// Load shedding steps, in the order they're taken. Each level includes the ones before it
+typedef enum {
+    PIPELINE_SHED_NONE = 0,
+    PIPELINE_SHED_TELEMETRY,    // No raw telemetry blocks or result logging
+    PIPELINE_SHED_DECIMATE,     // Decimation factor doubled, with the lowpass cutoff halved to match: half the filtered samples
+    PIPELINE_SHED_RATE,         // ADC rate halved (the adaptive rate's ceiling, if adaptive)
+} pipeline_shed_level_t;
+
+typedef struct {
+    int64_t timestamp_us;       // When the step was taken
+    pipeline_shed_level_t level;    // Level after it
+    uint32_t load_pct;          // CPU load over the period that led to it
+    uint32_t max_backlog;       // Most frames waiting for the averager in that period
+    uint32_t dropped_frames;    // Frames the sampler dropped or overwrote in that period
+} pipeline_shed_event_t;
+
+typedef struct {
+    uint32_t sample_rate_hz;    // Scans per second at the ADC (starting rate if adaptive). The averager sees 1 / DECIM_FILTER_FACTOR of them
+    uint32_t min_rate_hz;       // Adaptive rate floor. 0 = fixed at sample_rate_hz
+    uint32_t max_rate_hz;       // Adaptive rate ceiling
+    bool log_results;           // Print every average. Turn off for high rates
+    bool telemetry;             // Stream every average as a binary record (Telemetry component)
+    bool telemetry_raw;         // Stream each channel's raw block too. Needs telemetry
+    ADC_sampler_overrun_policy_t overrun_policy;    // When the averager falls behind. Drop newest by default
+    size_t spectrum_len;        // FFT size for each channel's spectrum, at the ADC rate with 50% overlap. 0 = off
+    size_t history_bytes;       // RAM for each channel's compressed raw history. 0 = off
+    bool flash_log;             // Keep every raw scan in the flash log partition too (Flash-Log)
+    bool rollup;                // Keep filtered samples bucketed up to an hour back for pipeline_query_window
+    bool calibrate;             // Filter, average and roll up in mV instead of raw codes (ADC-Cal table). Raw stages keep the codes
+    ADC_sampler_threshold_t alarm[NUM_CHANNELS];    // Comparator per channel, raw codes. high <= low (all 0) = off
+    pipeline_alarm_cb_t on_alarm;   // Optional. Runs above the sampler's priority, so keep it short
+    void* alarm_ctx;
+    pipeline_result_cb_t on_result; // Optional. Holds up the averager, so keep it short
+    void* result_ctx;
+    const char* replay_path;    // Replay backend only: capture file to feed the pipeline from
+    bool replay_fast;           // Replay backend only: as fast as the averager goes, for throughput and golden output runs
+    bool load_shedding;         // Step through pipeline_shed_level_t under overload instead of dropping frames at random
+    uint32_t latency_target_us; // Tune the block size for first sample -> average published within this. 0 = fixed at FRAME_LEN
+    uint32_t block_overhead_pct;    // CPU the per-block overhead may take while tuning. 0 for 5%
+} pipeline_config_t;
+
+typedef struct {
+    uint32_t blocks;            // Frames filtered and averaged, per channel
+    uint32_t dropped_samples;   // Samples the sampler had nowhere to put because the averager held every frame
+    uint32_t overwritten_samples;   // Overwrite oldest policy: samples replaced before the averager got them
+    uint32_t spare_frames_used;     // Spare pool policy: times the sampler had to dip into the spares
+    uint32_t sampler_overruns;  // Samples/frames the sampler itself lost
+    uint32_t max_frame_backlog; // Most frames waiting when the averager picked one up
+    int64_t latency_sum_us;     // Frame ready -> average published
+    int64_t latency_max_us;
+    int64_t sampler_busy_us;    // Time spent in the sampler task, including the frame callback
+    int64_t avg_busy_us;        // Time spent averaging, including the spectra
+    int64_t spectrum_busy_us;   // Part of avg_busy_us spent windowing and FFTing
+    uint32_t spectra;           // FFTs done, per channel
+    uint32_t telemetry_dropped; // Records the telemetry writer couldn't keep up with
+    uint32_t flash_log_dropped; // Scans the flash log writer couldn't keep up with
+    uint32_t logger_dropped_frames; // Frames the flash log task missed while it was behind
+    uint32_t logger_max_backlog;    // Most frames queued for it at once
+    uint32_t logger_lag_max_us;     // Longest frame ready -> picked up by it
+    uint32_t sample_rate_hz;    // ADC rate of the last frame averaged
+    uint32_t rate_changes;      // Times the ADC rate changed (ADC_sampler_get_rate_changes has when)
+    uint32_t alarms;            // Threshold crossings handled
+    uint32_t alarms_dropped;    // Crossings lost because the alarm task was that far behind
+    uint32_t load_pct;          // CPU load over the last load shedding period
+    pipeline_shed_level_t shed_level;
+    uint32_t shed_steps;        // Load shedding steps taken either way (pipeline_get_shed_events has them)
+    uint32_t block_len;         // Raw samples per channel per frame the block size is set to
+    uint32_t block_tunes;       // Times the block size was changed
+    float block_overhead_us;    // Tuning only: measured cost of a frame on top of its samples: handing it over, publishing, bookkeeping
+    float block_overhead_pct;   // That over a block period at block_len and the current rate
+} pipeline_metrics_t;
+
+esp_err_t pipeline_start(const pipeline_config_t* config);
+esp_err_t pipeline_stop(void);
+
+// The averager updates these without a lock, so they are only exact once the pipeline is stopped
+void pipeline_get_metrics(pipeline_metrics_t* metrics);
+// Sampler timing since pipeline_start, in us: alarm -> ISR jitter and ISR -> read latency for
+// every scan. Either can be NULL. Safe to call while running
+void pipeline_get_timing(latency_hist_t* jitter, latency_hist_t* read_latency);
+// Crossing sample taken -> alarm task running, in us, for every crossing since pipeline_start.
+// Safe to call while running
+void pipeline_get_alarm_latency(latency_hist_t* latency);
+// Copy out up to max load shedding steps, oldest first, starting from step number *cursor (start
+// at 0) and move *cursor past them. Like ADC_sampler_get_rate_changes, steps the log has moved
+// on from are skipped. Returns how many were copied. Safe to call while running
+size_t pipeline_get_shed_events(pipeline_shed_event_t* events, size_t max, uint32_t* cursor);
+// Latest averages. Lock-free: never holds up the averager, retries if it raced with an update
+void pipeline_get_avg(pipeline_avg_t* avg);
+// Latest power spectrum of channel ch (index into the scanned channels): spectrum_len / 2 + 1
+// bins, DC first, bin k at k * rate / spectrum_len where rate is metrics.sample_rate_hz. The
+// spectra start over whenever the rate changes. Same lock-free read as
+// pipeline_get_avg. Returns the FFTs done so far (0 = nothing yet, power untouched), or 0 if
+// the spectrum is off or ch is out of range
+uint32_t pipeline_get_spectrum(size_t ch, uint32_t* power);
+
+// Raw sample history of channel ch, by segment: segments *first to *end - 1 are held, oldest
+// first. ESP_ERR_INVALID_STATE if the history is off or the pipeline stopped
+esp_err_t pipeline_history_range(size_t ch, uint32_t* first, uint32_t* end);
+// Decode history segment id of channel ch into out[HISTORY_SEGMENT_LEN]. info (optional) says
+// how many samples, when and at what rate. ESP_ERR_NOT_FOUND once the segment's been evicted
+esp_err_t pipeline_history_read(size_t ch, uint32_t id, int16_t* out, sample_history_info_t* info);
+// Close off every channel's unfinished segment so the newest samples can be read
+void pipeline_history_flush(void);
+esp_err_t pipeline_history_get_stats(size_t ch, sample_history_stats_t* stats);
+
+// Mean, min and max of channel ch's filtered samples over [from_us, to_us) in esp_timer time,
+// widened to whole buckets (result says the span it actually covers). The finer the window the
+// finer the buckets: 100 ms for the last 2 s, 1 s for the last minute, 1 min for the last hour.
+// ESP_ERR_INVALID_STATE if rollup is off or the pipeline stopped
+esp_err_t pipeline_query_window(size_t ch, int64_t from_us, int64_t to_us, rollup_stats_result_t* result);
+// Same for the last window_us up to the newest filtered sample, e.g. the last 1 s, 1 min or 1 h
+esp_err_t pipeline_query_last(size_t ch, int64_t window_us, rollup_stats_result_t* result);
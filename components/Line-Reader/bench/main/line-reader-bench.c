@@ -0,0 +1,171 @@
+/**
+ * Line-Reader throughput at 115200 and 921600 baud.
+ *
+ * NUM_LINES numbered lines of LINE_LEN bytes, "\r\n" included, go down the wire back to back in
+ * one write, and on_line checks each one off as it comes in. On the linux target they go down
+ * the reader's mock wire, on a chip out of BENCH_UART with its TX looped back to its RX.
+ * Reported per run:
+ *  - lines/s and bytes/s received, from the start of the write to the last line, and what
+ *    that is of the wire's speed (baud / 10 bytes/s)
+ *  - wake-ups per line and bytes per wake-up: what reading a chunk at a time is worth
+ *  - cpu: reader task busy time over the run
+ *  - lost lines (gaps in the numbering) and bad ones (wrong length or contents)
+ *  - latency: from when a line's last byte was due off the wire to on_line getting it, mean
+ *    and worst. The FIFO threshold and RX timeout are most of it
+ * Every run should come in at close to 100% of the wire with nothing lost or bad.
+ * The last run spins SLOW_US in on_line for each line so the reader falls behind the wire
+ * and the driver's buffer overflows. Lines should be lost there, all counted as discarded or
+ * overflowed, and none bad: a line missing bytes is thrown away, not passed on.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "line_reader.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "driver/uart.h"
+#endif
+
+
+#define NUM_LINES 400
+#define LINE_LEN 64             // Including the "\r\n"
+#define BAUD_RATES {115200, 921600}
+#define SLOW_US 1000            // Per line in the overflow run, longer than a line takes at 921600
+#define SETTLE_MS 100           // After the write, for the RX timeout and the reader to finish
+#define BENCH_UART 1            // UART_NUM_1, the console is on 0
+
+static const char* TAG = "bench";
+
+typedef struct {
+    uint32_t baud_rate;
+    int64_t start_us;           // When the write started
+    int64_t last_us;            // When the last line came in
+    uint32_t slow_us;
+    uint32_t next;              // Number the next line should have
+    uint32_t received;
+    uint32_t lost;
+    uint32_t bad;
+    int64_t latency_sum_us;
+    int64_t latency_max_us;
+} bench_t;
+
+static uint8_t wire[NUM_LINES * LINE_LEN];
+
+
+static char payload_char(uint32_t num, size_t i) {
+    return (char)('a' + (num + i) % 26);
+}
+
+// "00042 " then letters that depend on the number, then "\r\n"
+static void make_lines(void) {
+    for (uint32_t num = 0; num < NUM_LINES; num++) {
+        char* line = (char*)&wire[num * LINE_LEN];
+        snprintf(line, 7, "%05" PRIu32 " ", num);
+        for (size_t i = 6; i < LINE_LEN - 2; i++) {
+            line[i] = payload_char(num, i);
+        }
+        line[LINE_LEN - 2] = '\r';
+        line[LINE_LEN - 1] = '\n';
+    }
+}
+
+static void on_line(const char* line, size_t len, void* ctx) {
+    bench_t* b = ctx;
+    int64_t now = esp_timer_get_time();
+
+    char* end;
+    uint32_t num = strtoul(line, &end, 10);
+    bool good = (len == LINE_LEN - 2 && end == line + 5 && num < NUM_LINES && num >= b->next);
+    for (size_t i = 6; good && i < len; i++) {
+        good = (line[i] == payload_char(num, i));
+    }
+    if (!good) {
+        b->bad++;
+        return;
+    }
+    b->lost += num - b->next;
+    b->next = num + 1;
+    b->received++;
+    b->last_us = now;
+
+    int64_t due_us = b->start_us + (int64_t)(num + 1) * LINE_LEN * 10 * 1000000 / b->baud_rate;
+    int64_t latency = now - due_us;
+    b->latency_sum_us += latency;
+    if (latency > b->latency_max_us) {
+        b->latency_max_us = latency;
+    }
+
+    int64_t until = now + b->slow_us;
+    while (esp_timer_get_time() < until) {
+    }
+}
+
+static void run(uint32_t baud_rate, uint32_t slow_us) {
+    bench_t b = {
+        .baud_rate = baud_rate,
+        .slow_us = slow_us,
+    };
+    line_reader_config_t config = {
+        .uart_num = BENCH_UART,
+        .baud_rate = baud_rate,
+        .on_line = on_line,
+        .ctx = &b,
+        .task_priority = 5,
+    };
+    line_reader_t* reader;
+    line_reader_stats_t s;
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+    uart_config_t uart_config = {
+        .baud_rate = baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    ESP_ERROR_CHECK(uart_param_config(BENCH_UART, &uart_config));
+#endif
+    ESP_ERROR_CHECK(line_reader_start(&config, &reader));
+#ifndef CONFIG_IDF_TARGET_LINUX
+    ESP_ERROR_CHECK(uart_set_loop_back(BENCH_UART, true));
+#endif
+
+    b.start_us = esp_timer_get_time();
+#ifdef CONFIG_IDF_TARGET_LINUX
+    line_reader_mock_rx(reader, wire, sizeof(wire));
+#else
+    uart_write_bytes(BENCH_UART, wire, sizeof(wire));
+    uart_wait_tx_done(BENCH_UART, portMAX_DELAY);
+#endif
+    vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+    line_reader_get_stats(reader, &s);
+    ESP_ERROR_CHECK(line_reader_stop(reader));
+
+    b.lost += NUM_LINES - b.next;
+    float elapsed_s = (b.last_us - b.start_us) / 1e6f;
+    float bytes_per_s = b.received ? b.received * LINE_LEN / elapsed_s : 0.0f;
+    ESP_LOGI(TAG, "%6" PRIu32 " %5" PRIu32 " %7.0f %7.0f %5.1f%% %6.2f %6.1f %5.1f%% %5" PRIu32 " %4" PRIu32
+             " %6.0f %6" PRId64 "  (%" PRIu32 " overflows, %" PRIu32 " discarded)",
+             baud_rate, slow_us, b.received / elapsed_s, bytes_per_s, bytes_per_s * 100 / (baud_rate / 10.0f),
+             s.lines ? (float)s.wakeups / s.lines : 0.0f, s.wakeups ? (float)s.bytes / s.wakeups : 0.0f,
+             (float)s.busy_us * 100 / (b.last_us - b.start_us), b.lost, b.bad,
+             b.received ? (float)b.latency_sum_us / b.received : 0.0f, b.latency_max_us,
+             s.overflows, s.discarded_lines);
+}
+
+void app_main(void) {
+    static const uint32_t baud_rates[] = BAUD_RATES;
+
+    make_lines();
+    ESP_LOGI(TAG, "%d lines of %d bytes in one write", NUM_LINES, LINE_LEN);
+    ESP_LOGI(TAG, "  baud  slow lines/s bytes/s  wire wk/line B/wake   cpu  lost  bad lat avg lat max");
+    for (size_t i = 0; i < sizeof(baud_rates) / sizeof(baud_rates[0]); i++) {
+        run(baud_rates[i], 0);
+    }
+    run(baud_rates[sizeof(baud_rates) / sizeof(baud_rates[0]) - 1], SLOW_US);
+}
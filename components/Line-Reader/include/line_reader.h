@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/**
+ * Line input from a UART console, shared by the projects that take commands over serial.
+ *
+ * A reader task sleeps on the UART driver's event queue and only wakes when the driver has a
+ * chunk for it: the RX FIFO filled up to its threshold, or the line went quiet for a few
+ * characters (the RX timeout). Each time it works through every event waiting, reading the
+ * bytes each one is for a chunk at a time, then whatever's buffered that lost its event. It
+ * splits them into lines and hands every complete one on. A burst of typing or a pasted block
+ * costs at most a wake-up per chunk, not per byte, and nothing is left unread.
+ *
+ * A line ends at '\r', '\n' or "\r\n" (one line, not an empty one after it). Lines are handed
+ * over without the terminator and NUL terminated, either:
+ *  - to on_line, called from the reader task. The line is only valid during the call
+ *  - or with on_line NULL, into a queue of queue_len lines for line_reader_receive. A line
+ *    that finds the queue full is dropped and counted
+ * Anything past max_line is cut off and the line counted as truncated. If the driver's FIFO or
+ * buffer overflowed, the line in progress is missing bytes, so it's thrown away at its
+ * terminator (discarded_lines) rather than handed on with a hole in it.
+ *
+ * The reader installs the UART driver itself, with the event queue, so set the port up with
+ * uart_param_config and uart_set_pin first but don't install the driver. uart_write_bytes
+ * works on the port as usual while the reader runs.
+ *
+ * The linux target has no UART. There the reader reads from a mock wire instead: bytes given
+ * to line_reader_mock_rx arrive at baud_rate, in FIFO threshold sized chunks with the rest
+ * after the RX timeout, the way the driver hands them over. For benchmarks and tests.
+ */
+
+#define LINE_READER_DEFAULT_MAX_LINE 128
+#define LINE_READER_DEFAULT_QUEUE_LEN 4
+#define LINE_READER_DEFAULT_RX_BUF 1024     // Has to be over the 128 byte hardware FIFO
+#define LINE_READER_DEFAULT_STACK 3072
+
+typedef struct line_reader line_reader_t;
+
+// Called from the reader task with each complete line, len bytes plus a NUL
+typedef void (*line_reader_cb_t)(const char* line, size_t len, void* ctx);
+
+typedef struct {
+    int uart_num;                   // Port, set up with uart_param_config and uart_set_pin
+    uint32_t baud_rate;             // Linux mock only: speed of the mock wire
+    size_t rx_buffer_size;          // Driver RX ring buffer. 0 for LINE_READER_DEFAULT_RX_BUF
+    size_t tx_buffer_size;          // Driver TX ring buffer. 0 for none: uart_write_bytes waits for the FIFO
+    size_t max_line;                // Longest line kept, without the terminator. 0 for LINE_READER_DEFAULT_MAX_LINE
+    line_reader_cb_t on_line;       // Optional. NULL to queue lines for line_reader_receive instead
+    void* ctx;                      // Passed through to on_line
+    size_t queue_len;               // Lines the queue holds without on_line. 0 for LINE_READER_DEFAULT_QUEUE_LEN
+    uint32_t task_priority;         // Priority of the reader task
+    size_t task_stack;              // Its stack, on_line included. 0 for LINE_READER_DEFAULT_STACK
+} line_reader_config_t;
+
+typedef struct {
+    uint32_t bytes;                 // Bytes read from the driver
+    uint32_t lines;                 // Complete lines handed on
+    uint32_t wakeups;               // Times the reader task woke up for driver events
+    uint32_t reads;                 // Chunks read out of the driver's buffer
+    uint32_t overflows;             // Times the FIFO or the driver's buffer overflowed and bytes were lost
+    uint32_t discarded_lines;       // Lines thrown away because an overflow left a hole in them
+    uint32_t truncated_lines;       // Lines longer than max_line, handed on cut short
+    uint32_t dropped_lines;         // Queue only: lines that found it full
+    uint32_t errors;                // Framing, parity and break events
+    int64_t busy_us;                // Time the reader task spent reading, splitting and in on_line
+} line_reader_stats_t;
+
+// Install the UART driver on config->uart_num and start the reader task
+esp_err_t line_reader_start(const line_reader_config_t* config, line_reader_t** reader);
+// Stop the reader task and delete the driver. Lines still queued are lost
+esp_err_t line_reader_stop(line_reader_t* reader);
+
+// Queue only: wait up to wait ticks for the next line and copy it, cut to max - 1 bytes, and a
+// NUL into line. For one receiving task. Returns false on timeout
+bool line_reader_receive(line_reader_t* reader, char* line, size_t max, TickType_t wait);
+
+// Copy out the counters. Safe to call while running
+void line_reader_get_stats(line_reader_t* reader, line_reader_stats_t* stats);
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+// Send len bytes down the mock wire to the reader, at baud_rate with 10 bits per byte. Returns
+// once the last one has arrived, like a blocking write on the far end. Bytes the driver's
+// buffer has no room for are lost, and counted, like they would be off a real UART
+void line_reader_mock_rx(line_reader_t* reader, const uint8_t* data, size_t len);
+#endif
@@ -0,0 +1,253 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "line_reader_priv.h"
+
+
+#define CHUNK_LEN 128   // Read out of the driver this much at a time, one hardware FIFO's worth
+
+// A line as it goes through the queue
+typedef struct line_reader_item {
+    size_t len;
+    char text[];        // max_line + 1
+} line_reader_item_t;
+
+
+static void add_stats(line_reader_stats_t* to, const line_reader_stats_t* from) {
+    to->bytes += from->bytes;
+    to->lines += from->lines;
+    to->wakeups += from->wakeups;
+    to->reads += from->reads;
+    to->overflows += from->overflows;
+    to->discarded_lines += from->discarded_lines;
+    to->truncated_lines += from->truncated_lines;
+    to->dropped_lines += from->dropped_lines;
+    to->errors += from->errors;
+    to->busy_us += from->busy_us;
+}
+
+// Hand the line put together so far on, unless an overflow took a piece out of it
+static void end_line(line_reader_t* r) {
+    line_reader_item_t* line = r->line;
+    line->text[line->len] = '\0';
+
+    if (r->broken) {
+        r->pending.discarded_lines++;
+    }
+    else {
+        if (r->truncated) {
+            r->pending.truncated_lines++;
+        }
+        if (r->config.on_line != NULL) {
+            r->config.on_line(line->text, line->len, r->config.ctx);
+            r->pending.lines++;
+        }
+        else if (xQueueSend(r->lines, line, 0) == pdTRUE) {
+            r->pending.lines++;
+        }
+        else {
+            r->pending.dropped_lines++;
+        }
+    }
+    line->len = 0;
+    r->broken = false;
+    r->truncated = false;
+}
+
+// Split a chunk into lines. Runs between terminators are copied whole, not a byte at a time
+static void split(line_reader_t* r, const uint8_t* data, size_t len) {
+    const size_t max_line = r->config.max_line;
+    size_t i = 0;
+
+    while (i < len) {
+        // The '\n' of a "\r\n" split across two chunks
+        if (r->after_cr) {
+            r->after_cr = false;
+            if (data[i] == '\n') {
+                i++;
+                continue;
+            }
+        }
+        size_t end = i;
+        while (end < len && data[end] != '\r' && data[end] != '\n') {
+            end++;
+        }
+
+        line_reader_item_t* line = r->line;
+        size_t n = end - i;
+        if (n > max_line - line->len) {
+            n = max_line - line->len;
+            r->truncated = true;
+        }
+        memcpy(&line->text[line->len], &data[i], n);
+        line->len += n;
+
+        if (end == len) {
+            break;
+        }
+        r->after_cr = (data[end] == '\r');
+        end_line(r);
+        i = end + 1;
+    }
+}
+
+// Read and split up to len bytes, a chunk at a time
+static void read_bytes(line_reader_t* r, uint8_t* chunk, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        size_t want = (len - total < CHUNK_LEN) ? len - total : CHUNK_LEN;
+        size_t n = line_source_read(r->source, chunk, want);
+        if (n == 0) {
+            break;
+        }
+        r->pending.reads++;
+        r->pending.bytes += n;
+        split(r, chunk, n);
+        total += n;
+    }
+}
+
+static void line_reader_task(void* param) {
+    line_reader_t* r = param;
+    uint8_t chunk[CHUNK_LEN];
+    size_t len;
+
+    while (true) {
+        line_source_event_t event = line_source_wait(r->source, &len, portMAX_DELAY);
+        if (event == LINE_SOURCE_NONE) {
+            continue;
+        }
+        int64_t start = esp_timer_get_time();
+        r->pending.wakeups++;
+
+        while (true) {
+            // Events in order, each DATA for just its own bytes, so an overflow lands between the
+            // bytes from before and after it. Reading ahead would pass on a line with a hole in it
+            do {
+                if (event == LINE_SOURCE_DATA) {
+                    read_bytes(r, chunk, len);
+                }
+                else if (event == LINE_SOURCE_OVERFLOW) {
+                    r->pending.overflows++;
+                    r->broken = true;
+                }
+                else if (event == LINE_SOURCE_ERROR) {
+                    r->pending.errors++;
+                }
+                event = line_source_wait(r->source, &len, 0);
+            } while (event != LINE_SOURCE_NONE);
+
+            // Bytes can be buffered without an event left for them: the driver drops events when
+            // the queue's full, not bytes. Count them, then check the queue's still empty. Every
+            // byte counted had its event queued already, so if none is left no overflow came
+            // after them yet and they're all safe to read. Anything newer waits for its event
+            size_t buffered = line_source_buffered(r->source);
+            event = line_source_wait(r->source, &len, 0);
+            if (event == LINE_SOURCE_NONE) {
+                read_bytes(r, chunk, buffered);
+                break;
+            }
+        }
+
+        r->pending.busy_us += esp_timer_get_time() - start;
+        portENTER_CRITICAL(&r->lock);
+        add_stats(&r->stats, &r->pending);
+        portEXIT_CRITICAL(&r->lock);
+        memset(&r->pending, 0, sizeof(r->pending));
+    }
+}
+
+static void line_reader_free(line_reader_t* r) {
+    if (r->lines != NULL) {
+        vQueueDelete(r->lines);
+    }
+    if (r->source != NULL) {
+        line_source_close(r->source);
+    }
+    free(r->line);
+    free(r->received);
+    free(r);
+}
+
+esp_err_t line_reader_start(const line_reader_config_t* config, line_reader_t** out) {
+    if (config == NULL || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    line_reader_t* r = calloc(1, sizeof(line_reader_t));
+    if (r == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    r->config = *config;
+    if (r->config.max_line == 0) {
+        r->config.max_line = LINE_READER_DEFAULT_MAX_LINE;
+    }
+    if (r->config.queue_len == 0) {
+        r->config.queue_len = LINE_READER_DEFAULT_QUEUE_LEN;
+    }
+    if (r->config.rx_buffer_size == 0) {
+        r->config.rx_buffer_size = LINE_READER_DEFAULT_RX_BUF;
+    }
+    if (r->config.task_stack == 0) {
+        r->config.task_stack = LINE_READER_DEFAULT_STACK;
+    }
+    portMUX_INITIALIZE(&r->lock);
+    r->item_size = sizeof(line_reader_item_t) + r->config.max_line + 1;
+
+    r->line = calloc(1, r->item_size);
+    if (r->config.on_line == NULL) {
+        r->received = malloc(r->item_size);
+        r->lines = xQueueCreate(r->config.queue_len, r->item_size);
+    }
+    if (r->line == NULL || (r->config.on_line == NULL && (r->received == NULL || r->lines == NULL))) {
+        line_reader_free(r);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = line_source_open(&r->config, &r->source);
+    if (err != ESP_OK) {
+        line_reader_free(r);
+        return err;
+    }
+    if (xTaskCreate(line_reader_task, "Line reader", r->config.task_stack, r, r->config.task_priority, &r->task) != pdPASS) {
+        line_reader_free(r);
+        return ESP_ERR_NO_MEM;
+    }
+    *out = r;
+    return ESP_OK;
+}
+
+esp_err_t line_reader_stop(line_reader_t* r) {
+    if (r == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // The task has to go first since it may be blocked on the driver's queue
+    vTaskDelete(r->task);
+    line_reader_free(r);
+    return ESP_OK;
+}
+
+bool line_reader_receive(line_reader_t* r, char* line, size_t max, TickType_t wait) {
+    if (r->lines == NULL || max == 0 || xQueueReceive(r->lines, r->received, wait) != pdTRUE) {
+        return false;
+    }
+    size_t len = (r->received->len < max - 1) ? r->received->len : max - 1;
+    memcpy(line, r->received->text, len);
+    line[len] = '\0';
+    return true;
+}
+
+void line_reader_get_stats(line_reader_t* r, line_reader_stats_t* out) {
+    portENTER_CRITICAL(&r->lock);
+    *out = r->stats;
+    portEXIT_CRITICAL(&r->lock);
+}
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+void line_reader_mock_rx(line_reader_t* r, const uint8_t* data, size_t len) {
+    line_source_mock_rx(r->source, data, len);
+}
+#endif
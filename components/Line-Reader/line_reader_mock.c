@@ -0,0 +1,151 @@
+/**
+ * Mock line source for the linux target. line_reader_mock_rx plays the far end of the wire:
+ * bytes go out at baud_rate, 10 bits each, and are handed over the way the UART driver does
+ * it, FIFO_THRESHOLD at a time as the FIFO fills and whatever's left once the line has been
+ * quiet for RX_TIMEOUT characters. Each hand-over copies the bytes into a ring of
+ * rx_buffer_size and posts a DATA event for them, both under the lock so the reader never sees
+ * bytes before their event, like the driver's interrupt. Bytes the ring has no room for are lost and
+ * an OVERFLOW event posted after the DATA for the ones that fit, like the FIFO overflowing
+ * while the driver's buffer is full. Only one until the reader reads again, the way the FIFO
+ * only overflows once while it stays full.
+ */
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "line_reader_priv.h"
+
+#define FIFO_THRESHOLD 120      // The driver's default rxfifo_full_thresh
+#define RX_TIMEOUT 10           // And rx_timeout_thresh, in characters
+#define EVENT_QUEUE_LEN 20
+#define US_PER_TICK (1000000 / configTICK_RATE_HZ)
+
+struct line_source {
+    uint8_t* ring;
+    size_t size;
+    size_t head;                // Next byte to read
+    size_t count;
+    bool overflowed;            // Bytes were lost since the last read
+    portMUX_TYPE lock;
+    QueueHandle_t events;       // mock_event_t
+    uint32_t baud_rate;
+};
+
+typedef struct {
+    line_source_event_t type;
+    size_t len;
+} mock_event_t;
+
+
+esp_err_t line_source_open(const line_reader_config_t* config, line_source_t** out) {
+    if (config->baud_rate == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    line_source_t* s = calloc(1, sizeof(line_source_t));
+    if (s == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s->size = config->rx_buffer_size;
+    s->baud_rate = config->baud_rate;
+    portMUX_INITIALIZE(&s->lock);
+    s->ring = malloc(s->size);
+    s->events = xQueueCreate(EVENT_QUEUE_LEN, sizeof(mock_event_t));
+    if (s->ring == NULL || s->events == NULL) {
+        line_source_close(s);
+        return ESP_ERR_NO_MEM;
+    }
+    *out = s;
+    return ESP_OK;
+}
+
+void line_source_close(line_source_t* s) {
+    if (s->events != NULL) {
+        vQueueDelete(s->events);
+    }
+    free(s->ring);
+    free(s);
+}
+
+line_source_event_t line_source_wait(line_source_t* s, size_t* len, TickType_t wait) {
+    mock_event_t event;
+    if (xQueueReceive(s->events, &event, wait) != pdTRUE) {
+        return LINE_SOURCE_NONE;
+    }
+    *len = event.len;
+    return event.type;
+}
+
+size_t line_source_read(line_source_t* s, uint8_t* buf, size_t len) {
+    portENTER_CRITICAL(&s->lock);
+    if (len > s->count) {
+        len = s->count;
+    }
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = s->ring[(s->head + i) % s->size];
+    }
+    s->head = (s->head + len) % s->size;
+    s->count -= len;
+    s->overflowed = false;
+    portEXIT_CRITICAL(&s->lock);
+    return len;
+}
+
+size_t line_source_buffered(line_source_t* s) {
+    portENTER_CRITICAL(&s->lock);
+    size_t count = s->count;
+    portEXIT_CRITICAL(&s->lock);
+    return count;
+}
+
+// Sleep off whole ticks, then spin the rest so chunks land on time at high baud rates
+static void wait_until(int64_t due_us) {
+    int64_t now = esp_timer_get_time();
+    if (due_us - now >= US_PER_TICK) {
+        vTaskDelay((TickType_t)((due_us - now) / US_PER_TICK));
+    }
+    while (esp_timer_get_time() < due_us) {
+    }
+}
+
+// What the driver's RX interrupt does with a FIFO's worth of bytes
+static void hand_over(line_source_t* s, const uint8_t* data, size_t len) {
+    portENTER_CRITICAL(&s->lock);
+    size_t room = s->size - s->count;
+    size_t n = (len < room) ? len : room;
+    size_t tail = s->head + s->count;
+    for (size_t i = 0; i < n; i++) {
+        s->ring[(tail + i) % s->size] = data[i];
+    }
+    s->count += n;
+    bool overflow = (n < len && !s->overflowed);
+    s->overflowed |= (n < len);
+
+    // Like the driver, an event that finds the queue full is lost. The bytes aren't
+    if (n > 0) {
+        mock_event_t event = {LINE_SOURCE_DATA, n};
+        xQueueSend(s->events, &event, 0);
+    }
+    if (overflow) {
+        mock_event_t event = {LINE_SOURCE_OVERFLOW, 0};
+        xQueueSend(s->events, &event, 0);
+    }
+    portEXIT_CRITICAL(&s->lock);
+}
+
+void line_source_mock_rx(line_source_t* s, const uint8_t* data, size_t len) {
+    const int64_t start = esp_timer_get_time();
+    size_t sent = 0;
+
+    while (sent < len) {
+        size_t n = len - sent;
+        size_t chars = n + RX_TIMEOUT;
+        if (n >= FIFO_THRESHOLD) {
+            n = FIFO_THRESHOLD;
+            chars = n;
+        }
+        wait_until(start + (int64_t)(sent + chars) * 10 * 1000000 / s->baud_rate);
+        hand_over(s, &data[sent], n);
+        sent += n;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "line_reader.h"
+
+/**
+ * What the reader task needs from wherever the bytes come from. line_reader_uart.c implements
+ * it on the UART driver, line_reader_mock.c on a mock wire for the linux target.
+ */
+
+typedef enum {
+    LINE_SOURCE_NONE = 0,       // Timed out
+    LINE_SOURCE_DATA,           // Bytes to read
+    LINE_SOURCE_OVERFLOW,       // Bytes were lost after the ones the DATA events so far were for
+    LINE_SOURCE_ERROR,          // Framing, parity or break. Whatever's buffered is still good
+} line_source_event_t;
+
+typedef struct line_source line_source_t;
+
+// Install the driver (or set up the mock) for config->uart_num
+esp_err_t line_source_open(const line_reader_config_t* config, line_source_t** source);
+void line_source_close(line_source_t* source);
+// Wait up to wait ticks for the next event. For DATA, len is how many bytes it's for
+line_source_event_t line_source_wait(line_source_t* source, size_t* len, TickType_t wait);
+// Read up to len buffered bytes without waiting. Returns how many
+size_t line_source_read(line_source_t* source, uint8_t* buf, size_t len);
+// How many bytes are buffered. Every one of them already has its DATA event queued (or lost)
+size_t line_source_buffered(line_source_t* source);
+
+struct line_reader {
+    line_reader_config_t config;
+    line_source_t* source;
+    TaskHandle_t task;
+    QueueHandle_t lines;        // Queue only: line_reader_item_t of item_size bytes each
+    size_t item_size;
+    struct line_reader_item* line;      // Line being put together. Handed to the queue as is
+    struct line_reader_item* received;  // line_reader_receive's copy out of the queue
+    bool after_cr;              // Last byte was '\r', so a '\n' straight after doesn't end another line
+    bool broken;                // An overflow took bytes out of the line being put together
+    bool truncated;             // It ran past max_line
+    line_reader_stats_t pending;    // Counted by the reader task, added to stats once per wake-up
+    line_reader_stats_t stats;
+    portMUX_TYPE lock;
+};
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+// Mock only: the wire end of line_reader_mock_rx
+void line_source_mock_rx(line_source_t* source, const uint8_t* data, size_t len);
+#endif
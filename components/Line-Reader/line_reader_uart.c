@@ -0,0 +1,89 @@
+/**
+ * UART line source. Installs the driver with an event queue and passes its events on.
+ * UART_DATA is for the bytes the driver just moved into its buffer. UART_BUFFER_FULL means
+ * there are bytes to read too: with the buffer full the driver holds the rest back in the FIFO
+ * until there's room, so nothing's lost yet and what was buffered when the event was taken can
+ * be read. Not more: bytes after it may come after an overflow whose event is still queued.
+ * Bytes are lost when the FIFO overflows too (UART_FIFO_OVF). The driver resets the FIFO then,
+ * but the bytes it buffered before that are good, so nothing's flushed.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/uart.h"
+#include "line_reader_priv.h"
+
+#define EVENT_QUEUE_LEN 20
+
+struct line_source {
+    uart_port_t port;
+    QueueHandle_t events;       // uart_event_t, created by the driver
+};
+
+
+esp_err_t line_source_open(const line_reader_config_t* config, line_source_t** out) {
+    line_source_t* s = calloc(1, sizeof(line_source_t));
+    if (s == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s->port = config->uart_num;
+    esp_err_t err = uart_driver_install(s->port, config->rx_buffer_size, config->tx_buffer_size,
+                                        EVENT_QUEUE_LEN, &s->events, 0);
+    if (err != ESP_OK) {
+        free(s);
+        return err;
+    }
+    *out = s;
+    return ESP_OK;
+}
+
+void line_source_close(line_source_t* s) {
+    uart_driver_delete(s->port);
+    free(s);
+}
+
+line_source_event_t line_source_wait(line_source_t* s, size_t* len, TickType_t wait) {
+    uart_event_t event;
+    if (xQueueReceive(s->events, &event, wait) != pdTRUE) {
+        return LINE_SOURCE_NONE;
+    }
+    switch (event.type) {
+        case UART_DATA:
+            *len = event.size;
+            return LINE_SOURCE_DATA;
+        case UART_BUFFER_FULL:
+            *len = line_source_buffered(s);
+            return LINE_SOURCE_DATA;
+        case UART_FIFO_OVF:
+            return LINE_SOURCE_OVERFLOW;
+        case UART_BREAK:
+        case UART_PARITY_ERR:
+        case UART_FRAME_ERR:
+            return LINE_SOURCE_ERROR;
+        default:
+            return LINE_SOURCE_NONE;
+    }
+}
+
+// The driver moves bytes in and queues their event in the same interrupt, so no task sees one
+// without the other
+size_t line_source_buffered(line_source_t* s) {
+    size_t buffered = 0;
+    if (uart_get_buffered_data_len(s->port, &buffered) != ESP_OK) {
+        return 0;
+    }
+    return buffered;
+}
+
+size_t line_source_read(line_source_t* s, uint8_t* buf, size_t len) {
+    size_t buffered = line_source_buffered(s);
+    if (buffered == 0) {
+        return 0;
+    }
+    if (len > buffered) {
+        len = buffered;
+    }
+    int n = uart_read_bytes(s->port, buf, len, 0);
+    return (n > 0) ? (size_t)n : 0;
+}